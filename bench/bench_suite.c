@@ -0,0 +1,492 @@
+#include "../src/pipe_networking.h"
+#include "../src/server_hub.h"
+
+#include <time.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/**
+ * bench_suite [-c max clients] [-r rounds] [-m flood MB] [-n commands] [server binary] [server options]
+ *
+ * Runs every measurement against a fresh server for 1, 2, 4, ... clients, up to max clients
+ * (MAX_CLIENTS by default). Every client is connected with client_handshake(), and they are
+ * all read by this one process with poll(), so the sweep can go up to thousands of clients.
+ * The first client types every command, and a run ends once every client has seen
+ * the marker "<n>" that the command prints last.
+ *
+ *  - echo_latency: time from typing a printf to its output reaching each client
+ *  - flood_yes / flood_cat: MB/s that each client receives while the shell floods output
+ *  - commands_builtin / commands_spawn: lines per second the shell runs, and every client sees
+ *
+ * Every measurement is printed as a single line of key=value pairs, so that runs
+ * can be compared against a baseline with a script. The server options are passed
+ * to every server, so that different settings can be compared.
+ */
+
+#define DEFAULT_ROUNDS 200
+#define DEFAULT_FLOOD_MB 64
+#define DEFAULT_COMMANDS 1000
+
+// A flood is split across every client, but never gets smaller than this
+#define FLOOD_MIN_BYTES (1 << 20)
+
+#define ROUND_TIMEOUT_MS 1000
+#define RUN_TIMEOUT_MS 30000
+
+// Largest frame of commands that is typed at once
+#define TYPE_FRAME_SIZE 4096
+
+struct bench_client
+{
+    int from;
+    int to;
+    struct frame_reader reader;
+
+    // Where the client is in reading a marker
+    int in_marker;
+    int digits;
+    long number;
+
+    // Bytes of output received, and when the marker of the current run showed up
+    long long bytes;
+    long long done_at;
+};
+
+struct bench
+{
+    struct bench_client* clients;
+    struct pollfd* polls;
+    int count;
+
+    // Frames that the first client still has to type
+    char* out;
+    size_t out_length;
+    size_t out_sent;
+    size_t out_capacity;
+    uint32_t sequence;
+
+    // The marker that ends the current run
+    long marker;
+};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void* a, const void* b)
+{
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Connect to the server, retrying until the server has created its WKP
+static int connect_client(int* to_server)
+{
+    int from_server, tries;
+
+    for(tries = 0; tries < 1000; ++tries)
+    {
+        from_server = client_handshake(to_server, DEFAULT_SESSION);
+        if(from_server >= 0) return from_server;
+        usleep(5000);
+    }
+
+    return -1;
+}
+
+// Queue text to be typed by the first client, split into frames
+static void bench_type(struct bench* bench, const char* text, size_t length)
+{
+    struct frame_header header;
+    size_t size;
+
+    while(length)
+    {
+        size = length < TYPE_FRAME_SIZE ? length : TYPE_FRAME_SIZE;
+
+        if(bench->out_length + sizeof(header) + size > bench->out_capacity)
+        {
+            bench->out_capacity = 2 * (bench->out_length + sizeof(header) + size);
+            bench->out = realloc(bench->out, bench->out_capacity);
+        }
+
+        frame_header_init(&header, FRAME_DATA, bench->sequence++, size);
+        memcpy(bench->out + bench->out_length, &header, sizeof(header));
+        memcpy(bench->out + bench->out_length + sizeof(header), text, size);
+        bench->out_length += sizeof(header) + size;
+
+        text += size;
+        length -= size;
+    }
+}
+
+// Count the output of a client, and look for the marker of the current run
+static void bench_scan(struct bench* bench, struct bench_client* client, const char* payload, uint32_t length)
+{
+    uint32_t i;
+    char c;
+
+    client->bytes += length;
+
+    for(i = 0; i < length; ++i)
+    {
+        c = payload[i];
+
+        if(c == '<')
+        {
+            client->in_marker = 1;
+            client->digits = 0;
+            client->number = 0;
+        }
+        else if(client->in_marker && c >= '0' && c <= '9')
+        {
+            client->number = client->number * 10 + c - '0';
+            ++client->digits;
+        }
+        else
+        {
+            if(client->in_marker && c == '>' && client->digits && client->number == bench->marker && client->done_at == 0)
+                client->done_at = now_ns();
+
+            client->in_marker = 0;
+        }
+    }
+}
+
+/**
+ * Type everything that was queued, and read every client until they have all seen
+ * the marker or the timeout runs out. Returns the number of clients that saw it.
+ */
+static int bench_run(struct bench* bench, int timeout_ms)
+{
+    long long deadline = now_ns() + timeout_ms * 1000000LL;
+    struct bench_client* client;
+    struct frame frame;
+    ssize_t written;
+    int i, done, closed, filled;
+
+    for(i = 0; i < bench->count; ++i)
+    {
+        bench->clients[i].bytes = 0;
+        bench->clients[i].done_at = 0;
+    }
+
+    while(1)
+    {
+        for(i = 0, done = 0, closed = 0; i < bench->count; ++i)
+        {
+            done += bench->clients[i].done_at != 0;
+            closed += bench->clients[i].from < 0;
+            bench->polls[i].fd = bench->clients[i].done_at ? -1 : bench->clients[i].from;
+            bench->polls[i].events = POLLIN;
+        }
+
+        if(done + closed == bench->count || now_ns() > deadline) break;
+
+        bench->polls[bench->count].fd = bench->out_sent < bench->out_length ? bench->clients[0].to : -1;
+        bench->polls[bench->count].events = POLLOUT;
+
+        if(poll(bench->polls, bench->count + 1, 100) < 0 && errno != EINTR) break;
+
+        if(bench->polls[bench->count].revents)
+        {
+            written = write(bench->clients[0].to, bench->out + bench->out_sent, bench->out_length - bench->out_sent);
+            if(written > 0) bench->out_sent += written;
+            else if(errno != EAGAIN) break;
+        }
+
+        for(i = 0; i < bench->count; ++i)
+        {
+            client = &bench->clients[i];
+            if(bench->polls[i].fd < 0 || bench->polls[i].revents == 0) continue;
+
+            filled = frame_reader_fill(&client->reader, client->from);
+            if(filled <= 0)
+            {
+                if(filled < 0 && errno == EAGAIN) continue;
+
+                close(client->from);
+                client->from = -1;
+                continue;
+            }
+
+            while(frame_reader_next(&client->reader, &frame))
+                if(frame.type == FRAME_DATA) bench_scan(bench, client, frame.payload, frame.length);
+        }
+    }
+
+    bench->out_length = bench->out_sent = 0;
+    return done;
+}
+
+// Queue a command followed by the marker of a new run, and run it
+static int bench_command(struct bench* bench, const char* command, int timeout_ms)
+{
+    char line[128];
+    int length;
+
+    ++bench->marker;
+    length = snprintf(line, sizeof(line), "%s%sprintf '<%%d>\\n' %ld\n", command, *command ? " ; " : "", bench->marker);
+    bench_type(bench, line, length);
+
+    return bench_run(bench, timeout_ms);
+}
+
+static void measure_latency(struct bench* bench, int rounds)
+{
+    long long *samples = malloc((size_t)rounds * bench->count * sizeof(long long)), start;
+    long measured = 0, lost = 0;
+    int r, i;
+
+    for(r = 0; r < rounds; ++r)
+    {
+        start = now_ns();
+        bench_command(bench, "", ROUND_TIMEOUT_MS);
+
+        for(i = 0; i < bench->count; ++i)
+        {
+            if(bench->clients[i].done_at) samples[measured++] = bench->clients[i].done_at - start;
+            else ++lost;
+        }
+    }
+
+    if(measured)
+    {
+        qsort(samples, measured, sizeof(long long), compare_ll);
+        printf("test=echo_latency clients=%d samples=%ld lost=%ld p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n",
+            bench->count, measured, lost,
+            samples[measured / 2] / 1000.0,
+            samples[measured * 99 / 100] / 1000.0,
+            samples[measured * 999 / 1000] / 1000.0,
+            samples[measured - 1] / 1000.0
+        );
+    }
+    else printf("test=echo_latency clients=%d samples=0 lost=%ld\n", bench->count, lost);
+
+    fflush(stdout);
+    free(samples);
+}
+
+static void measure_flood(struct bench* bench, const char* name, const char* command, long long size)
+{
+    long long start, elapsed, least = -1, longest = 0, total = 0;
+    double rate, sum = 0, slowest = -1, fastest = 0;
+    int i, done;
+
+    start = now_ns();
+    done = bench_command(bench, command, RUN_TIMEOUT_MS);
+
+    for(i = 0; i < bench->count; ++i)
+    {
+        if(least < 0 || bench->clients[i].bytes < least) least = bench->clients[i].bytes;
+        total += bench->clients[i].bytes;
+        if(bench->clients[i].done_at == 0) continue;
+
+        elapsed = bench->clients[i].done_at - start;
+        if(elapsed > longest) longest = elapsed;
+
+        rate = bench->clients[i].bytes / (elapsed / 1e9) / (1 << 20);
+        sum += rate;
+        if(slowest < 0 || rate < slowest) slowest = rate;
+        if(rate > fastest) fastest = rate;
+    }
+
+    printf("test=%s clients=%d bytes=%lld received_min=%lld lost=%d mbps_mean=%.1f mbps_min=%.1f mbps_max=%.1f aggregate_mbps=%.1f\n",
+        name, bench->count, size, least, bench->count - done,
+        done ? sum / done : 0, slowest < 0 ? 0 : slowest, fastest,
+        longest ? total / (longest / 1e9) / (1 << 20) : 0
+    );
+    fflush(stdout);
+}
+
+static void measure_commands(struct bench* bench, const char* name, const char* command, int commands)
+{
+    char line[64];
+    long long start, elapsed;
+    int i, length, done;
+
+    length = snprintf(line, sizeof(line), "%s\n", command);
+    for(i = 0; i < commands; ++i) bench_type(bench, line, length);
+
+    start = now_ns();
+    done = bench_command(bench, "", RUN_TIMEOUT_MS);
+
+    for(i = 0, elapsed = 0; i < bench->count; ++i)
+        if(bench->clients[i].done_at - start > elapsed) elapsed = bench->clients[i].done_at - start;
+
+    printf("test=%s clients=%d commands=%d lost=%d commands_per_sec=%.0f\n",
+        name, bench->count, commands + 1, bench->count - done,
+        done == bench->count ? (commands + 1) / (elapsed / 1e9) : 0
+    );
+    fflush(stdout);
+}
+
+// Write a file of printable lines for cat to flood with
+static int write_flood_file(const char* path, long long size)
+{
+    char line[80];
+    long long written;
+    int fd, i;
+
+    for(i = 0; i < (int)sizeof(line) - 1; ++i) line[i] = 'a' + i % 26;
+    line[sizeof(line) - 1] = '\n';
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return -1;
+
+    for(written = 0; written < size; written += sizeof(line))
+        write(fd, line, size - written < (long long)sizeof(line) ? size - written : (long long)sizeof(line));
+
+    close(fd);
+    return 0;
+}
+
+/**
+ * Start a server, connect every client, run every measurement, and stop the server again
+ */
+static void sweep_point(char** server_argv, int clients, int rounds, long long flood_total, int commands)
+{
+    struct bench bench = {};
+    char command[128];
+    long long flood;
+    int i, null_fd, saved_stderr;
+    pid_t server;
+
+    server = fork();
+    if(server == 0)
+    {
+        // Put the server and its children in their own group, so they can all be killed together
+        setpgid(0, 0);
+        dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+        execv(server_argv[0], server_argv);
+        exit(-1);
+    }
+
+    bench.clients = calloc(clients, sizeof(struct bench_client));
+    bench.polls = calloc(clients + 1, sizeof(struct pollfd));
+
+    // The handshake prints every step, which would drown out the results
+    null_fd = open("/dev/null", O_WRONLY);
+    saved_stderr = dup(STDERR_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+
+    for(bench.count = 0; bench.count < clients; ++bench.count)
+    {
+        bench.clients[bench.count].from = connect_client(&bench.clients[bench.count].to);
+        if(bench.clients[bench.count].from < 0) break;
+
+        fcntl(bench.clients[bench.count].from, F_SETFL, O_NONBLOCK);
+        fcntl(bench.clients[bench.count].to, F_SETFL, O_NONBLOCK);
+        frame_reader_init(&bench.clients[bench.count].reader);
+    }
+
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    close(null_fd);
+
+    if(bench.count < clients) fprintf(stderr, "only %d of %d clients connected\n", bench.count, clients);
+
+    // The shell has to have started and shown its prompt before anything is measured
+    if(bench.count && bench_command(&bench, "", RUN_TIMEOUT_MS) == bench.count)
+    {
+        measure_latency(&bench, rounds);
+
+        flood = flood_total / bench.count;
+        if(flood < FLOOD_MIN_BYTES) flood = FLOOD_MIN_BYTES;
+
+        snprintf(command, sizeof(command), "yes | head -c %lld", flood);
+        measure_flood(&bench, "flood_yes", command, flood);
+
+        write_flood_file("flood.txt", flood);
+        measure_flood(&bench, "flood_cat", "cat flood.txt", flood);
+        remove("flood.txt");
+
+        measure_commands(&bench, "commands_builtin", "echo ok", commands);
+        measure_commands(&bench, "commands_spawn", "/bin/echo ok", commands);
+    }
+    else if(bench.count) fprintf(stderr, "the shell never answered with %d clients\n", bench.count);
+
+    kill(-server, SIGKILL);
+    waitpid(server, NULL, 0);
+    remove(WKP);
+
+    for(i = 0; i < bench.count; ++i)
+    {
+        if(bench.clients[i].from >= 0) close(bench.clients[i].from);
+        close(bench.clients[i].to);
+        frame_reader_free(&bench.clients[i].reader);
+    }
+
+    free(bench.clients);
+    free(bench.polls);
+    free(bench.out);
+}
+
+int main(int argc, char** argv)
+{
+    char dir[] = "/tmp/bench_suite_XXXXXX";
+    char server_path[4096];
+    int opt, clients, max_clients = MAX_CLIENTS, rounds = DEFAULT_ROUNDS, flood_mb = DEFAULT_FLOOD_MB, commands = DEFAULT_COMMANDS;
+    struct rlimit files;
+
+    while((opt = getopt(argc, argv, "+c:r:m:n:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'c': max_clients = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 'm': flood_mb = atoi(optarg); break;
+            case 'n': commands = atoi(optarg); break;
+
+            default:
+                fprintf(stderr, "usage: %s [-c max clients] [-r rounds] [-m flood MB] [-n commands] [server binary] [server options]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-c max clients] [-r rounds] [-m flood MB] [-n commands] [server binary] [server options]\n", argv[0]);
+        return 1;
+    }
+
+    realpath(argv[optind], server_path);
+    argv[optind] = server_path;
+
+    if(max_clients < 1) max_clients = 1;
+    if(max_clients > MAX_CLIENTS) max_clients = MAX_CLIENTS;
+    if(rounds < 1) rounds = 1;
+
+    // Every client needs both ends of its pipes open
+    if(getrlimit(RLIMIT_NOFILE, &files) == 0)
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+
+        if((rlim_t)max_clients * 2 + 64 > files.rlim_cur)
+        {
+            max_clients = (files.rlim_cur - 64) / 2;
+            fprintf(stderr, "only sweeping up to %d clients, the file descriptor limit is %llu\n", max_clients, (unsigned long long)files.rlim_cur);
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Run the server from a temporary directory so the WKP can't collide with a real one
+    mkdtemp(dir);
+    chdir(dir);
+
+    // Powers of 2, and then max clients itself
+    for(clients = 1;; clients = clients * 2 < max_clients ? clients * 2 : max_clients)
+    {
+        sweep_point(argv + optind, clients, rounds, (long long)flood_mb << 20, commands);
+        if(clients == max_clients) break;
+    }
+
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include "../src/shell.h"
+#include "parse_corpus.h"
+
+#include <time.h>
+#include <sys/resource.h>
+
+/**
+ * parse_bench [-t ms per group] [-f corpus file] [-w]
+ *
+ * Parses every group of lines in parse_corpus.h with shell_line_create() and shell_line_free(),
+ * first with the parse cache off, so every line is lexed and parsed from scratch,
+ * and then with it on, which is what the shell does when a line is typed again.
+ * Every group is repeated until it has run for the given time, and prints one line of
+ * key=value pairs: the time and the number of allocations for every line, and how fast it parses.
+ * Lines made of builtins are then run through shell_execute_line(), to time the executor
+ * without starting any processes. The peak RSS of the whole run is printed last.
+ *
+ * -f times the lines of a file instead, one per line, and -w writes out the built in corpus,
+ * so a corpus can be saved, edited and replayed against another build.
+ *
+ * malloc, calloc and realloc are wrapped by the linker, see the makefile,
+ * so every allocation the parser makes is counted.
+ */
+
+#define DEFAULT_GROUP_MS 200
+
+// Counted by the wrappers, and read around every timed run
+static long long allocations = 0;
+static long long allocated_bytes = 0;
+
+void* __real_malloc(size_t);
+void* __real_calloc(size_t, size_t);
+void* __real_realloc(void*, size_t);
+
+void* __wrap_malloc(size_t size)
+{
+    ++allocations;
+    allocated_bytes += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    ++allocations;
+    allocated_bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* memory, size_t size)
+{
+    ++allocations;
+    allocated_bytes += size;
+    return __real_realloc(memory, size);
+}
+
+// Lines of builtins, which run inside of the shell without forking
+static const char* executor_lines[] =
+{
+    "true a b c\n",
+    "test -n abc\n",
+    "[ 1 -lt 2 ]\n",
+    "echo hi > /dev/null\n",
+    "printf '%s\\n' a b c >> /dev/null\n",
+    "true; false; true\n",
+};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief time a group of lines, and print how it did
+ *
+ * every round goes through the whole group once, and rounds are run until
+ * the group has taken at least group_ns. the lines are parsed once before the clock starts,
+ * so the arena that is kept between lines and the cache are already warm.
+ *
+ * @param group the lines to run
+ * @param phase "parse" to only parse the lines, "execute" to also run them
+ * @param cache SH_TRUE to keep the parse cache on
+ * @param group_ns how long to keep running the group for
+ */
+static void run(struct parse_corpus* group, const char* phase, int cache, long long group_ns)
+{
+    struct shell_line* line;
+    long long start, elapsed, allocations_before, bytes_before, lines = 0;
+    size_t bytes = 0;
+    int execute = strcmp(phase, "execute") == 0, i;
+
+    shell_set_parse_cache(cache);
+
+    for(i = 0; i < group->count; ++i)
+    {
+        bytes += strlen(group->lines[i]);
+        shell_line_free(shell_line_create(group->lines[i]));
+    }
+
+    allocations_before = allocations;
+    bytes_before = allocated_bytes;
+    start = now_ns();
+
+    do
+    {
+        for(i = 0; i < group->count; ++i)
+        {
+            line = shell_line_create(group->lines[i]);
+            if(execute) shell_execute_line(line);
+            shell_line_free(line);
+        }
+
+        lines += group->count;
+        elapsed = now_ns() - start;
+    } while(elapsed < group_ns);
+
+    printf("corpus=%s phase=%s cache=%s lines=%d avg_bytes=%zu rounds=%lld ns_per_line=%.0f mb_per_sec=%.1f allocs_per_line=%.3f alloc_bytes_per_line=%.0f\n",
+        group->name, phase, cache ? "on" : "off", group->count, bytes / group->count, lines / group->count,
+        (double)elapsed / lines, (double)bytes * (lines / group->count) / (elapsed / 1e9) / (1 << 20),
+        (double)(allocations - allocations_before) / lines, (double)(allocated_bytes - bytes_before) / lines);
+    fflush(stdout);
+}
+
+/**
+ * @brief read every line of a file into a group
+ *
+ * @param group the group to fill
+ * @param path the file to read
+ * @return 0 on success, -1 if the file couldn't be read or was empty
+ */
+static int read_corpus(struct parse_corpus* group, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    char* line = NULL;
+    size_t size = 0;
+
+    if(file == NULL) return -1;
+
+    group->name = "file";
+    while(getline(&line, &size, file) > 0) parse_corpus_add(group, strdup(line));
+
+    free(line);
+    fclose(file);
+    return group->count > 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+    struct parse_corpus groups[PARSE_CORPUS_MAX_GROUPS], executor;
+    struct rusage usage;
+    const char* path = NULL;
+    long long group_ns = DEFAULT_GROUP_MS * 1000000LL;
+    int opt, count, write_corpus = 0, i, j;
+
+    while((opt = getopt(argc, argv, "t:f:w")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': group_ns = atoi(optarg) * 1000000LL; break;
+            case 'f': path = optarg; break;
+            case 'w': write_corpus = 1; break;
+
+            default:
+                fprintf(stderr, "usage: %s [-t ms per group] [-f corpus file] [-w]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(path)
+    {
+        memset(groups, 0, sizeof(groups));
+        count = 1;
+
+        if(read_corpus(&groups[0], path) < 0)
+        {
+            fprintf(stderr, "unable to read a corpus from %s\n", path);
+            return 1;
+        }
+    }
+    else count = parse_corpus_build(groups);
+
+    if(write_corpus)
+    {
+        for(i = 0; i < count; ++i)
+            for(j = 0; j < groups[i].count; ++j) fputs(groups[i].lines[j], stdout);
+
+        parse_corpus_free(groups, count);
+        return 0;
+    }
+
+    for(i = 0; i < count; ++i)
+    {
+        run(&groups[i], "parse", SH_FALSE, group_ns);
+        run(&groups[i], "parse", SH_TRUE, group_ns);
+    }
+
+    executor.name = "builtins";
+    executor.lines = (char**)executor_lines;
+    executor.count = sizeof(executor_lines) / sizeof(*executor_lines);
+    if(path == NULL) run(&executor, "execute", SH_TRUE, group_ns);
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("peak_rss_kb=%ld\n", usage.ru_maxrss);
+
+    parse_corpus_free(groups, count);
+    return 0;
+}
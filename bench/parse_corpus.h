@@ -0,0 +1,155 @@
+#ifndef PARSE_CORPUS_HEADER_FILE
+#define PARSE_CORPUS_HEADER_FILE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The lines that parse_bench times and parse_fuzz starts mutating from.
+ *
+ * Every group is generated the same way every time, so numbers from different
+ * builds are comparable, and `parse_bench -w` writes them out to be replayed with -f.
+ * The groups go from what people type to what stresses each part of the lexer and parser.
+ */
+
+// Lines in every generated group, each bigger than the last
+#define PARSE_CORPUS_VARIANTS 16
+
+// Most groups a corpus has
+#define PARSE_CORPUS_MAX_GROUPS 16
+
+struct parse_corpus
+{
+    const char* name;
+    char** lines;
+    int count;
+};
+
+// What people actually type
+static const char* parse_corpus_realistic[] =
+{
+    "ls -la\n",
+    "cd ~/projects/multi_shell\n",
+    "git status\n",
+    "git commit -m \"fix the relay when a client leaves\"\n",
+    "grep -rn 'hub_session' src | sort | uniq -c | sort -rn | head -20\n",
+    "cat < input.txt | tr a-z A-Z > output.txt\n",
+    "echo \"$HOME\" 'single quoted' plain\n",
+    "find . -name '*.c' | xargs wc -l\n",
+    "sleep 1 &\n",
+    "ps aux | grep shell_server | grep -v grep\n",
+    "printf '%s %d\\n' name 42 >> log.txt\n",
+    "export PATH=/usr/local/bin:/usr/bin:/bin\n",
+    "tail -n 100 server.log | grep Client\n",
+    "ssh user@host 'uptime; df -h'\n",
+    "tar -czf backup.tgz src bench makefile README.md\n",
+    "make clean; make -j4 server client\n",
+    "make -j4 server && ./bin/shell_server -u || echo failed\n",
+};
+
+/**
+ * @brief add a generated line to a group
+ *
+ * @param group the group to add to
+ * @param line the line, which the group takes
+ */
+static void parse_corpus_add(struct parse_corpus* group, char* line)
+{
+    char** lines = realloc(group->lines, (group->count + 1) * sizeof(char*));
+    if(lines == NULL) return;
+
+    group->lines = lines;
+    group->lines[group->count++] = line;
+}
+
+/**
+ * @brief generate a group of lines, where variant v repeats its pattern (v + 1) * scale times
+ *
+ * @param group the group to fill
+ * @param name the name of the group
+ * @param head what every line starts with
+ * @param pattern what is repeated, every %d is the number of the repeat, up to 3 of them
+ * @param tail what every line ends with, before the newline
+ * @param scale how many repeats each variant adds
+ */
+static void parse_corpus_generate(struct parse_corpus* group, const char* name, const char* head, const char* pattern, const char* tail, int scale)
+{
+    FILE* stream;
+    char* line;
+    size_t size;
+    int v, i;
+
+    group->name = name;
+
+    for(v = 0; v < PARSE_CORPUS_VARIANTS; ++v)
+    {
+        stream = open_memstream(&line, &size);
+        if(stream == NULL) return;
+
+        fputs(head, stream);
+        for(i = 0; i < (v + 1) * scale; ++i) fprintf(stream, pattern, i, i, i);
+        fprintf(stream, "%s\n", tail);
+
+        fclose(stream);
+        parse_corpus_add(group, line);
+    }
+}
+
+/**
+ * @brief build every group of the corpus
+ *
+ * @param groups room for PARSE_CORPUS_MAX_GROUPS groups
+ * @return the number of groups
+ */
+static int parse_corpus_build(struct parse_corpus* groups)
+{
+    int i, count = 0;
+
+    memset(groups, 0, PARSE_CORPUS_MAX_GROUPS * sizeof(*groups));
+
+    groups[count].name = "realistic";
+    for(i = 0; i < sizeof(parse_corpus_realistic) / sizeof(*parse_corpus_realistic); ++i)
+        parse_corpus_add(&groups[count], strdup(parse_corpus_realistic[i]));
+    ++count;
+
+    // Every kind of quote, with the characters that would otherwise be special inside of them
+    parse_corpus_generate(&groups[count++], "quoting", "echo", " \"double %d; | >\" 'single %d & <' \"mixed 'inner'\" 'a\"b' \"\"", "", 4);
+
+    // Words that are mostly escapes, so the lexer can never copy a whole run at once
+    parse_corpus_generate(&groups[count++], "escapes", "echo", " a\\ b\\;c\\|d\\>e\\\\f\\'g\\\"h%d", "", 8);
+
+    // Hundreds of arguments, so argv keeps doubling
+    parse_corpus_generate(&groups[count++], "args", "cmd", " argument%d", "", 64);
+
+    // Long chains of short pipelines
+    parse_corpus_generate(&groups[count++], "chains", "", "true %d; ", "false", 16);
+
+    // Long pipelines
+    parse_corpus_generate(&groups[count++], "pipes", "cat input", " | grep -v x%d", "", 8);
+
+    // Every kind of redirect, many times over
+    parse_corpus_generate(&groups[count++], "redirects", "cmd", " < in%d > out%d >> log%d", "", 16);
+
+    // One word that never hits a delimiter, and lines that end in the middle of a quote or escape
+    parse_corpus_generate(&groups[count++], "long_word", "echo ", "abcdefghijklmnopqrstuvwxyz%d", "", 32);
+    parse_corpus_generate(&groups[count++], "unterminated", "echo", " \"open %d 'quote", " 'never closed \\", 4);
+
+    return count;
+}
+
+/**
+ * @brief free every line of every group
+ */
+static void parse_corpus_free(struct parse_corpus* groups, int count)
+{
+    int i, j;
+
+    for(i = 0; i < count; ++i)
+    {
+        for(j = 0; j < groups[i].count; ++j) free(groups[i].lines[j]);
+        free(groups[i].lines);
+    }
+}
+
+#endif
@@ -0,0 +1,331 @@
+#include "../src/shell.h"
+#include "parse_corpus.h"
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * parse_fuzz [iterations] [seed]
+ *
+ * Feeds shell_line_create() and shell_line_free() lines that are mutated from the corpus
+ * in parse_corpus.h, and checks every parsed line:
+ *
+ *  - every pipeline is as long as its list of commands, and isn't empty
+ *  - argv is NULL terminated, fits in argv_capacity, and has no NULL arguments
+ *  - every redirect has a known type and a path
+ *  - a line with a syntax error has no pipelines
+ *  - the words never add up to more than the line, as quotes and escapes only remove characters
+ *  - parsing the line again gives the same result, with the parse cache off and on,
+ *    and a cache hit gives back the same line
+ *
+ * the first line that breaks one of these is printed with its bytes escaped, and the fuzzer aborts.
+ * the same seed always makes the same lines, so a failure can be replayed.
+ *
+ * built with -DPARSE_FUZZ_LIBFUZZER and -fsanitize=fuzzer, the same checks run
+ * as a libFuzzer target instead, see LLVMFuzzerTestOneInput(...).
+ */
+
+#define DEFAULT_ITERATIONS 50000
+#define DEFAULT_SEED 1
+
+// Longest line the mutator makes
+#define FUZZ_MAX_LINE (1 << 14)
+
+/**
+ * @brief print a line with every byte that isn't printable escaped
+ */
+static void fuzz_print_line(FILE* stream, const char* text, size_t length)
+{
+    size_t i;
+
+    for(i = 0; i < length; ++i)
+    {
+        if(text[i] >= 0x20 && text[i] < 0x7f && text[i] != '\\') fputc(text[i], stream);
+        else fprintf(stream, "\\x%02x", (unsigned char)text[i]);
+    }
+
+    fputc('\n', stream);
+}
+
+/**
+ * @brief stop on a line that broke a check
+ */
+static void fuzz_fail(const char* check, const char* text)
+{
+    printf("parse_fuzz: %s: ", check);
+    fuzz_print_line(stdout, text, strlen(text));
+    fflush(stdout);
+    abort();
+}
+
+/**
+ * @brief check a parsed line, and print its structure so it can be compared
+ *
+ * @param line the parsed line
+ * @param text the text it was parsed from
+ * @param stream where the structure is printed
+ */
+static void fuzz_check(struct shell_line* line, const char* text, FILE* stream)
+{
+    struct shell_pipeline* pipeline;
+    struct shell_command* command;
+    struct shell_redirect* redirect;
+    size_t words = 0;
+    int length, i;
+
+    if(line->error)
+    {
+        if(line->pipelines) fuzz_fail("line with an error kept its pipelines", text);
+        fprintf(stream, "E[%s]", line->error);
+    }
+
+    for(pipeline = line->pipelines; pipeline; pipeline = pipeline->next_pipeline)
+    {
+        fprintf(stream, "P%d%d", pipeline->background, pipeline->condition);
+
+        for(command = pipeline->commands, length = 0; command; command = command->next_command, ++length)
+        {
+            if(command->argc < 0 || command->argc >= command->argv_capacity) fuzz_fail("argc doesn't fit in argv", text);
+            if(command->argv[command->argc] != NULL) fuzz_fail("argv isn't NULL terminated", text);
+
+            fprintf(stream, "C%d", command->argc);
+            for(i = 0; i < command->argc; ++i)
+            {
+                if(command->argv[i] == NULL) fuzz_fail("NULL argument", text);
+
+                words += strlen(command->argv[i]);
+                fprintf(stream, "[%zu:%s]", strlen(command->argv[i]), command->argv[i]);
+            }
+
+            for(redirect = command->redirects; redirect; redirect = redirect->next)
+            {
+                if(redirect->type != SH_TOKEN_REDIRECT_IN && redirect->type != SH_TOKEN_REDIRECT_OUT && redirect->type != SH_TOKEN_REDIRECT_APPEND)
+                    fuzz_fail("unknown redirect", text);
+                if(redirect->path == NULL) fuzz_fail("redirect without a path", text);
+
+                words += strlen(redirect->path);
+                fprintf(stream, "R%d[%zu:%s]", redirect->type, strlen(redirect->path), redirect->path);
+            }
+        }
+
+        if(length != pipeline->length) fuzz_fail("pipeline length doesn't match its commands", text);
+        if(length == 1 && pipeline->commands->argc == 0 && pipeline->commands->redirects == NULL) fuzz_fail("empty pipeline was kept", text);
+    }
+
+    if(words > strlen(text)) fuzz_fail("words are longer than the line", text);
+}
+
+/**
+ * @brief parse a line and print what it parsed to, into a new string
+ *
+ * @param text the line to parse
+ * @param parsed where the line is stored, if it should be kept
+ * @return the structure of the line, which has to be freed
+ */
+static char* fuzz_parse(const char* text, struct shell_line** parsed)
+{
+    struct shell_line* line = shell_line_create(text);
+    FILE* stream;
+    char* dump;
+    size_t size;
+
+    stream = open_memstream(&dump, &size);
+    if(stream == NULL) abort();
+
+    fuzz_check(line, text, stream);
+    fclose(stream);
+
+    if(parsed) *parsed = line;
+    else shell_line_free(line);
+
+    return dump;
+}
+
+/**
+ * @brief run every check on a line of input
+ *
+ * @param text the null terminated line
+ */
+static void fuzz_one(const char* text)
+{
+    struct shell_line *first, *again;
+    char *cold, *warm, *hit;
+
+    shell_set_parse_cache(SH_FALSE);
+    cold = fuzz_parse(text, NULL);
+
+    shell_set_parse_cache(SH_TRUE);
+    warm = fuzz_parse(text, &first);
+    hit = fuzz_parse(text, &again);
+
+    if(strcmp(cold, warm) != 0 || strcmp(warm, hit) != 0) fuzz_fail("parsing again gave a different line", text);
+    if(first->cached && again != first) fuzz_fail("cache hit gave back a different line", text);
+
+    shell_line_free(first);
+    if(again != first) shell_line_free(again);
+
+    free(cold);
+    free(warm);
+    free(hit);
+}
+
+#ifdef PARSE_FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    char* text = malloc(size + 1);
+    if(text == NULL) return 0;
+
+    memcpy(text, data, size);
+    text[size] = '\0';
+
+    fuzz_one(text);
+
+    free(text);
+    return 0;
+}
+
+#else
+
+// Bytes that mean something to the lexer, which the mutator prefers to insert
+static const char fuzz_special[] = " ;\n|&'\"<>\\";
+
+// xorshift64, so a seed always makes the same lines
+static uint64_t fuzz_state;
+
+static uint64_t fuzz_random()
+{
+    fuzz_state ^= fuzz_state << 13;
+    fuzz_state ^= fuzz_state >> 7;
+    fuzz_state ^= fuzz_state << 17;
+    return fuzz_state;
+}
+
+/**
+ * @brief change a line in a few random ways
+ *
+ * bytes are flipped, replaced with the bytes the lexer cares about, inserted,
+ * deleted and duplicated, and the line is sometimes cut short or joined with another one.
+ *
+ * @param line the line to change, which has room for FUZZ_MAX_LINE bytes and a null
+ * @param length the length of the line
+ * @param other another line from the corpus, to splice in
+ * @return the new length of the line
+ */
+static size_t fuzz_mutate(char* line, size_t length, const char* other)
+{
+    size_t at, size, other_length = strlen(other);
+    int changes = 1 + fuzz_random() % 8;
+
+    while(changes--)
+    {
+        at = length ? fuzz_random() % length : 0;
+
+        switch(fuzz_random() % 7)
+        {
+            // Flip a bit
+            case 0:
+                if(length) line[at] ^= 1 << fuzz_random() % 8;
+                break;
+
+            // Replace a byte with a special one
+            case 1:
+                if(length) line[at] = fuzz_special[fuzz_random() % (sizeof(fuzz_special) - 1)];
+                break;
+
+            // Insert a special byte
+            case 2:
+                if(length >= FUZZ_MAX_LINE) break;
+                memmove(line + at + 1, line + at, length - at);
+                line[at] = fuzz_special[fuzz_random() % (sizeof(fuzz_special) - 1)];
+                ++length;
+                break;
+
+            // Delete a run of bytes
+            case 3:
+                size = length ? fuzz_random() % (length - at + 1) % 16 : 0;
+                memmove(line + at, line + at + size, length - at - size);
+                length -= size;
+                break;
+
+            // Duplicate a run of bytes
+            case 4:
+                size = length ? fuzz_random() % (length - at) % 64 : 0;
+                if(length + size > FUZZ_MAX_LINE) break;
+                memmove(line + at + size, line + at, length - at);
+                length += size;
+                break;
+
+            // Cut the line short
+            case 5:
+                length = at;
+                break;
+
+            // Splice in part of another line
+            default:
+                size = other_length ? fuzz_random() % other_length : 0;
+                if(length + size > FUZZ_MAX_LINE) break;
+                memmove(line + at + size, line + at, length - at);
+                memcpy(line + at, other + other_length - size, size);
+                length += size;
+                break;
+        }
+    }
+
+    // The lexer works on null terminated lines, so a null inside just ends it early
+    line[length] = '\0';
+    return strlen(line);
+}
+
+int main(int argc, char** argv)
+{
+    struct parse_corpus groups[PARSE_CORPUS_MAX_GROUPS];
+    const char *seed_line, *other;
+    char* line = malloc(FUZZ_MAX_LINE + 1);
+    long long iterations, i, start;
+    struct timespec ts;
+    size_t length;
+    int count, group;
+
+    iterations = argc > 1 ? atoll(argv[1]) : DEFAULT_ITERATIONS;
+    fuzz_state = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_SEED;
+    if(fuzz_state == 0) fuzz_state = DEFAULT_SEED;
+
+    if(line == NULL) return 1;
+
+    // The parser complains about redirects without a file on stderr, which the mutator makes all the time
+    freopen("/dev/null", "w", stderr);
+
+    count = parse_corpus_build(groups);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    for(i = 0; i < iterations; ++i)
+    {
+        group = fuzz_random() % count;
+        seed_line = groups[group].lines[fuzz_random() % groups[group].count];
+        group = fuzz_random() % count;
+        other = groups[group].lines[fuzz_random() % groups[group].count];
+
+        length = strlen(seed_line);
+        if(length > FUZZ_MAX_LINE) length = FUZZ_MAX_LINE;
+        memcpy(line, seed_line, length);
+
+        // 1 in 8 lines is tried as it is, the rest are mutated
+        line[length] = '\0';
+        if(i % 8) length = fuzz_mutate(line, length, other);
+
+        fuzz_one(line);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    printf("iterations=%lld seed=%s failures=0 lines_per_sec=%.0f\n",
+        iterations, argc > 2 ? argv[2] : "1", iterations / ((ts.tv_sec * 1000000000LL + ts.tv_nsec - start) / 1e9));
+
+    parse_corpus_free(groups, count);
+    free(line);
+    return 0;
+}
+
+#endif
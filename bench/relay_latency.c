@@ -0,0 +1,213 @@
+#include "../src/pipe_networking.h"
+
+#include <time.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+/**
+ * relay_latency [server binary] [clients] [rounds]
+ *
+ * Starts the server in a temporary directory and connects a number of clients to it.
+ * The first client types a short token, and every other client waits until it shows up.
+ * For each round, the time until the token reached every client is recorded,
+ * and the percentiles are printed at the end. Rounds where the token never
+ * reached every client within ROUND_TIMEOUT_MS are counted as lost.
+ */
+
+#define DEFAULT_CLIENTS 2
+#define DEFAULT_ROUNDS 200
+#define ROUND_TIMEOUT_MS 1000
+
+#define TOKEN_START '\x01'
+#define TOKEN_END '\x02'
+
+struct receipt
+{
+    int client;
+    int round;
+    long long time;
+};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void* a, const void* b)
+{
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Connect to the server, retrying until the server has created its WKP
+static int connect_client(int* to_server)
+{
+    int from_server, tries;
+
+    for(tries = 0; tries < 1000; ++tries)
+    {
+        from_server = client_handshake(to_server, DEFAULT_SESSION);
+        if(from_server >= 0) return from_server;
+        usleep(5000);
+    }
+
+    return -1;
+}
+
+// Read from the server and report every token that shows up
+static void receiver(int client, int ready, int results)
+{
+    int to_server, from_server, i, in_token = 0, round = 0;
+    struct frame_reader reader;
+    struct frame frame;
+    struct receipt r;
+
+    from_server = connect_client(&to_server);
+    write(ready, &from_server, sizeof(from_server));
+    if(from_server < 0) exit(-1);
+
+    frame_reader_init(&reader);
+
+    while(frame_reader_fill(&reader, from_server) > 0)
+    {
+        while(frame_reader_next(&reader, &frame))
+        {
+            if(frame.type != FRAME_DATA) continue;
+
+            for(i = 0; i < frame.length; ++i)
+            {
+                if(frame.payload[i] == TOKEN_START) { in_token = 1; round = 0; }
+                else if(in_token && frame.payload[i] == TOKEN_END)
+                {
+                    r.client = client;
+                    r.round = round;
+                    r.time = now_ns();
+                    write(results, &r, sizeof(r));
+                    in_token = 0;
+                }
+                else if(in_token) round = round * 10 + (frame.payload[i] - '0');
+            }
+        }
+    }
+
+    exit(0);
+}
+
+int main(int argc, char** argv)
+{
+    char dir[] = "/tmp/relay_latency_XXXXXX";
+    char token[32], server_path[4096];
+    int clients, rounds, measured, i, r, seen, lost, to_server, from_server, len, status;
+    char* seen_by;
+    struct pollfd wait_for;
+    int ready[2], results[2];
+    long long start, *latency, *seen_at;
+    pid_t server, *receivers;
+    struct receipt receipt;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s [server binary] [clients] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    realpath(argv[1], server_path);
+    clients = argc > 2 ? atoi(argv[2]) : DEFAULT_CLIENTS;
+    rounds = argc > 3 ? atoi(argv[3]) : DEFAULT_ROUNDS;
+    if(clients < 2) clients = 2;
+
+    latency = calloc(rounds, sizeof(long long));
+    seen_at = calloc(rounds, sizeof(long long));
+    receivers = calloc(clients, sizeof(pid_t));
+    seen_by = calloc(clients, sizeof(char));
+
+    // Run the server from a temporary directory so the WKP can't collide with a real one
+    mkdtemp(dir);
+    chdir(dir);
+
+    server = fork();
+    if(server == 0)
+    {
+        // Put the server and its children in their own group, so they can all be killed together
+        setpgid(0, 0);
+        dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+        execl(server_path, server_path, NULL);
+        exit(-1);
+    }
+
+    pipe(ready);
+    pipe(results);
+
+    // Every client but the first one is a receiver,
+    // and they have to connect one after another
+    for(i = 1; i < clients; ++i)
+    {
+        if((receivers[i] = fork()) == 0)
+        {
+            close(ready[PIPE_OUTPUT]);
+            close(results[PIPE_OUTPUT]);
+            dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+            receiver(i, ready[PIPE_INPUT], results[PIPE_INPUT]);
+        }
+
+        read(ready[PIPE_OUTPUT], &status, sizeof(status));
+        if(status < 0) { fprintf(stderr, "client %d failed to connect\n", i); goto cleanup; }
+    }
+
+    close(results[PIPE_INPUT]);
+
+    // The first client is the sender
+    dup2(STDOUT_FILENO, STDERR_FILENO);
+    from_server = connect_client(&to_server);
+    if(from_server < 0) { fprintf(stderr, "sender failed to connect\n"); goto cleanup; }
+
+    wait_for.fd = results[PIPE_OUTPUT];
+    wait_for.events = POLLIN;
+
+    for(r = 0, lost = 0, measured = 0; r < rounds; ++r)
+    {
+        memset(seen_by, 0, clients);
+        len = sprintf(token, "%c%d%c", TOKEN_START, r, TOKEN_END);
+
+        start = now_ns();
+        frame_write(to_server, FRAME_DATA, r, token, len);
+
+        // Wait until every receiver has seen the token,
+        // only counting the first time each receiver sees it
+        for(seen = 0; seen < clients - 1;)
+        {
+            if(poll(&wait_for, 1, ROUND_TIMEOUT_MS) <= 0) break;
+            if(read(results[PIPE_OUTPUT], &receipt, sizeof(receipt)) != sizeof(receipt)) goto cleanup;
+            if(receipt.round != r || seen_by[receipt.client]) continue;
+
+            seen_by[receipt.client] = 1;
+            ++seen;
+            if(receipt.time > seen_at[r]) seen_at[r] = receipt.time;
+        }
+
+        if(seen < clients - 1) ++lost;
+        else latency[measured++] = seen_at[r] - start;
+
+        usleep(1000);
+    }
+
+    if(measured == 0) { printf("clients=%d rounds=%d lost=%d\n", clients, rounds, lost); goto cleanup; }
+
+    qsort(latency, measured, sizeof(long long), compare_ll);
+    printf("clients=%d rounds=%d lost=%d p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+        clients, rounds, lost,
+        latency[measured / 2] / 1000.0,
+        latency[measured * 99 / 100] / 1000.0,
+        latency[measured - 1] / 1000.0
+    );
+
+    cleanup:
+    kill(-server, SIGKILL);
+    for(i = 1; i < clients; ++i) if(receivers[i] > 0) kill(receivers[i], SIGKILL);
+    while(wait(NULL) > 0);
+
+    rmdir(dir);
+    return 0;
+}
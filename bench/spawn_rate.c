@@ -0,0 +1,74 @@
+#include "../src/shell.h"
+
+#include <time.h>
+
+/**
+ * spawn_rate [commands] [ballast MB]
+ *
+ * Runs the same line over and over through shell_execute_line(), once with the
+ * posix_spawn engine and once with the fork engine, and prints how many commands
+ * each one started per second. The ballast is memory that the shell touches before
+ * the run, since fork() has to copy the page tables of all of it, and posix_spawn doesn't.
+ * The same lines are then run with the true builtin, which never starts a process
+ * on its own, and only forks inside of a pipeline.
+ */
+
+#define DEFAULT_COMMANDS 2000
+#define DEFAULT_BALLAST_MB 0
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Run a line a number of times with an engine, and print the commands per second
+static void run(const char* name, int engine, const char* text, int commands_per_line, int commands, int ballast_mb)
+{
+    struct shell_line* line;
+    long long start, elapsed;
+    int i;
+
+    shell_set_engine(engine);
+
+    start = now_ns();
+    for(i = 0; i < commands; i += commands_per_line)
+    {
+        line = shell_line_create(text);
+        shell_execute_line(line);
+        shell_line_free(line);
+    }
+    elapsed = now_ns() - start;
+
+    printf("engine=%s line=\"%.*s\" ballast_mb=%d commands=%d commands_per_sec=%.0f\n",
+        name, (int)strcspn(text, "\n"), text, ballast_mb, i, i * 1e9 / elapsed);
+}
+
+int main(int argc, char** argv)
+{
+    int commands, ballast_mb;
+    char* ballast;
+
+    commands = argc > 1 ? atoi(argv[1]) : DEFAULT_COMMANDS;
+    ballast_mb = argc > 2 ? atoi(argv[2]) : DEFAULT_BALLAST_MB;
+
+    // Touch every page so that it is really mapped
+    ballast = malloc((size_t)ballast_mb << 20);
+    if(ballast_mb && ballast == NULL)
+    {
+        fprintf(stderr, "unable to allocate %d MB of ballast\n", ballast_mb);
+        return 1;
+    }
+    memset(ballast, 1, (size_t)ballast_mb << 20);
+
+    run("spawn", SH_ENGINE_SPAWN, "/bin/true\n", 1, commands, ballast_mb);
+    run("fork", SH_ENGINE_FORK, "/bin/true\n", 1, commands, ballast_mb);
+    run("builtin", SH_ENGINE_SPAWN, "true\n", 1, commands, ballast_mb);
+    run("spawn", SH_ENGINE_SPAWN, "/bin/true | /bin/true | /bin/true | /bin/true\n", 4, commands, ballast_mb);
+    run("fork", SH_ENGINE_FORK, "/bin/true | /bin/true | /bin/true | /bin/true\n", 4, commands, ballast_mb);
+    run("builtin", SH_ENGINE_SPAWN, "true | true | true | true\n", 4, commands, ballast_mb);
+
+    free(ballast);
+    return 0;
+}
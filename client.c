@@ -1,54 +1,279 @@
 #include "./src/pipe_networking.h"
+#include "./src/broadcast_ring.h"
+#include "./src/latency_trace.h"
+
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#define RING_READ_SIZE (1 << 16)
 
 int direct_read();
 
 // Handle SIGINT so that the shell can survive a ctrl+c
 static void signal_handler(int);
 
+// Remember that the terminal was resized, so the server can be told
+static void resize_handler(int);
+
+// Remember to print the latency histograms
+static void dump_handler(int);
+
+// Print the latency histograms of the client
+static void print_latency();
+
 int to_server;
 int from_server;
 
-int main() 
+uint32_t sequence;
+struct frame_reader from_server_frames;
+
+volatile sig_atomic_t resized;
+volatile sig_atomic_t dumping;
+
+// Histograms of the hops this client times, NULL unless it samples lines with -t.
+// every trace_every-th line is sampled, and trace_sent_ns is when the last one was sent
+struct latency_trace_table* trace;
+int trace_every;
+int trace_countdown;
+long long trace_sent_ns;
+
+// Shell output read straight out of the server's shared memory
+struct broadcast_ring ring;
+uint64_t ring_cursor;
+
+int main(int argc, char** argv)
 {
+    int opt, use_ring = 0, use_socket = 0, attach = 0;
+    const char* session = DEFAULT_SESSION;
+    struct timespec start, end;
+
+    while((opt = getopt(argc, argv, "muas:t:")) != -1)
+    {
+        switch(opt)
+        {
+            // Read shell output from shared memory
+            case 'm': use_ring = 1; break;
+
+            // Connect over the unix socket instead of the WKP
+            case 'u': use_socket = 1; break;
+
+            // Hand stdin and stdout to the server over the unix socket
+            case 'a': use_socket = attach = 1; break;
+
+            // Join a named session instead of the default one
+            case 's': session = optarg; break;
+
+            // Time 1 in n lines on their way through the server, see latency_trace.h
+            case 't': trace_every = atoi(optarg); break;
+
+            default:
+                fprintf(stderr, "usage: %s [-m] [-u] [-a] [-s session] [-t trace 1 in n]\n", argv[0]);
+                return 1;
+        }
+    }
+
     signal(SIGINT, signal_handler);
-    from_server = client_handshake( &to_server );
-    while(direct_read(from_server, to_server, STDIN_FILENO, STDOUT_FILENO));
+    signal(SIGWINCH, resize_handler);
+
+    if(trace_every > 0 && (trace = latency_trace_create())) signal(SIGUSR1, dump_handler);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(use_socket) from_server = client_socket_handshake( &to_server, attach, session );
+    else from_server = client_handshake( &to_server, session );
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(from_server < 0)
+    {
+        client_printf("Unable to connect to the server\n");
+        return 1;
+    }
+
+    client_printf("Connected in %ld us\n", (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000);
+    frame_reader_init(&from_server_frames);
+
+    if(use_ring && !attach) frame_write(to_server, FRAME_RING, sequence++, NULL, 0);
+
+    resize_handler(SIGWINCH);
+
+    // The server reads and writes the terminal itself, so only frames need to be handled
+    if(attach) while(direct_read(from_server, to_server, -1, STDOUT_FILENO));
+    else while(direct_read(from_server, to_server, STDIN_FILENO, STDOUT_FILENO));
+
+    if(trace) print_latency();
     signal_handler(-1);
 }
 
 // Handle SIGINT by not closing if it is the parent process
 // and exiting if it is the child. The child usually overwrites this however.
-static void signal_handler(int signal) 
+static void signal_handler(int signal)
 {
-    write(to_server, PANIC, sizeof(PANIC)); 
+    frame_write(to_server, FRAME_CLOSE, sequence++, NULL, 0);
     close(to_server); to_server = -1;
     close(from_server); from_server = -1;
     exit(0);
 }
 
+static void resize_handler(int signal)
+{
+    resized = 1;
+}
+
+static void dump_handler(int signal)
+{
+    dumping = 1;
+}
+
+// Print the histograms of the hops that only the client can time
+static void print_latency()
+{
+    dumping = 0;
+    client_printf("Latency: ");
+    latency_trace_print(stderr, trace);
+    fprintf(stderr, "\n");
+}
+
+// Send a FRAME_TRACE before every trace_every-th line, so the server times its hops too
+static void trace_line(int to_server)
+{
+    struct frame_trace sent;
+
+    if(trace == NULL || --trace_countdown > 0) return;
+    trace_countdown = trace_every;
+
+    sent.sent_ns = trace_sent_ns = latency_trace_now_ns();
+    frame_write(to_server, FRAME_TRACE, sequence++, &sent, sizeof(sent));
+}
+
+// Time the prompt that a sampled line led to, which the server sends a FRAME_TRACE right behind
+static void trace_prompt(struct frame* frame)
+{
+    struct frame_trace sent;
+    long long now = latency_trace_now_ns();
+
+    if(trace == NULL || frame->length != sizeof(sent)) return;
+    memcpy(&sent, frame->payload, sizeof(sent));
+
+    latency_trace_record(trace, TRACE_HOP_WORKER_TO_CLIENT, now - sent.sent_ns);
+    if(trace_sent_ns) latency_trace_record(trace, TRACE_HOP_ROUND_TRIP, now - trace_sent_ns);
+    trace_sent_ns = 0;
+}
+
+// Send the size of the terminal to the server
+static void send_resize(int to_server, int from_user)
+{
+    struct winsize window;
+    struct frame_resize size;
+
+    resized = 0;
+    if(ioctl(from_user, TIOCGWINSZ, &window) < 0) return;
+
+    size.rows = window.ws_row;
+    size.cols = window.ws_col;
+    frame_write(to_server, FRAME_RESIZE, sequence++, &size, sizeof(size));
+}
+
+// Write all of a buffer, even if the user's terminal or pipe only takes part of it at a time
+static int write_all(int fd, const char* buffer, int size)
+{
+    int written;
+
+    while(size > 0)
+    {
+        written = write(fd, buffer, size);
+
+        if(written < 0 && errno == EINTR) continue;
+        if(written < 0) return -1;
+
+        buffer += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+// Copy shell output from the ring to the user as soon as the server publishes it
+static void* ring_reader(void* to_user)
+{
+    static char buffer[RING_READ_SIZE];
+    uint64_t skipped = 0;
+    int read_size;
+
+    while(broadcast_ring_wait(&ring, ring_cursor, -1))
+    {
+        read_size = broadcast_ring_read(&ring, &ring_cursor, buffer, RING_READ_SIZE, &skipped);
+        if(read_size < 0) break;
+
+        if(skipped)
+        {
+            client_printf("Fell behind, skipped %llu bytes of output\n", (unsigned long long)skipped);
+            skipped = 0;
+        }
+
+        write_all(*(int*)to_user, buffer, read_size);
+    }
+
+    return NULL;
+}
+
+// Map the ring the server told us about, and start reading from it.
+// If anything goes wrong, the output keeps coming through the FIFO.
+static void start_ring_reader(struct frame* frame, int* to_user)
+{
+    struct frame_ring reply;
+    pthread_t thread;
+
+    if(frame->length != sizeof(reply))
+    {
+        client_printf("Server doesn't have a ring, using the FIFO\n");
+        return;
+    }
+
+    memcpy(&reply, frame->payload, sizeof(reply));
+    reply.name[FRAME_RING_NAME_SIZE - 1] = '\0';
+
+    if(broadcast_ring_open(&ring, reply.name) < 0)
+    {
+        client_printf("Error Opening Ring %s: %s [%d]\n", reply.name, strerror(errno), errno);
+        return;
+    }
+
+    ring_cursor = reply.cursor;
+    pthread_create(&thread, NULL, ring_reader, to_user);
+    pthread_detach(thread);
+
+    client_printf("Reading Output From Ring %s\n", reply.name);
+}
+
 int direct_read(int from_server, int to_server, int from_user, int to_user)
 {
+    static int ring_to_user;
+
     int read_size;
     char buffer[BUFFER_SIZE] = {};
+    struct frame frame;
     fd_set read_fds;
 
+    if(resized) send_resize(to_server, from_user < 0 ? STDIN_FILENO : from_user);
+    if(dumping) print_latency();
+
     FD_ZERO(&read_fds);
 
     FD_SET(from_server, &read_fds);
-    FD_SET(from_user, &read_fds);
+    if(from_user >= 0) FD_SET(from_user, &read_fds);
 
     int max_desc = from_server > from_user ? from_server : from_user;
 
-    int i = select(max_desc+1, &read_fds, NULL, NULL, NULL);
+    if(select(max_desc+1, &read_fds, NULL, NULL, NULL) < 0) return errno == EINTR;
 
-    if(FD_ISSET(from_user, &read_fds)) 
-    { 
+    if(from_user >= 0 && FD_ISSET(from_user, &read_fds))
+    {
         read_size = read(from_user, buffer, BUFFER_SIZE);
-        if(read_size)
+        if(read_size > 0)
         {
-            write(to_server, buffer, read_size);
-            return 1;
-        } 
+            trace_line(to_server);
+            frame_write(to_server, FRAME_DATA, sequence++, buffer, read_size);
+        }
         else
         {
             client_printf("STDIN doesn't work anymore???\n");
@@ -58,19 +283,39 @@ int direct_read(int from_server, int to_server, int from_user, int to_user)
 
     if(FD_ISSET(from_server, &read_fds))
     {
-        read_size = read(from_server, buffer, BUFFER_SIZE);
-            
-        if(read_size)
-        {
-            write(to_user, buffer, read_size);
-            return 1;
-        } 
-        else
+        if(frame_reader_fill(&from_server_frames, from_server) <= 0)
         {
             client_printf("Server Closed!\n");
             return 0;
         }
+
+        // Handle every frame that has fully arrived
+        while(frame_reader_next(&from_server_frames, &frame))
+        {
+            switch(frame.type)
+            {
+                case FRAME_DATA:
+                    write_all(to_user, frame.payload, frame.length);
+                    break;
+
+                case FRAME_TRACE:
+                    trace_prompt(&frame);
+                    break;
+
+                case FRAME_RING:
+                    ring_to_user = to_user;
+                    start_ring_reader(&frame, &ring_to_user);
+                    break;
+
+                case FRAME_CLOSE:
+                    client_printf("Server Closed!\n");
+                    return 0;
+
+                default:
+                    break;
+            }
+        }
     }
 
-    return 0;
-}
\ No newline at end of file
+    return 1;
+}
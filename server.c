@@ -1,76 +1,83 @@
 #include "./src/shell.h"
 #include "./src/pipe_networking.h"
 #include "./src/shell_command.h"
+#include "./src/server_hub.h"
 
 #include <stdio.h>
 #include <signal.h>
+#include <limits.h>
 
-#define MAX_CLIENTS 256
+pid_t shell_start(bi_file* shell);
 
-typedef union {
-    struct {
-        int from;
-        int to;
-    };
-
-    int pipe[2];
-} bi_file;
-
-int shell_loop(int* input);
-int handle_client(bi_file shell, int shell_chain, bi_file client, bi_file prev_client);
-void close_all_fds();
+// Print how the server is started, and return the exit status for a bad option
+static int usage(const char* program)
+{
+    fprintf(stderr, "usage: %s [-z] [-u] [-d flush delay us] [-q queue limit KB] [-o disconnect|drop|pause] [-s scrollback MB] [-w workers] [-t trace 1 in n]\n", program);
+    return 1;
+}
 
 int main(int argc, char** argv)
 {
-    int read_size;
-    char buffer[BUFFER_SIZE];
+    struct server_hub hub;
+    int opt, use_socket = 0, zero_copy = 0, flush_delay_us = HUB_FLUSH_DELAY_US, workers = 0;
+    int queue_limit = HUB_QUEUE_LIMIT, overflow = HUB_OVERFLOW_DROP, scrollback_mb = HUB_SCROLLBACK_MB, trace_every = -1;
 
-    int client_id = 0;
+    while((opt = getopt(argc, argv, "zud:q:o:s:w:t:")) != -1)
+    {
+        switch(opt)
+        {
+            // Fan shell output out to the clients that are caught up with tee() / splice()
+            case 'z': zero_copy = 1; break;
 
-    bi_file client, prev_client;
-    bi_file shell, shell_chain;
+            // Also accept clients on the unix socket
+            case 'u': use_socket = 1; break;
 
-    int t, last_server = -1;
+            // Longest that shell output is held back to be batched, in microseconds
+            case 'd': flush_delay_us = atoi(optarg); break;
 
-    shell.from = shell_loop(&shell.to);
+            // Most output that is queued for a slow client, in KB
+            case 'q': queue_limit = atoi(optarg) << 10; break;
 
-    client.from = -1;
-    client.to = -1;
+            // What happens to a client that goes over the queue limit
+            case 'o':
+                if(strcmp(optarg, "disconnect") == 0) overflow = HUB_OVERFLOW_DISCONNECT;
+                else if(strcmp(optarg, "drop") == 0) overflow = HUB_OVERFLOW_DROP;
+                else if(strcmp(optarg, "pause") == 0) overflow = HUB_OVERFLOW_PAUSE;
+                else return usage(argv[0]);
+                break;
 
-    while(1)
-    {
-        pipe(prev_client.pipe);
-        pipe(shell_chain.pipe);
+            // Output kept to show clients when they join, in MB
+            case 's': scrollback_mb = atoi(optarg); break;
 
-        t = last_server;
-        last_server = prev_client.to;
-        prev_client.to = t;
+            // Number of worker threads the clients are spread across, 0 for one per cpu
+            case 'w': workers = atoi(optarg); break;
 
-        client.from = server_handshake( &client.to );
-        ++client_id;
+            // Time the hops of 1 in n lines, 0 to only time the lines that clients sample with -t
+            case 't': trace_every = atoi(optarg); break;
 
-        if(fork() == 0)
-        {
-            server_printf("Started Client Handle [ID: #%d]\n", client.from);
-            while(handle_client(shell, shell_chain.to, client, prev_client));
-            close_all_fds();
-
-            server_printf("Killing Client Handle [ID: #%d]\n", client.from);
-            kill(getppid(), SIGKILL);
-            exit(0);
-        }
-
-        else
-        {
-            close(shell.from);
-            close(shell_chain.to);
-            shell.from = shell_chain.from;
-            close(prev_client.from);
-            close(prev_client.to);
-            close(client.from);
-            close(client.to);
+            default: return usage(argv[0]);
         }
     }
+
+    if(scrollback_mb < 0) scrollback_mb = 0;
+    if(scrollback_mb > HUB_SCROLLBACK_MAX_MB) scrollback_mb = HUB_SCROLLBACK_MAX_MB;
+
+    // A client always has to be able to fall a couple of whole frames behind
+    if(queue_limit < 2 * HUB_OUTPUT_SIZE) queue_limit = 2 * HUB_OUTPUT_SIZE;
+    if(queue_limit > HUB_QUEUE_MAX) queue_limit = HUB_QUEUE_MAX;
+    if(workers < 0) workers = 0;
+
+    server_hub_init(&hub, shell_start);
+    hub.worker_count = workers;
+    hub.zero_copy = zero_copy;
+    hub.flush_delay_us = flush_delay_us;
+    hub.queue_limit = queue_limit;
+    hub.overflow = overflow;
+    hub.scrollback_size = (size_t)scrollback_mb << 20;
+    if(use_socket) hub.socket_listener = server_socket_listen();
+    if(trace_every >= 0) hub_trace_start(&hub, trace_every);
+
+    return server_hub_run(&hub);
 }
 
 // Handle SIGINT by not closing if it is the parent process
@@ -79,144 +86,68 @@ static void signal_handler(int signal)
 {
 }
 
-int shell_loop(int* input)
+// Start the shell of a session, which the hub calls the first time a client asks for it
+pid_t shell_start(bi_file* shell)
 {
-    int i;
-    char* command_str;
-    struct shell_command* command;
+    struct shell_line* line;
+    char stats[PATH_MAX];
+    pid_t pid;
 
     int server_to_shell[2];
     int shell_to_server[2];
 
-    pipe(server_to_shell);
-    pipe(shell_to_server);
+    if(pipe(server_to_shell)) return -1;
+    if(pipe(shell_to_server))
+    {
+        close(server_to_shell[0]); close(server_to_shell[1]);
+        return -1;
+    }
 
-    if(fork() == 0)
+    pid = fork();
+
+    if(pid == 0)
     {
+        close(server_to_shell[PIPE_INPUT]);
+        close(shell_to_server[PIPE_OUTPUT]);
+
         dup2(server_to_shell[PIPE_OUTPUT], STDIN_FILENO); close(server_to_shell[PIPE_OUTPUT]);
         dup2(shell_to_server[PIPE_INPUT], STDOUT_FILENO); 
         dup2(shell_to_server[PIPE_INPUT], STDERR_FILENO); close(shell_to_server[PIPE_INPUT]);
 
+        // The hub is already running, so drop every client and session it has open,
+        // and undo what it did to SIGPIPE and SIGTERM, which commands would inherit
+        closefrom(STDERR_FILENO + 1);
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
         signal(SIGINT, signal_handler);
 
+        // The stats builtin finds the server through this, even after the shell changes directory
+        if(realpath(STATS_NAME, stats)) setenv(SH_STATS_ENV, stats, 1);
+
         // Very Simple Shell Loop
-        while(1)
+        while(!feof(stdin))
         {
             // Read command from GNU readline
-            command = shell_readline();
+            line = shell_readline();
             
-            shell_execute_commands(command);
-            shell_command_free(command);
-            free(command_str);
+            shell_execute_line(line);
+            shell_line_free(line);
         }
 
         exit(0);
     }
 
-    else
-    {
-        *input = server_to_shell[PIPE_INPUT];
-        return shell_to_server[PIPE_OUTPUT];
-    }
-
-}
-
-#define MAX_DESC(a, b) ((a) > (b) ? (a) : (b))
-
-int handle_client(bi_file shell, int shell_chain, bi_file client, bi_file prev_client)
-{
-    int read_size;
-    char buffer[BUFFER_SIZE] = {};
-
-    fd_set read_fds;
-
-    FD_ZERO(&read_fds);
-
-    FD_SET(shell.from, &read_fds);
-    FD_SET(client.from, &read_fds);
-    FD_SET(prev_client.from, &read_fds);
-
-    int max_desc = MAX_DESC(MAX_DESC(shell.from, client.from), prev_client.from);
+    close(server_to_shell[PIPE_OUTPUT]);
+    close(shell_to_server[PIPE_INPUT]);
 
-    int i = select(max_desc+1, &read_fds, NULL, NULL, NULL);
-
-    if(FD_ISSET(shell.from, &read_fds)) 
-    { 
-        read_size = read(shell.from, buffer, BUFFER_SIZE);
-
-        if(read_size && (strncmp(buffer, PANIC, sizeof(PANIC)) != 0)) 
-        {
-            write(client.to, buffer, read_size); 
-            write(shell_chain, buffer, read_size); 
-            return 1;
-        }
-        else 
-        {
-            server_printf("Closed: shell.from [ID: #%d]\n", client.from);
-            goto close_fds;
-        }
-    }
-
-    if(FD_ISSET(client.from, &read_fds))
-    {
-        read_size = read(client.from, buffer, BUFFER_SIZE);
-
-        if(read_size && (strncmp(buffer, PANIC, sizeof(PANIC)) != 0)) 
-        {
-            write(shell.to, buffer, read_size); 
-            write(shell_chain, buffer, read_size); 
-            write(prev_client.to, buffer, read_size); 
-            return 1;
-        }
-        else
-        {
-            server_printf("Closed: client.from [ID: #%d]\n", client.from);
-            goto close_fds;
-        }
-    }
-
-    if(FD_ISSET(prev_client.from, &read_fds))
+    if(pid < 0)
     {
-        read_size = read(prev_client.from, buffer, BUFFER_SIZE);
-        
-        if(read_size && (strncmp(buffer, PANIC, sizeof(PANIC)) != 0)) 
-        {
-            write(client.to, buffer, read_size); 
-            write(prev_client.to, buffer, read_size); 
-            return 1;
-        }
-        else 
-        {
-            server_printf("Closed: prev_client.from [ID: #%d]\n", client.from);
-            goto close_fds;
-        }
+        close(server_to_shell[PIPE_INPUT]);
+        close(shell_to_server[PIPE_OUTPUT]);
+        return -1;
     }
 
-    close_fds:
-
-    server_printf("\t- Closing: shell.to\n");
-    close(shell.to);
-
-    server_printf("\t- Closing: shell_chain\n");
-    close(shell_chain);
-
-    server_printf("\t- Closing: client\n");
-    close(client.from);
-    close(client.to);
-
-    server_printf("\t- PANICING: prev_client\n");
-    write(prev_client.to, PANIC, sizeof(PANIC)); 
-
-    server_printf("\t- Closing: prev_client\n");
-    close(prev_client.from);         
-    close(prev_client.to);        
-
-    server_printf("\t- Running Exit Process\n\nß");
-    return 0;
+    shell->to = server_to_shell[PIPE_INPUT];
+    shell->from = shell_to_server[PIPE_OUTPUT];
+    return pid;
 }
-
-void close_all_fds()
-{
-    int i, fdlimit = (int)sysconf(_SC_OPEN_MAX);
-    for (i = STDERR_FILENO + 1; i < fdlimit; i++) close(i);   
-}
\ No newline at end of file
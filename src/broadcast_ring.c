@@ -0,0 +1,350 @@
+#include "broadcast_ring.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static int futex(_Atomic uint32_t* word, int op, uint32_t value, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+/**
+ * @brief map a ring that is open as fd
+ *
+ * @param ring the ring to store the mapping in
+ * @param fd the shared memory object
+ * @param mapped_size the size of the shared memory object
+ * @return 0 on success, -1 on error
+ */
+static int broadcast_ring_map(struct broadcast_ring* ring, int fd, size_t mapped_size)
+{
+    void* memory = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(memory == MAP_FAILED) return -1;
+
+    ring->mapped_size = mapped_size;
+    ring->header = memory;
+    ring->data = (char*)memory + sizeof(struct broadcast_ring_header);
+    return 0;
+}
+
+/**
+ * @brief create a ring in shared memory
+ *
+ * @param ring the ring to create
+ * @param name the name of the shared memory object, starting with '/'
+ * @param size the number of bytes the ring holds, rounded up to a power of 2
+ * @return 0 on success, -1 on error
+ */
+int broadcast_ring_create(struct broadcast_ring* ring, const char* name, uint32_t size)
+{
+    uint32_t capacity;
+    int fd;
+
+    for(capacity = 1; capacity < size; capacity <<= 1);
+
+    snprintf(ring->name, BROADCAST_RING_NAME_SIZE, "%s", name);
+    ring->owner = 1;
+
+    shm_unlink(ring->name);
+    fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0) return -1;
+
+    if(ftruncate(fd, sizeof(struct broadcast_ring_header) + capacity) < 0)
+    {
+        close(fd);
+        shm_unlink(ring->name);
+        return -1;
+    }
+
+    if(broadcast_ring_map(ring, fd, sizeof(struct broadcast_ring_header) + capacity) < 0)
+    {
+        shm_unlink(ring->name);
+        return -1;
+    }
+
+    // The new memory is already zeroed, so the ring starts out empty
+    ring->header->magic = BROADCAST_RING_MAGIC;
+    ring->header->size = capacity;
+
+    return 0;
+}
+
+/**
+ * @brief create a ring in private memory, for threads of this process to share
+ *
+ * the memory is only backed by pages once bytes are written to them,
+ * so a big ring that hardly gets used stays small.
+ *
+ * @param ring the ring to create
+ * @param size the number of bytes the ring holds, rounded up to a power of 2
+ * @return 0 on success, -1 on error
+ */
+int broadcast_ring_init(struct broadcast_ring* ring, uint32_t size)
+{
+    uint32_t capacity;
+    void* memory;
+
+    for(capacity = 1; capacity < size; capacity <<= 1);
+
+    ring->name[0] = '\0';
+    ring->owner = 1;
+
+    memory = mmap(NULL, sizeof(struct broadcast_ring_header) + capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(memory == MAP_FAILED) return -1;
+
+    ring->mapped_size = sizeof(struct broadcast_ring_header) + capacity;
+    ring->header = memory;
+    ring->data = (char*)memory + sizeof(struct broadcast_ring_header);
+
+    ring->header->magic = BROADCAST_RING_MAGIC;
+    ring->header->size = capacity;
+
+    return 0;
+}
+
+/**
+ * @brief map a ring that was created by another process
+ *
+ * @param ring the ring to open
+ * @param name the name the ring was created with
+ * @return 0 on success, -1 on error
+ */
+int broadcast_ring_open(struct broadcast_ring* ring, const char* name)
+{
+    struct stat info;
+    int fd;
+
+    snprintf(ring->name, BROADCAST_RING_NAME_SIZE, "%s", name);
+    ring->owner = 0;
+
+    fd = shm_open(ring->name, O_RDWR, 0);
+    if(fd < 0) return -1;
+
+    if(fstat(fd, &info) < 0 || info.st_size < sizeof(struct broadcast_ring_header))
+    {
+        close(fd);
+        return -1;
+    }
+
+    if(broadcast_ring_map(ring, fd, info.st_size) < 0) return -1;
+
+    if(ring->header->magic != BROADCAST_RING_MAGIC
+    || ring->header->size + sizeof(struct broadcast_ring_header) > info.st_size)
+    {
+        munmap(ring->header, ring->mapped_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief append bytes to the ring and wake every waiting reader
+ *
+ * @param ring the ring to write to
+ * @param buffer the bytes to write
+ * @param size the number of bytes to write
+ */
+void broadcast_ring_write(struct broadcast_ring* ring, const char* buffer, uint32_t size)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void*)buffer;
+    iov.iov_len = size;
+    broadcast_ring_writev(ring, &iov, 1);
+}
+
+/**
+ * @brief append several buffers to the ring and wake every waiting reader
+ *
+ * the bytes are copied in before head is moved, so a reader never sees
+ * bytes that haven't been written yet, and sees every buffer at once.
+ * only the newest size bytes are kept, a reader that falls further behind
+ * than that loses the oldest bytes. like the write side of a seqlock,
+ * reserved is moved past the write before anything is copied, so the bytes
+ * that are about to be overwritten are never mistaken for ones that are still there.
+ *
+ * there is only one head, so writers in different threads have to take turns.
+ *
+ * @param ring the ring to write to
+ * @param iov the bytes to write
+ * @param count the number of buffers in iov
+ */
+void broadcast_ring_writev(struct broadcast_ring* ring, const struct iovec* iov, int count)
+{
+    uint32_t mask = ring->header->size - 1, offset, first, size;
+    uint64_t head = atomic_load_explicit(&ring->header->head, memory_order_relaxed), skip = 0;
+    const char* buffer;
+    int i;
+
+    for(i = 0; i < count; ++i) skip += iov[i].iov_len;
+
+    // Readers have to see the reservation before any of the bytes it covers change
+    atomic_store_explicit(&ring->header->reserved, head + skip, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    skip = skip > ring->header->size ? skip - ring->header->size : 0;
+
+    for(i = 0; i < count; ++i)
+    {
+        buffer = iov[i].iov_base;
+        size = iov[i].iov_len;
+
+        // Bytes that would be overwritten by this same write are skipped
+        if(skip >= size)
+        {
+            head += size;
+            skip -= size;
+            continue;
+        }
+
+        head += skip;
+        buffer += skip;
+        size -= skip;
+        skip = 0;
+
+        offset = head & mask;
+        first = ring->header->size - offset;
+        if(first > size) first = size;
+
+        memcpy(ring->data + offset, buffer, first);
+        memcpy(ring->data, buffer + first, size - first);
+        head += size;
+    }
+
+    atomic_store_explicit(&ring->header->head, head, memory_order_release);
+
+    atomic_fetch_add(&ring->header->wake, 1);
+    if(atomic_load(&ring->header->waiters)) futex(&ring->header->wake, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+/**
+ * @brief copy the bytes after a cursor out of the ring
+ *
+ * if the writer lapped the reader, the cursor jumps forward to the oldest byte
+ * that is still in the ring, and the number of bytes that were lost is added to *skipped.
+ * like the read side of a seqlock, the copy is checked against reserved after it is made,
+ * so bytes that a write in progress overwrote are never returned, even before head moves.
+ *
+ * @param ring the ring to read from
+ * @param cursor the position of the reader, which is moved forward
+ * @param buffer the buffer to copy into
+ * @param size the size of the buffer
+ * @param skipped incremented by the number of bytes lost, can be NULL
+ * @return the number of bytes copied, or -1 if the ring is closed and empty
+ */
+int broadcast_ring_read(struct broadcast_ring* ring, uint64_t* cursor, char* buffer, uint32_t size, uint64_t* skipped)
+{
+    uint32_t mask = ring->header->size - 1, offset, first, available;
+    uint64_t head, reserved, oldest;
+
+    while(1)
+    {
+        head = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+        reserved = atomic_load_explicit(&ring->header->reserved, memory_order_acquire);
+
+        if(head == *cursor) return atomic_load(&ring->header->closed) ? -1 : 0;
+
+        // Everything before oldest is gone, or is being overwritten right now
+        if(reserved - *cursor > ring->header->size)
+        {
+            oldest = reserved - ring->header->size;
+            if(oldest > head) oldest = head;
+
+            if(skipped) *skipped += oldest - *cursor;
+            *cursor = oldest;
+            if(oldest == head) return 0;
+        }
+
+        available = head - *cursor;
+        if(available > size) available = size;
+
+        offset = *cursor & mask;
+        first = ring->header->size - offset;
+        if(first > available) first = available;
+
+        memcpy(buffer, ring->data + offset, first);
+        memcpy(buffer + first, ring->data, available - first);
+
+        // Make sure no write has started on anything that was copied
+        atomic_thread_fence(memory_order_acquire);
+        reserved = atomic_load_explicit(&ring->header->reserved, memory_order_relaxed);
+        if(reserved - *cursor <= ring->header->size)
+        {
+            *cursor += available;
+            return available;
+        }
+    }
+}
+
+/**
+ * @brief sleep on the futex until the writer publishes past cursor
+ *
+ * the futex word is read before head is checked, so if the writer
+ * publishes in between, FUTEX_WAIT returns right away instead of missing the wakeup.
+ *
+ * @param ring the ring to wait on
+ * @param cursor the position of the reader
+ * @param timeout how long to wait in milliseconds, -1 to wait forever
+ * @return 1 if there is data or the ring closed, 0 on timeout
+ */
+int broadcast_ring_wait(struct broadcast_ring* ring, uint64_t cursor, int timeout)
+{
+    struct timespec limit;
+    uint32_t wake;
+
+    while(1)
+    {
+        wake = atomic_load(&ring->header->wake);
+
+        if(atomic_load_explicit(&ring->header->head, memory_order_acquire) != cursor) return 1;
+        if(atomic_load(&ring->header->closed)) return 1;
+
+        limit.tv_sec = timeout / 1000;
+        limit.tv_nsec = (timeout % 1000) * 1000000L;
+
+        atomic_fetch_add(&ring->header->waiters, 1);
+        if(futex(&ring->header->wake, FUTEX_WAIT, wake, timeout < 0 ? NULL : &limit) < 0 && errno == ETIMEDOUT)
+        {
+            atomic_fetch_sub(&ring->header->waiters, 1);
+            return 0;
+        }
+        atomic_fetch_sub(&ring->header->waiters, 1);
+    }
+}
+
+/**
+ * @brief unmap the ring, and remove it if this process created it with a name
+ *
+ * readers that are waiting are woken up and see that the ring has closed.
+ *
+ * @param ring the ring to close
+ */
+void broadcast_ring_close(struct broadcast_ring* ring)
+{
+    if(ring->header == NULL) return;
+
+    if(ring->owner)
+    {
+        atomic_store(&ring->header->closed, 1);
+        atomic_fetch_add(&ring->header->wake, 1);
+        futex(&ring->header->wake, FUTEX_WAKE, INT_MAX, NULL);
+        if(ring->name[0]) shm_unlink(ring->name);
+    }
+
+    munmap(ring->header, ring->mapped_size);
+    ring->header = NULL;
+    ring->data = NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef BROADCAST_RING_HEADER_FILE
+#define BROADCAST_RING_HEADER_FILE 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#define BROADCAST_RING_MAGIC 0x53414c52
+#define BROADCAST_RING_NAME_SIZE 64
+
+// Shared between the writer and every reader.
+// head counts every byte that has ever been written, so a reader
+// only needs its own cursor to know where it is, and how far behind it is.
+// reserved is moved to where head will be before a write starts copying,
+// so a reader can tell if the bytes it copied were being overwritten.
+struct broadcast_ring_header
+{
+    uint32_t magic;
+    uint32_t size;
+
+    _Atomic uint64_t head;
+    _Atomic uint64_t reserved;
+
+    // Futex word that changes every time data is published or the ring closes
+    _Atomic uint32_t wake;
+    _Atomic uint32_t waiters;
+    _Atomic uint32_t closed;
+};
+
+struct broadcast_ring
+{
+    char name[BROADCAST_RING_NAME_SIZE];
+    int owner;
+
+    size_t mapped_size;
+    struct broadcast_ring_header* header;
+    char* data;
+};
+
+// Create a ring in shared memory that holds size bytes (rounded up to a power of 2)
+int broadcast_ring_create(struct broadcast_ring*, const char* name, uint32_t size);
+
+// Create a ring that only this process can see, which has no name
+int broadcast_ring_init(struct broadcast_ring*, uint32_t size);
+
+// Map a ring that was created by another process
+int broadcast_ring_open(struct broadcast_ring*, const char* name);
+
+// Append bytes to the ring and wake every waiting reader
+void broadcast_ring_write(struct broadcast_ring*, const char* buffer, uint32_t size);
+
+// Append several buffers to the ring, which readers see all at once
+void broadcast_ring_writev(struct broadcast_ring*, const struct iovec* iov, int count);
+
+// Copy bytes after *cursor into buffer, returns the number of bytes or -1 if the ring is closed
+int broadcast_ring_read(struct broadcast_ring*, uint64_t* cursor, char* buffer, uint32_t size, uint64_t* skipped);
+
+// Wait until there are bytes after cursor, or the timeout (in ms, -1 forever) runs out
+int broadcast_ring_wait(struct broadcast_ring*, uint64_t cursor, int timeout);
+
+// Unmap the ring, and remove it if this process created it with a name
+void broadcast_ring_close(struct broadcast_ring*);
+
+#endif
@@ -5,12 +5,20 @@
 
 #define SH_VERSION_NO "v3.0"
 
-#define SH_MAX_ARGS (1 << 8)
+// Arguments a command has room for before its argv has to grow
+#define SH_INITIAL_ARGS (1 << 3)
 
 #define SH_CWD_SIZE (1 << 12)
 #define SH_USR_SIZE (1 << 10)
 
-#define SH_USER_INPUT_BUFFER (1 << 12)
+// Room for the colors and box drawing around the hostname and directory
+#define SH_PROMPT_SIZE (SH_CWD_SIZE + SH_USR_SIZE + (1 << 7))
+
+// Environment variable with the path of the stats socket of the server, for the stats builtin
+#define SH_STATS_ENV "MULTI_SHELL_STATS"
+
+// Longest that the stats builtin waits for the server to answer
+#define SH_STATS_TIMEOUT_MS 1000
 
 #define SH_STDIN STDIN_FILENO
 #define SH_STDOUT STDOUT_FILENO
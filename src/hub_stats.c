@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include "hub_stats.h"
+
+#include <sys/socket.h>
+
+// Longest that a reader of the stats socket can take to read a snapshot
+#define HUB_STATS_TIMEOUT_MS 1000
+
+// A snapshot that a thread is writing to a reader of the stats socket
+struct hub_stats_reply
+{
+    int fd;
+    char* buffer;
+    size_t size;
+};
+
+/**
+ * @brief add every counter of a client that is leaving to the totals of the hub
+ *
+ * any worker can be retiring a client at the same time, so these are locked adds.
+ * the queue of the client is gone with it, so only the most it ever had is kept.
+ *
+ * @param hub the hub with the totals
+ * @param client the client that is leaving
+ */
+void hub_stats_retire(struct server_hub* hub, struct hub_client* client)
+{
+    struct hub_stats* stats = &client->stats;
+    long long queue_max = atomic_load(&stats->queue_max), old;
+
+    atomic_fetch_add(&hub->closed.bytes_in, atomic_load(&stats->bytes_in));
+    atomic_fetch_add(&hub->closed.bytes_out, atomic_load(&stats->bytes_out));
+    atomic_fetch_add(&hub->closed.reads, atomic_load(&stats->reads));
+    atomic_fetch_add(&hub->closed.writes, atomic_load(&stats->writes));
+    atomic_fetch_add(&hub->closed.short_writes, atomic_load(&stats->short_writes));
+    atomic_fetch_add(&hub->closed.write_ns, atomic_load(&stats->write_ns));
+    atomic_fetch_add(&hub->closed.blocked_us, atomic_load(&stats->blocked_us));
+
+    old = atomic_load(&hub->closed.queue_max);
+    while(queue_max > old && !atomic_compare_exchange_weak(&hub->closed.queue_max, &old, queue_max));
+
+    atomic_fetch_add(&hub->disconnect_count, 1);
+}
+
+/**
+ * @brief print a string as a JSON string, escaping anything that JSON doesn't allow
+ */
+static void hub_stats_string(FILE* stream, const char* text)
+{
+    fputc('"', stream);
+
+    for(; *text; ++text)
+    {
+        if(*text == '"' || *text == '\\') fprintf(stream, "\\%c", *text);
+        else if((unsigned char)*text < 0x20) fprintf(stream, "\\u%04x", *text);
+        else fputc(*text, stream);
+    }
+
+    fputc('"', stream);
+}
+
+/**
+ * @brief print the counters of a client or the totals, without the braces around them
+ */
+static void hub_stats_counters(FILE* stream, struct hub_stats* stats)
+{
+    fprintf(stream,
+        "\"bytes_in\": %lld, \"bytes_out\": %lld, \"reads\": %lld, \"writes\": %lld, "
+        "\"short_writes\": %lld, \"write_us\": %lld, \"blocked_us\": %lld, \"queue_depth\": %lld, \"queue_max\": %lld",
+        atomic_load(&stats->bytes_in), atomic_load(&stats->bytes_out), atomic_load(&stats->reads), atomic_load(&stats->writes),
+        atomic_load(&stats->short_writes), atomic_load(&stats->write_ns) / 1000, atomic_load(&stats->blocked_us),
+        atomic_load(&stats->queue_depth), atomic_load(&stats->queue_max)
+    );
+}
+
+/**
+ * @brief add the counters of a client to a running total
+ */
+static void hub_stats_sum(struct hub_stats* total, struct hub_stats* stats)
+{
+    total->bytes_in += atomic_load(&stats->bytes_in);
+    total->bytes_out += atomic_load(&stats->bytes_out);
+    total->reads += atomic_load(&stats->reads);
+    total->writes += atomic_load(&stats->writes);
+    total->short_writes += atomic_load(&stats->short_writes);
+    total->write_ns += atomic_load(&stats->write_ns);
+    total->blocked_us += atomic_load(&stats->blocked_us);
+    total->queue_depth += atomic_load(&stats->queue_depth);
+    if(atomic_load(&stats->queue_max) > total->queue_max) total->queue_max = atomic_load(&stats->queue_max);
+}
+
+/**
+ * @brief print a snapshot of every counter of the hub as JSON
+ *
+ * this runs on the hub, which owns the sessions. the clients belong to the workers,
+ * so each worker is locked while its clients are read, which only stops it
+ * from adding or removing clients. the counters themselves are read while they change.
+ * the totals are the clients that left, plus every client that is still connected.
+ * latency is null unless tracing is on, see latency_trace.h.
+ *
+ * @param hub the hub to print the counters of
+ * @param stream where the JSON is printed
+ */
+static void hub_stats_print(struct server_hub* hub, FILE* stream)
+{
+    struct hub_stats total;
+    struct hub_session* session;
+    struct hub_worker* worker;
+    struct hub_client* client;
+    int i, j, first = 1;
+
+    memset(&total, 0, sizeof(total));
+    hub_stats_sum(&total, &hub->closed);
+
+    fprintf(stream, "{\"pid\": %d, \"uptime_ms\": %lld, \"workers\": %d, \"clients\": %d, \"connects\": %lld, \"disconnects\": %lld, ",
+        getpid(), (hub_now_us() - hub->started_us) / 1000, hub->worker_count, atomic_load(&hub->client_count),
+        hub->connect_count, atomic_load(&hub->disconnect_count));
+
+    fprintf(stream, "\"handshake_avg_us\": %lld, \"handshake_max_us\": %lld,\n \"sessions\": [",
+        hub->connect_count ? hub->connect_total_us / hub->connect_count : 0, hub->connect_max_us);
+
+    for(i = 0; i < hub->session_count; ++i)
+    {
+        session = hub->sessions[i];
+
+        fprintf(stream, "%s\n  {\"id\": %d, \"name\": ", i ? "," : "", session->id);
+        hub_stats_string(stream, session->name);
+        fprintf(stream, ", \"pid\": %d, \"clients\": %d, \"published\": %llu, \"paused\": %s, \"ended\": %s}",
+            session->pid, atomic_load(&session->client_count),
+            (unsigned long long)atomic_load(&session->feed.header->head),
+            session->paused ? "true" : "false", atomic_load(&session->ended) ? "true" : "false");
+    }
+
+    fprintf(stream, "],\n \"client_stats\": [");
+
+    for(i = 0; i < hub->worker_count; ++i)
+    {
+        worker = &hub->workers[i];
+        pthread_mutex_lock(&worker->lock);
+
+        for(j = 0; j < worker->client_count; ++j)
+        {
+            client = worker->clients[j];
+            hub_stats_sum(&total, &client->stats);
+
+            fprintf(stream, "%s\n  {\"id\": %d, \"session\": ", first ? "" : ",", client->id);
+            hub_stats_string(stream, client->session->name);
+            fprintf(stream, ", \"worker\": %d, ", worker->index);
+            hub_stats_counters(stream, &client->stats);
+            fprintf(stream, "}");
+
+            first = 0;
+        }
+
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    fprintf(stream, "],\n \"totals\": {");
+    hub_stats_counters(stream, &total);
+    fprintf(stream, "},\n \"latency\": ");
+    latency_trace_print(stream, hub->trace);
+    fprintf(stream, "}\n");
+}
+
+/**
+ * @brief write a snapshot to a reader of the stats socket, and close it
+ *
+ * this runs on its own thread, so a reader that is slow to take
+ * a big snapshot never holds up the hub.
+ *
+ * @param arg the reply to send, which is freed
+ * @return NULL
+ */
+static void* hub_stats_send(void* arg)
+{
+    struct hub_stats_reply* reply = arg;
+    size_t written = 0;
+    ssize_t step;
+
+    while(written < reply->size)
+    {
+        step = write(reply->fd, reply->buffer + written, reply->size - written);
+        if(step < 0 && errno == EINTR) continue;
+        if(step <= 0) break;
+
+        written += step;
+    }
+
+    close(reply->fd);
+    free(reply->buffer);
+    free(reply);
+    return NULL;
+}
+
+/**
+ * @brief send a snapshot of the counters to every connection waiting on the stats socket
+ *
+ * the snapshot is taken on the hub, and written by a detached thread.
+ * the connection is made blocking with a send timeout, so that thread always finishes.
+ *
+ * @param hub the hub with the stats socket
+ */
+void hub_stats_serve(struct server_hub* hub)
+{
+    struct timeval timeout = { HUB_STATS_TIMEOUT_MS / 1000, HUB_STATS_TIMEOUT_MS % 1000 * 1000 };
+    struct hub_stats_reply* reply;
+    pthread_attr_t attributes;
+    sigset_t all, old;
+    pthread_t thread;
+    FILE* stream;
+    int connection;
+
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+    while((connection = server_socket_accept(hub->stats_listener)) >= 0)
+    {
+        reply = calloc(1, sizeof(*reply));
+        stream = reply ? open_memstream(&reply->buffer, &reply->size) : NULL;
+
+        if(stream == NULL)
+        {
+            free(reply);
+            close(connection);
+            continue;
+        }
+
+        hub_stats_print(hub, stream);
+        fclose(stream);
+
+        fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) & ~O_NONBLOCK);
+        setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        reply->fd = connection;
+
+        // Signals are left to the hub, the same as with the workers
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &old);
+
+        if(pthread_create(&thread, &attributes, hub_stats_send, reply)) hub_stats_send(reply);
+
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+
+    pthread_attr_destroy(&attributes);
+}
@@ -0,0 +1,12 @@
+#ifndef HUB_STATS_HEADER_FILE
+#define HUB_STATS_HEADER_FILE 1
+
+#include "server_hub.h"
+
+// Send a JSON snapshot of every counter to every connection waiting on the stats socket
+void hub_stats_serve(struct server_hub*);
+
+// Add the counters of a client that is leaving to the totals of the hub
+void hub_stats_retire(struct server_hub*, struct hub_client*);
+
+#endif
@@ -0,0 +1,1461 @@
+#define _GNU_SOURCE
+#include "hub_worker.h"
+#include "hub_stats.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+/**
+ * @return the time in nanoseconds, which times the writes to the clients
+ */
+static long long hub_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief count a write to a client
+ *
+ * the client is blocked from the first write that it couldn't take all of,
+ * until its queue is empty again.
+ *
+ * @param client the client that was written to
+ * @param started when the write started, from hub_now_ns()
+ * @param written the number of bytes written
+ * @param size the number of bytes that were tried
+ */
+static void hub_count_write(struct hub_client* client, long long started, int written, size_t size)
+{
+    struct hub_stats* stats = &client->stats;
+
+    hub_stats_add(stats->writes, 1);
+    hub_stats_add(stats->write_ns, hub_now_ns() - started);
+    if(written > 0) hub_stats_add(stats->bytes_out, written);
+
+    if(written < 0 || (size_t)written < size)
+    {
+        hub_stats_add(stats->short_writes, 1);
+        if(client->blocked_since == 0) client->blocked_since = hub_now_us();
+    }
+    else if(client->blocked_since)
+    {
+        hub_stats_add(stats->blocked_us, hub_now_us() - client->blocked_since);
+        client->blocked_since = 0;
+    }
+}
+
+/**
+ * @param client the client to check
+ * @return the file descriptor that shell output and echoes are written to
+ */
+static int hub_output_fd(struct hub_client* client)
+{
+    return client->terminal.to >= 0 ? client->terminal.to : client->pipe.to;
+}
+
+/**
+ * @param client the client to check
+ * @param queue client->queue or client->control
+ * @return the file descriptor that the queue is written to
+ */
+static int hub_queue_fd(struct hub_client* client, struct hub_queue* queue)
+{
+    return queue == &client->control ? client->pipe.to : hub_output_fd(client);
+}
+
+/**
+ * @param queue the queue to check
+ * @return the number of bytes waiting in the queue
+ */
+static uint32_t hub_queue_size(struct hub_queue* queue)
+{
+    return queue->end - queue->start;
+}
+
+/**
+ * @param client the client to check
+ * @return the number of bytes of output waiting to be written to the client
+ */
+static uint32_t hub_queued(struct hub_client* client)
+{
+    return hub_queue_size(&client->queue);
+}
+
+/**
+ * @brief mark a client as closed, so it is removed by its worker
+ *
+ * @param client the client to close
+ */
+static void hub_close(struct hub_client* client)
+{
+    if(client->pipe.to < 0) return;
+
+    // A socket is still open through pipe.from, so epoll wouldn't forget pipe.to on its own
+    if(client->watching) epoll_ctl(client->worker->epoll, EPOLL_CTL_DEL, hub_output_fd(client), NULL);
+    if(client->watching_control) epoll_ctl(client->worker->epoll, EPOLL_CTL_DEL, client->pipe.to, NULL);
+    client->watching = client->watching_control = 0;
+
+    close(client->pipe.to);
+    client->pipe.to = -1;
+    ++client->worker->closing;
+}
+
+/**
+ * @brief wait for a client to be able to take more, only while it has something queued
+ *
+ * an attached client is waited on separately for its terminal and for its socket.
+ *
+ * @param client the client to update
+ */
+static void hub_watch_output(struct hub_client* client)
+{
+    struct epoll_event event;
+    int watch = client->pipe.to >= 0 && hub_queued(client) > 0;
+
+    event.events = EPOLLOUT;
+
+    if(watch != client->watching)
+    {
+        event.data.ptr = &client->watches[2];
+        epoll_ctl(client->worker->epoll, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, hub_output_fd(client), &event);
+        client->watching = watch;
+    }
+
+    watch = client->pipe.to >= 0 && hub_queue_size(&client->control) > 0;
+
+    if(watch != client->watching_control)
+    {
+        event.data.ptr = &client->watches[3];
+        epoll_ctl(client->worker->epoll, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, client->pipe.to, &event);
+        client->watching_control = watch;
+    }
+}
+
+/**
+ * @brief write to a queue of a client without ever blocking
+ *
+ * if nothing is in the queue, the bytes are written straight away,
+ * and whatever doesn't fit is queued. otherwise everything is queued behind
+ * what is already there, so the order never changes. queued bytes are written
+ * by hub_flush(...) once the client can take more.
+ *
+ * @param client the client to write to
+ * @param queue client->queue for output, or client->control for the socket of an attached client
+ * @param iov the bytes to write
+ * @param count the number of buffers in iov
+ */
+static void hub_write_queue(struct hub_client* client, struct hub_queue* queue, struct iovec* iov, int count)
+{
+    long long started;
+    size_t size = 0;
+    int i, written = 0;
+
+    if(client->pipe.to < 0) return;
+
+    if(hub_queue_size(queue) == 0)
+    {
+        for(i = 0; i < count; ++i) size += iov[i].iov_len;
+
+        started = hub_now_ns();
+        written = writev(hub_queue_fd(client, queue), iov, count);
+        hub_count_write(client, started, written, size);
+
+        if(written < 0)
+        {
+            if(errno != EAGAIN && errno != EINTR)
+            {
+                hub_close(client);
+                return;
+            }
+            written = 0;
+        }
+    }
+
+    // Queue whatever wasn't written
+    for(i = 0; i < count; ++i)
+    {
+        if(written >= iov[i].iov_len)
+        {
+            written -= iov[i].iov_len;
+            continue;
+        }
+
+        if(hub_queue_push(queue, (char*)iov[i].iov_base + written, iov[i].iov_len - written) < 0)
+        {
+            server_printf("Unable to Queue Output [ID: #%d]: %s [%d]\n", client->id, strerror(errno), errno);
+            hub_close(client);
+            return;
+        }
+
+        written = 0;
+    }
+}
+
+/**
+ * @brief write shell output and echoes to a client without ever blocking, see hub_write_queue(...)
+ */
+static void hub_write(struct hub_client* client, struct iovec* iov, int count)
+{
+    hub_write_queue(client, &client->queue, iov, count);
+}
+
+/**
+ * @brief write as much of a queue of a client as it can take
+ *
+ * @param client the client to write to
+ * @param queue the queue to write
+ */
+static void hub_flush(struct hub_client* client, struct hub_queue* queue)
+{
+    long long started;
+    int written;
+
+    if(client->pipe.to < 0 || hub_queue_size(queue) == 0) return;
+
+    started = hub_now_ns();
+    written = write(hub_queue_fd(client, queue), queue->buffer + queue->start, hub_queue_size(queue));
+    hub_count_write(client, started, written, hub_queue_size(queue));
+
+    if(written < 0)
+    {
+        if(errno != EAGAIN && errno != EINTR) hub_close(client);
+        return;
+    }
+
+    queue->start += written;
+    if(hub_queue_size(queue) > 0) return;
+
+    // Caught up, so give the memory back
+    free(queue->buffer);
+    memset(queue, 0, sizeof(*queue));
+}
+
+/**
+ * @brief write as much of the output queue of a client as it can take
+ *
+ * @param client the client to write to
+ */
+static void hub_flush_queue(struct hub_client* client)
+{
+    hub_flush(client, &client->queue);
+}
+
+/**
+ * @brief send a single frame to a client
+ *
+ * if the client attached its terminal, FRAME_DATA is written to it directly instead.
+ * the few other frames that an attached client gets go to its socket, through a queue of their own.
+ *
+ * @param client the client to send the frame to
+ * @param type the type of frame
+ * @param payload the payload of the frame
+ * @param size the length of the payload
+ */
+static void hub_send(struct hub_client* client, int type, const char* payload, int size)
+{
+    struct frame_header header;
+    struct iovec iov[2];
+
+    if(client->pipe.to < 0) return;
+
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = size;
+
+    if(client->terminal.to >= 0 && type == FRAME_DATA)
+    {
+        hub_write(client, iov + 1, 1);
+        return;
+    }
+
+    frame_header_init(&header, type, client->sequence++, size);
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+
+    hub_write_queue(client, client->terminal.to >= 0 ? &client->control : &client->queue, iov, 2);
+}
+
+/**
+ * @brief show a new client everything in the scrollback, before it gets any live output
+ *
+ * the scrollback is sent as a single frame with one writev(), straight out of the ring.
+ * once the ring has wrapped, the oldest line is probably cut off, so it is skipped.
+ * whatever the client can't take right away is queued like any other output.
+ * the session has to be locked, so nothing is published in the middle of it.
+ *
+ * @param client the client that just joined
+ */
+static void hub_scrollback_replay(struct hub_client* client)
+{
+    struct hub_scrollback* scrollback = &client->session->scrollback;
+    struct frame_header header;
+    struct iovec iov[3];
+    char* line;
+    int count = 0;
+
+    if(scrollback->buffer == NULL) return;
+
+    iov[1].iov_base = scrollback->buffer;
+    iov[1].iov_len = scrollback->head;
+    iov[2].iov_base = scrollback->buffer;
+    iov[2].iov_len = 0;
+
+    if(scrollback->wrapped)
+    {
+        iov[2] = iov[1];
+        iov[1].iov_base = scrollback->buffer + scrollback->head;
+        iov[1].iov_len = scrollback->size - scrollback->head;
+
+        line = memchr(iov[1].iov_base, '\n', iov[1].iov_len);
+        if(line)
+        {
+            iov[1].iov_len -= line + 1 - (char*)iov[1].iov_base;
+            iov[1].iov_base = line + 1;
+        }
+    }
+
+    if(iov[1].iov_len + iov[2].iov_len == 0) return;
+
+    // Attached terminals don't get frames
+    if(client->terminal.to < 0)
+    {
+        frame_header_init(&header, FRAME_DATA, client->sequence++, iov[1].iov_len + iov[2].iov_len);
+        iov[0].iov_base = &header;
+        iov[0].iov_len = sizeof(header);
+    }
+    else count = 1;
+
+    hub_write(client, iov + count, 3 - count);
+    server_printf("Replayed Scrollback [ID: #%d] [%zu bytes]\n", client->id, iov[1].iov_len + iov[2].iov_len);
+}
+
+/**
+ * @brief stop counting a client as a reason to pause its session
+ *
+ * the hub is woken up once no client in the session is holding it back anymore.
+ *
+ * @param client the client that caught up or left
+ */
+static void hub_client_resume(struct hub_client* client)
+{
+    uint64_t one = 1;
+
+    client->pausing = 0;
+    if(atomic_fetch_sub(&client->session->lagging, 1) == 1) write(client->worker->hub->wake, &one, sizeof(one));
+}
+
+/**
+ * @brief deal with a client that is more than hub->queue_limit behind in the feed of its session
+ *
+ *  - HUB_OVERFLOW_DISCONNECT closes the client
+ *  - HUB_OVERFLOW_DROP skips the client ahead to the newest record
+ *  - HUB_OVERFLOW_PAUSE keeps everything, and the hub stops reading the shell
+ *    until the client catches up
+ *
+ * every writer publishes whole records, so head is always at the start of one.
+ *
+ * @param client the client to check
+ * @param head the head of the feed
+ * @return 0 if the client was closed, 1 otherwise
+ */
+static int hub_client_overflow(struct hub_client* client, uint64_t head)
+{
+    struct server_hub* hub = client->worker->hub;
+
+    if(head - client->cursor <= hub->queue_limit) return 1;
+
+    switch(hub->overflow)
+    {
+        case HUB_OVERFLOW_DISCONNECT:
+            server_printf("Client Too Slow, Disconnecting [ID: #%d] [%llu KB behind]\n", client->id, (unsigned long long)(head - client->cursor) >> 10);
+            hub_close(client);
+            return 0;
+
+        case HUB_OVERFLOW_DROP:
+            server_printf("Client Too Slow, Dropping Output [ID: #%d] [%llu KB dropped]\n", client->id, (unsigned long long)(head - client->cursor) >> 10);
+            client->cursor = head;
+            return 1;
+
+        default:
+            if(!client->pausing)
+            {
+                client->pausing = 1;
+                atomic_fetch_add(&client->session->lagging, 1);
+            }
+            return 1;
+    }
+}
+
+/**
+ * @brief keep track of how far behind a client is, after it was sent what it could take
+ *
+ * a paused session is only resumed once the client is back under half of the limit,
+ * so it doesn't stop and start on every write.
+ *
+ * @param client the client to check
+ */
+static void hub_client_lag(struct hub_client* client)
+{
+    struct server_hub* hub = client->worker->hub;
+    uint64_t behind = atomic_load_explicit(&client->session->feed.header->head, memory_order_acquire) - client->cursor + hub_queued(client);
+
+    atomic_store_explicit(&client->stats.queue_depth, behind, memory_order_relaxed);
+    if((long long)behind > atomic_load_explicit(&client->stats.queue_max, memory_order_relaxed))
+        atomic_store_explicit(&client->stats.queue_max, behind, memory_order_relaxed);
+
+    if(client->pausing && behind < hub->queue_limit / 2) hub_client_resume(client);
+
+    if(client->lagging_since == 0 && behind > hub->queue_limit / 2)
+    {
+        client->lagging_since = hub_now_us();
+        server_printf("Client Lagging [ID: #%d] [%llu KB behind]\n", client->id, (unsigned long long)behind >> 10);
+    }
+    else if(client->lagging_since && behind == 0)
+    {
+        server_printf("Client Caught Up [ID: #%d] [behind for %lld ms]\n", client->id, (hub_now_us() - client->lagging_since) / 1000);
+        client->lagging_since = 0;
+    }
+}
+
+/**
+ * @brief time how long a traced prompt took to reach a client, once the client has been sent it
+ *
+ * every client that reads the prompt from its FIFO is a sample of the hop from the feed.
+ * the client whose line was traced is sent a FRAME_TRACE right behind the prompt,
+ * so it can time the rest of the way.
+ *
+ * @param client the client that was just sent records
+ */
+static void hub_client_trace(struct hub_client* client)
+{
+    struct hub_session* session = client->session;
+    uint64_t at = atomic_load_explicit(&session->trace_published_at, memory_order_acquire);
+    struct frame_trace trace;
+    long long now;
+    int id = client->id;
+
+    if(client->trace_seen >= at || client->cursor < at) return;
+    client->trace_seen = at;
+
+    now = latency_trace_now_ns();
+    if(!client->ring) latency_trace_record(client->worker->hub->trace, TRACE_HOP_FEED_TO_WORKER, now - atomic_load_explicit(&session->trace_published_ns, memory_order_relaxed));
+
+    if(atomic_compare_exchange_strong(&session->trace_client, &id, 0))
+    {
+        trace.sent_ns = now;
+        hub_send(client, FRAME_TRACE, (char*)&trace, sizeof(trace));
+    }
+}
+
+/**
+ * @brief send a client every record of its feed that it hasn't got yet
+ *
+ * records are gathered into frames of up to HUB_OUTPUT_SIZE, and nothing more
+ * is taken from the feed while the client has something queued, so the feed itself
+ * is the backlog of a slow client, and the worker never copies it.
+ * clients don't get their own echoes back, and clients that read from the shared memory
+ * ring already have the shell output from when they subscribed, so both are skipped over.
+ *
+ * the feed is read without any lock. if the writers lapped the client anyway,
+ * it starts again from the newest record.
+ * once the session has ended, the client is sent what is left and told to close.
+ *
+ * @param client the client to send to
+ */
+static void hub_client_pump(struct hub_client* client)
+{
+    struct hub_session* session = client->session;
+    struct broadcast_ring* feed = &session->feed;
+    char* buffer = client->worker->buffer;
+    struct hub_record record;
+    uint64_t head, cursor, skipped;
+    uint32_t size;
+    int ended = atomic_load(&client->session->ended);
+
+    while(client->pipe.to >= 0)
+    {
+        head = atomic_load_explicit(&feed->header->head, memory_order_acquire);
+
+        if(!hub_client_overflow(client, head)) return;
+        if(head == client->cursor || hub_queued(client) > 0) break;
+
+        for(size = 0, skipped = 0; client->cursor != head;)
+        {
+            cursor = client->cursor;
+            broadcast_ring_read(feed, &cursor, (char*)&record, sizeof(record), &skipped);
+            if(skipped || size + record.length > HUB_OUTPUT_SIZE) break;
+
+            if(record.source == client->id || (client->ring && record.source == 0 && client->cursor >= client->ring_from))
+            {
+                client->cursor = cursor + record.length;
+                continue;
+            }
+
+            broadcast_ring_read(feed, &cursor, buffer + size, record.length, &skipped);
+            if(skipped) break;
+
+            client->cursor = cursor;
+            size += record.length;
+        }
+
+        if(skipped)
+        {
+            server_printf("Client Too Slow, Dropping Output [ID: #%d] [lapped by the feed]\n", client->id);
+            client->cursor = atomic_load(&feed->header->head);
+        }
+
+        if(size) hub_send(client, FRAME_DATA, buffer, size);
+        if(session->trace) hub_client_trace(client);
+    }
+
+    if(client->pipe.to < 0) return;
+
+    if(ended)
+    {
+        hub_send(client, FRAME_CLOSE, NULL, 0);
+        hub_close(client);
+        return;
+    }
+
+    hub_client_lag(client);
+    hub_watch_output(client);
+}
+
+/**
+ * @brief move a client over to reading shell output from the shared memory ring
+ *
+ * every session has its own ring, which is created the first time a client asks for it.
+ * if it can't be created, the client is sent an empty name and keeps using its FIFO.
+ *
+ * output that is already in the feed was never written to the ring, like the first prompt,
+ * so the client is sent what it can take of it first, ahead of the reply.
+ * whatever is left from before the client subscribed still goes through the FIFO.
+ *
+ * @param client the client that asked for the ring
+ */
+static void hub_ring_subscribe(struct hub_client* client)
+{
+    struct hub_session* session = client->session;
+    char name[BROADCAST_RING_NAME_SIZE];
+    struct frame_ring reply;
+
+    if(client->ring) return;
+
+    // Attached terminals already get their output directly
+    if(client->terminal.to >= 0)
+    {
+        hub_send(client, FRAME_RING, NULL, 0);
+        return;
+    }
+
+    hub_client_pump(client);
+    if(client->pipe.to < 0) return;
+
+    pthread_mutex_lock(&session->lock);
+
+    if(session->ring.header == NULL)
+    {
+        sprintf(name, "/multi_shell_ring_%d_%d", getpid(), session->id);
+
+        if(broadcast_ring_create(&session->ring, name, HUB_RING_SIZE) < 0)
+        {
+            server_printf("Error Creating Ring %s: %s [%d]\n", name, strerror(errno), errno);
+            session->ring.header = NULL;
+            pthread_mutex_unlock(&session->lock);
+
+            hub_send(client, FRAME_RING, NULL, 0);
+            return;
+        }
+
+        server_printf("Created Ring %s\n", name);
+    }
+
+    // Shell output is written to the ring as well from here on, while the session is locked
+    client->ring = 1;
+    client->ring_from = atomic_load(&session->feed.header->head);
+    ++session->ring_clients;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.cursor = atomic_load(&session->ring.header->head);
+    snprintf(reply.name, FRAME_RING_NAME_SIZE, "%s", session->ring.name);
+
+    pthread_mutex_unlock(&session->lock);
+
+    hub_send(client, FRAME_RING, (char*)&reply, sizeof(reply));
+    server_printf("Client Reading From Ring [ID: #%d]\n", client->id);
+}
+
+/**
+ * @brief start or stop waiting on what a client sends
+ *
+ * @param client the client to update
+ * @param watch non-zero to wait on the client, 0 to leave it alone
+ */
+static void hub_watch_input(struct hub_client* client, int watch)
+{
+    struct epoll_event event;
+
+    event.events = EPOLLIN;
+    event.data.ptr = &client->watches[0];
+    epoll_ctl(client->worker->epoll, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, client->pipe.from, &event);
+
+    if(client->terminal.from >= 0)
+    {
+        event.data.ptr = &client->watches[1];
+        epoll_ctl(client->worker->epoll, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, client->terminal.from, &event);
+    }
+}
+
+/**
+ * @brief send input from a client to the shell of its session and every other client in it
+ *
+ * keystrokes are never held back, and any shell output that is still waiting
+ * is published first, so every client sees output and echoes in the same order.
+ * the shell is never waited on: whatever its pipe has no room for waits in the session,
+ * see hub_session_input(...). a client that sends more than HUB_INPUT_LIMIT
+ * while the shell is busy stops being read until the shell catches up,
+ * so it is only that client that waits, and not every client of the worker.
+ *
+ * when tracing is on, the input is sampled if the client asked for it with a FRAME_TRACE,
+ * or if it is the n-th input that the worker has seen. it is stamped right before it is written,
+ * and the shell takes the stamp once it has read the line.
+ *
+ * @param client the client the input is from
+ * @param buffer the input from the client
+ * @param size the length of the input
+ */
+static void hub_client_input(struct hub_client* client, const char* buffer, int size)
+{
+    struct hub_session* session = client->session;
+    struct hub_worker* worker = client->worker;
+    uint32_t waiting;
+
+    if(session->trace && (client->trace_next || (worker->hub->trace_every > 0 && --worker->trace_countdown <= 0)))
+    {
+        if(worker->trace_countdown <= 0) worker->trace_countdown = worker->hub->trace_every;
+        atomic_store(&session->trace_client, client->trace_next ? client->id : 0);
+        atomic_store(&session->trace->input_ns, latency_trace_now_ns());
+        client->trace_next = 0;
+    }
+
+    pthread_mutex_lock(&session->lock);
+
+    waiting = hub_session_input(worker->hub, session, buffer, size);
+
+    // Counted while the session is locked, so the hub can't drain the input without seeing it
+    client->input_paused = waiting > HUB_INPUT_LIMIT;
+    if(client->input_paused) atomic_fetch_add(&session->input_blocked, 1);
+
+    hub_session_flush(worker->hub, session);
+    hub_session_publish(session, client->id, buffer, size);
+    pthread_mutex_unlock(&session->lock);
+
+    if(client->input_paused)
+    {
+        server_printf("Shell Busy, Not Reading Client [ID: #%d] [%u KB waiting]\n", client->id, waiting >> 10);
+        hub_watch_input(client, 0);
+    }
+
+    hub_session_wake(client->worker->hub, session);
+}
+
+/**
+ * @brief handle every complete frame that a client has sent
+ *
+ *  - FRAME_DATA is written to the shell and every other client
+ *  - FRAME_PING is answered with a FRAME_PONG with the same payload
+ *  - FRAME_RESIZE is logged, as the shell isn't attached to a terminal
+ *  - FRAME_RING moves the client over to the shared memory ring
+ *  - FRAME_TRACE times the frame on its way here, and traces the next input of the client
+ *  - FRAME_CLOSE disconnects the client
+ *
+ * @param client the client to read the frames of
+ */
+static void hub_client_frames(struct hub_client* client)
+{
+    struct frame_resize size;
+    struct frame_trace trace;
+    struct frame frame;
+
+    while(client->pipe.to >= 0 && !client->input_paused && frame_reader_next(&client->reader, &frame))
+    {
+        switch(frame.type)
+        {
+            case FRAME_DATA:
+                hub_client_input(client, frame.payload, frame.length);
+                break;
+
+            case FRAME_PING:
+                hub_send(client, FRAME_PONG, frame.payload, frame.length);
+                break;
+
+            case FRAME_RESIZE:
+                if(frame.length == sizeof(size))
+                {
+                    memcpy(&size, frame.payload, sizeof(size));
+                    server_printf("Client Resized [ID: #%d] [%dx%d]\n", client->id, size.cols, size.rows);
+                }
+                break;
+
+            case FRAME_RING:
+                hub_ring_subscribe(client);
+                break;
+
+            case FRAME_TRACE:
+                if(frame.length == sizeof(trace) && client->worker->hub->trace)
+                {
+                    memcpy(&trace, frame.payload, sizeof(trace));
+                    latency_trace_record(client->worker->hub->trace, TRACE_HOP_CLIENT_TO_WORKER, latency_trace_now_ns() - trace.sent_ns);
+                    client->trace_next = 1;
+                }
+                break;
+
+            case FRAME_CLOSE:
+                hub_close(client);
+                break;
+
+            default:
+                server_printf("Unknown Frame [ID: #%d] [TYPE: %d]\n", client->id, frame.type);
+                break;
+        }
+    }
+
+    hub_watch_output(client);
+}
+
+/**
+ * @brief start reading a client again, once the shell of its session has taken enough of the input
+ *
+ * frames that the client sent before it was stopped are still in its reader, so they are handled first.
+ *
+ * @param client the client that was stopped
+ */
+static void hub_client_input_resume(struct hub_client* client)
+{
+    struct hub_session* session = client->session;
+    uint32_t waiting;
+
+    pthread_mutex_lock(&session->lock);
+
+    waiting = session->input.end - session->input.start;
+    if(waiting < HUB_INPUT_LIMIT / 2)
+    {
+        client->input_paused = 0;
+        atomic_fetch_sub(&session->input_blocked, 1);
+    }
+
+    pthread_mutex_unlock(&session->lock);
+
+    if(client->input_paused) return;
+
+    server_printf("Shell Caught Up, Reading Client [ID: #%d]\n", client->id);
+    hub_watch_input(client, 1);
+    hub_client_frames(client);
+}
+
+/**
+ * @brief have the hub tee the shell output of a session into a pipe for a group, with -z
+ *
+ * the output the hub read before the pipe existed is published first,
+ * so the pipe starts right at a record, which group->spliced is set to.
+ * only groups with a client that reads from a FIFO get a pipe.
+ *
+ * @param worker the worker of the group
+ * @param group the group to start splicing for
+ */
+static void hub_group_splice_start(struct hub_worker* worker, struct hub_group* group)
+{
+    struct hub_session* session = group->session;
+    int i, fds[2], published;
+
+    for(i = 0; i < group->client_count && !group->clients[i]->fifo; ++i);
+    if(i == group->client_count || atomic_load(&session->ended)) return;
+
+    if(pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) return;
+
+    // A pipe that can't hold a couple of whole records would fall behind on every flood
+    if(fcntl(fds[1], F_SETPIPE_SZ, HUB_SPLICE_PIPE_SIZE) < 0 && fcntl(fds[1], F_SETPIPE_SZ, 2 * HUB_OUTPUT_SIZE) < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+
+    pthread_mutex_lock(&session->lock);
+
+    published = session->output_size > 0;
+    hub_session_flush(worker->hub, session);
+
+    session->splice[worker->index] = fds[1];
+    session->splicing |= 1ULL << worker->index;
+    group->spliced = atomic_load(&session->feed.header->head);
+
+    pthread_mutex_unlock(&session->lock);
+
+    group->splice = fds[0];
+    if(published) hub_session_wake(worker->hub, session);
+}
+
+/**
+ * @brief stop splicing for a group, which then only copies out of the feed
+ *
+ * @param worker the worker of the group
+ * @param group the group to stop splicing for
+ */
+static void hub_group_splice_stop(struct hub_worker* worker, struct hub_group* group)
+{
+    struct hub_session* session = group->session;
+
+    if(group->splice < 0) return;
+
+    pthread_mutex_lock(&session->lock);
+
+    if(session->splice[worker->index] >= 0) close(session->splice[worker->index]);
+    session->splice[worker->index] = -1;
+    session->splicing &= ~(1ULL << worker->index);
+
+    pthread_mutex_unlock(&session->lock);
+
+    close(group->splice);
+    group->splice = -1;
+}
+
+/**
+ * @brief send the new records of a session to the clients of a group that are caught up, without copying shell output
+ *
+ * the pipe of the group holds the same shell output as the feed, from group->spliced on,
+ * so the records are walked in order. a client that is right at group->spliced,
+ * reads from a FIFO and has nothing queued gets the header of a frame,
+ * and then the shell output is tee()d into its FIFO straight from the pipe.
+ * whatever its FIFO has no room for is copied out of the feed and queued, and echoes are sent as usual.
+ * the output is then spliced into /dev/null, whether any client took it or not.
+ * clients that are behind are left to hub_client_pump(...), which copies them out of the feed.
+ *
+ * if the pipe has less in it than the feed says, the hub gave up on the worker,
+ * and the group goes back to copying until it is started again.
+ *
+ * @param worker the worker of the group
+ * @param group the group to send to
+ * @param head the head of the feed
+ */
+static void hub_group_splice(struct hub_worker* worker, struct hub_group* group, uint64_t head)
+{
+    struct hub_session* session = group->session;
+    struct broadcast_ring* feed = &session->feed;
+    char* buffer = worker->buffer;
+    struct frame_header header;
+    struct hub_record record;
+    struct hub_client* client;
+    struct iovec iov;
+    uint64_t cursor, at, skipped = 0;
+    long long started;
+    int i, available, loaded, sent, moved;
+
+    while(group->splice >= 0 && group->spliced != head)
+    {
+        cursor = group->spliced;
+        broadcast_ring_read(feed, &cursor, (char*)&record, sizeof(record), &skipped);
+
+        // Echoes are small, and aren't in the pipe, so they are read out of the feed up front
+        loaded = !skipped && record.source != 0;
+        if(loaded)
+        {
+            at = cursor;
+            broadcast_ring_read(feed, &at, buffer, record.length, &skipped);
+        }
+
+        if(skipped) server_printf("Worker Fell Behind, Copying Output [SESSION: \"%s\"] [WORKER: %d] [lapped by the feed]\n", session->name, worker->index);
+
+        // Otherwise the hub closed the pipe, and already said so
+        else if(record.source == 0 && (ioctl(group->splice, FIONREAD, &available) < 0 || available < (int)record.length)) skipped = 1;
+
+        if(skipped)
+        {
+            hub_group_splice_stop(worker, group);
+            break;
+        }
+
+        for(i = 0; i < group->client_count; ++i)
+        {
+            client = group->clients[i];
+            if(client->cursor != group->spliced || !client->fifo || client->ring || client->pipe.to < 0 || hub_queued(client) > 0) continue;
+
+            client->cursor = cursor + record.length;
+            if(record.source == client->id) continue;
+
+            if(record.source != 0)
+            {
+                hub_send(client, FRAME_DATA, buffer, record.length);
+                continue;
+            }
+
+            frame_header_init(&header, FRAME_DATA, client->sequence++, record.length);
+            iov.iov_base = &header;
+            iov.iov_len = sizeof(header);
+            hub_write(client, &iov, 1);
+
+            sent = 0;
+            if(client->pipe.to >= 0 && hub_queued(client) == 0)
+            {
+                started = hub_now_ns();
+                sent = tee(group->splice, client->pipe.to, record.length, SPLICE_F_NONBLOCK);
+                hub_count_write(client, started, sent, record.length);
+
+                if(sent < 0 && errno != EAGAIN)
+                {
+                    hub_close(client);
+                    continue;
+                }
+                if(sent < 0) sent = 0;
+            }
+
+            if(sent == (int)record.length) continue;
+
+            // The FIFO didn't take all of it, so the rest is copied after all
+            if(!loaded)
+            {
+                at = cursor;
+                broadcast_ring_read(feed, &at, buffer, record.length, &skipped);
+                loaded = !skipped;
+            }
+
+            if(!loaded)
+            {
+                server_printf("Client Too Slow, Dropping Output [ID: #%d] [lapped by the feed]\n", client->id);
+                hub_close(client);
+                continue;
+            }
+
+            iov.iov_base = buffer + sent;
+            iov.iov_len = record.length - sent;
+            hub_write(client, &iov, 1);
+        }
+
+        // Every client that was caught up has its copy, so the output is let go of
+        for(available = record.source == 0 ? record.length : 0; available > 0; available -= moved)
+        {
+            moved = splice(group->splice, NULL, worker->hub->dev_null, NULL, available, SPLICE_F_NONBLOCK);
+            if(moved <= 0) break;
+        }
+
+        group->spliced = cursor + record.length;
+        if(available > 0) hub_group_splice_stop(worker, group);
+    }
+
+    // Traced prompts are timed once the clients have them
+    for(i = 0; session->trace && i < group->client_count; ++i) hub_client_trace(group->clients[i]);
+}
+
+/**
+ * @brief add a client to the group of its session in its worker, starting the group if it is the first
+ *
+ * the bit of the worker in session->workers is set while the session is locked,
+ * before the client ever reads the head of the feed.
+ *
+ * @param worker the worker that owns the client
+ * @param client the client to add
+ * @return 0 on success, -1 if there was no memory for it
+ */
+static int hub_group_join(struct hub_worker* worker, struct hub_client* client)
+{
+    struct hub_session* session = client->session;
+    struct hub_group *group = NULL, **groups;
+    struct hub_client** clients;
+    int i;
+
+    for(i = 0; i < worker->group_count && group == NULL; ++i)
+        if(worker->groups[i]->session == session) group = worker->groups[i];
+
+    if(group == NULL)
+    {
+        if(worker->group_count == worker->group_capacity)
+        {
+            groups = realloc(worker->groups, (worker->group_capacity + HUB_SESSION_GROWTH) * sizeof(*groups));
+            if(groups == NULL) return -1;
+
+            worker->groups = groups;
+            worker->group_capacity += HUB_SESSION_GROWTH;
+        }
+
+        // A group is never left empty, so it starts with room for its first clients
+        group = calloc(1, sizeof(*group));
+        clients = malloc(HUB_SESSION_GROWTH * sizeof(*clients));
+        if(group == NULL || clients == NULL)
+        {
+            free(group);
+            free(clients);
+            return -1;
+        }
+
+        group->session = session;
+        group->clients = clients;
+        group->client_capacity = HUB_SESSION_GROWTH;
+        group->splice = -1;
+        worker->groups[worker->group_count++] = group;
+
+        pthread_mutex_lock(&session->lock);
+        atomic_fetch_or(&session->workers, 1ULL << worker->index);
+        group->seen = atomic_load(&session->feed.header->head);
+        pthread_mutex_unlock(&session->lock);
+    }
+
+    if(group->client_count == group->client_capacity)
+    {
+        clients = realloc(group->clients, (group->client_capacity + HUB_SESSION_GROWTH) * sizeof(*clients));
+        if(clients == NULL) return -1;
+
+        group->clients = clients;
+        group->client_capacity += HUB_SESSION_GROWTH;
+    }
+
+    group->clients[group->client_count++] = client;
+    client->group = group;
+    return 0;
+}
+
+/**
+ * @brief take a client out of its group, and free the group once it is empty
+ *
+ * the session stops waking the worker once the worker has no clients left in it,
+ * which has to happen before the session can be freed.
+ *
+ * @param client the client to remove
+ */
+static void hub_group_leave(struct hub_client* client)
+{
+    struct hub_group* group = client->group;
+    struct hub_worker* worker = client->worker;
+    int i;
+
+    if(group == NULL) return;
+    client->group = NULL;
+
+    for(i = 0; i < group->client_count && group->clients[i] != client; ++i);
+    if(i < group->client_count) group->clients[i] = group->clients[--group->client_count];
+    if(group->client_count > 0) return;
+
+    hub_group_splice_stop(worker, group);
+
+    pthread_mutex_lock(&group->session->lock);
+    atomic_fetch_and(&group->session->workers, ~(1ULL << worker->index));
+    pthread_mutex_unlock(&group->session->lock);
+
+    for(i = 0; i < worker->group_count && worker->groups[i] != group; ++i);
+    if(i < worker->group_count) worker->groups[i] = worker->groups[--worker->group_count];
+
+    free(group->clients);
+    free(group);
+}
+
+/**
+ * @brief close the pipes of a client and free it
+ *
+ * the session is let go of last, as the hub frees an ended session
+ * as soon as it has no clients left.
+ *
+ * @param client the client to free, which isn't in worker->clients anymore
+ */
+static void hub_client_free(struct hub_client* client)
+{
+    struct hub_session* session = client->session;
+    struct hub_worker* worker = client->worker;
+    struct server_hub* hub = worker->hub;
+    uint64_t one = 1;
+    int ended;
+
+    if(client->pipe.to >= 0)
+    {
+        hub_close(client);
+        --worker->closing;
+    }
+
+    epoll_ctl(worker->epoll, EPOLL_CTL_DEL, client->pipe.from, NULL);
+    close(client->pipe.from);
+
+    if(client->terminal.from >= 0)
+    {
+        epoll_ctl(worker->epoll, EPOLL_CTL_DEL, client->terminal.from, NULL);
+        close(client->terminal.from);
+    }
+    if(client->terminal.to >= 0) close(client->terminal.to);
+
+    frame_reader_free(&client->reader);
+    free(client->queue.buffer);
+    free(client->control.buffer);
+
+    if(client->pausing) hub_client_resume(client);
+    if(client->input_paused) atomic_fetch_sub(&session->input_blocked, 1);
+
+    if(client->ring)
+    {
+        pthread_mutex_lock(&session->lock);
+        --session->ring_clients;
+        pthread_mutex_unlock(&session->lock);
+    }
+
+    hub_group_leave(client);
+    hub_stats_retire(hub, client);
+    server_printf("Disconnected Client [ID: #%d] [%d clients]\n", client->id, atomic_fetch_sub(&hub->client_count, 1) - 1);
+
+    atomic_fetch_sub(&worker->assigned, 1);
+    free(client);
+
+    ended = atomic_load(&session->ended);
+    if(atomic_fetch_sub(&session->client_count, 1) == 1 && ended) write(hub->wake, &one, sizeof(one));
+}
+
+/**
+ * @brief remove every client of a worker that closed
+ *
+ * the last client is moved into each empty spot,
+ * so the order of the clients is not kept.
+ * the worker is locked the whole time, so the hub never reads a client that is being freed.
+ *
+ * @param worker the worker to remove the clients from
+ */
+static void hub_worker_sweep(struct hub_worker* worker)
+{
+    struct hub_client* client;
+    int i;
+
+    pthread_mutex_lock(&worker->lock);
+
+    for(i = worker->client_count - 1; i >= 0 && worker->closing > 0; --i)
+    {
+        client = worker->clients[i];
+        if(client->pipe.to >= 0) continue;
+
+        worker->clients[i] = worker->clients[--worker->client_count];
+        --worker->closing;
+        hub_client_free(client);
+    }
+
+    worker->closing = 0;
+
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/**
+ * @brief start waiting on a client that the hub handed over
+ *
+ * the client starts at the newest record of the feed, right after
+ * whatever is in the scrollback, so the session is locked while both are taken.
+ *
+ * @param worker the worker that owns the client from now on
+ * @param client the client
+ */
+static void hub_worker_adopt(struct hub_worker* worker, struct hub_client* client)
+{
+    struct hub_session* session = client->session;
+    struct hub_client** clients;
+    int i;
+
+    client->worker = worker;
+
+    pthread_mutex_lock(&worker->lock);
+
+    if(worker->client_count == worker->client_capacity)
+    {
+        clients = realloc(worker->clients, (worker->client_capacity + HUB_SESSION_GROWTH) * sizeof(*clients));
+        if(clients)
+        {
+            worker->clients = clients;
+            worker->client_capacity += HUB_SESSION_GROWTH;
+        }
+    }
+
+    if(worker->client_count == worker->client_capacity || hub_group_join(worker, client) < 0)
+    {
+        pthread_mutex_unlock(&worker->lock);
+
+        // The client was never in worker->clients, so it is freed without the lock,
+        // and hub_client_free(...) takes its fds out of epoll before closing them
+        server_printf("Unable to Add Client [ID: #%d]: %s [%d]\n", client->id, strerror(errno), errno);
+        hub_client_free(client);
+        return;
+    }
+
+    worker->clients[worker->client_count++] = client;
+
+    pthread_mutex_unlock(&worker->lock);
+
+    client->watches[0].kind = HUB_WATCH_INPUT;
+    client->watches[1].kind = HUB_WATCH_TERMINAL;
+    client->watches[2].kind = HUB_WATCH_OUTPUT;
+    client->watches[3].kind = HUB_WATCH_CONTROL;
+    for(i = 0; i < 4; ++i) client->watches[i].client = client;
+
+    hub_watch_input(client, 1);
+
+    pthread_mutex_lock(&session->lock);
+    client->cursor = atomic_load(&session->feed.header->head);
+    client->trace_seen = client->cursor;
+    if(session->scrollback.size) hub_scrollback_replay(client);
+    pthread_mutex_unlock(&session->lock);
+
+    // A session that ended before the worker joined it never wakes the worker for it
+    hub_client_pump(client);
+}
+
+/**
+ * @brief take every client that the hub has handed over since the last time
+ *
+ * @param worker the worker to add the clients to
+ */
+static void hub_worker_receive(struct hub_worker* worker)
+{
+    struct hub_client* clients[HUB_WORKER_EVENTS];
+    int i, read_size;
+
+    while((read_size = read(worker->inbox[0], clients, sizeof(clients))) > 0)
+        for(i = 0; i < read_size / (int)sizeof(*clients); ++i) hub_worker_adopt(worker, clients[i]);
+}
+
+/**
+ * @brief send the clients of every session whose feed has new records what they haven't got yet
+ *
+ * a wake doesn't say which sessions it was for, so the head of every session
+ * the worker has clients in is checked against what its group was last sent,
+ * and only the clients of the sessions that moved are pumped.
+ * with -z, the clients that are caught up are sent the shell output first, see hub_group_splice(...).
+ * clients that were stopped for a busy shell are read again once it caught up,
+ * and the clients of an ended session are told to close.
+ *
+ * @param worker the worker that was woken
+ */
+static void hub_worker_pump(struct hub_worker* worker)
+{
+    struct hub_session* session;
+    struct hub_client* client;
+    struct hub_group* group;
+    uint64_t head;
+    int i, j;
+
+    for(i = 0; i < worker->group_count; ++i)
+    {
+        group = worker->groups[i];
+        session = group->session;
+        head = atomic_load_explicit(&session->feed.header->head, memory_order_acquire);
+
+        if(head == group->seen && atomic_load(&session->input_blocked) == 0 && !atomic_load(&session->ended)) continue;
+        group->seen = head;
+
+        if(worker->hub->zero_copy && group->splice < 0) hub_group_splice_start(worker, group);
+        if(group->splice >= 0) hub_group_splice(worker, group, head);
+
+        for(j = 0; j < group->client_count; ++j)
+        {
+            client = group->clients[j];
+
+            if(client->input_paused && client->pipe.to >= 0) hub_client_input_resume(client);
+            hub_client_pump(client);
+        }
+    }
+}
+
+/**
+ * @brief relay between a shard of the clients and the feeds of their sessions until the hub stops
+ *
+ * every client of the worker is only ever touched by this thread, so:
+ *  - frames from a client are handled by hub_client_frames(...)
+ *  - when the feed of a session it has clients in has new records, those clients are
+ *    sent what they haven't got yet, see hub_worker_pump(...)
+ *  - a client that can take more after falling behind is sent its queue, and then the feed
+ *
+ * @param arg the worker to run
+ * @return NULL
+ */
+static void* hub_worker_run(void* arg)
+{
+    struct hub_worker* worker = arg;
+    struct epoll_event events[HUB_WORKER_EVENTS];
+    struct hub_client* client;
+    struct hub_watch* watch;
+    char buffer[BUFFER_SIZE];
+    int i, count, read_size, pump;
+    uint64_t value;
+
+    while(!atomic_load(&worker->hub->stopping))
+    {
+        count = epoll_wait(worker->epoll, events, HUB_WORKER_EVENTS, -1);
+
+        if(count < 0)
+        {
+            if(errno == EINTR) continue;
+
+            server_printf("Error in epoll_wait [WORKER: %d]: %s [%d]\n", worker->index, strerror(errno), errno);
+            break;
+        }
+
+        for(i = 0, pump = 0; i < count; ++i)
+        {
+            watch = events[i].data.ptr;
+            client = watch->client;
+
+            switch(watch->kind)
+            {
+                case HUB_WATCH_WAKE:
+                    read(worker->wake, &value, sizeof(value));
+                    pump = 1;
+                    break;
+
+                case HUB_WATCH_INBOX:
+                    hub_worker_receive(worker);
+                    break;
+
+                // Sockets share O_NONBLOCK with the side that is written to
+                case HUB_WATCH_INPUT:
+                    if(client->pipe.to < 0 || client->input_paused) break;
+
+                    read_size = frame_reader_fill(&client->reader, client->pipe.from);
+                    if(read_size < 0 && errno == EAGAIN) break;
+
+                    hub_stats_add(client->stats.reads, 1);
+                    if(read_size > 0) hub_stats_add(client->stats.bytes_in, read_size);
+
+                    if(read_size <= 0) hub_close(client);
+                    else hub_client_frames(client);
+                    break;
+
+                // Attached terminals are read from directly
+                case HUB_WATCH_TERMINAL:
+                    if(client->pipe.to < 0 || client->input_paused) break;
+
+                    read_size = read(client->terminal.from, buffer, BUFFER_SIZE);
+                    if(read_size < 0 && (errno == EAGAIN || errno == EINTR)) break;
+
+                    hub_stats_add(client->stats.reads, 1);
+                    if(read_size > 0) hub_stats_add(client->stats.bytes_in, read_size);
+                    if(read_size <= 0) hub_close(client);
+                    else hub_client_input(client, buffer, read_size);
+                    break;
+
+                case HUB_WATCH_OUTPUT:
+                    hub_flush_queue(client);
+                    hub_client_pump(client);
+                    break;
+
+                case HUB_WATCH_CONTROL:
+                    hub_flush(client, &client->control);
+                    hub_watch_output(client);
+                    break;
+            }
+        }
+
+        if(pump) hub_worker_pump(worker);
+
+        if(worker->closing) hub_worker_sweep(worker);
+    }
+
+    // The hub is stopping, so every client is told to close, after one last try at what it hasn't got yet
+    hub_worker_receive(worker);
+    for(i = 0; i < worker->client_count; ++i)
+    {
+        client = worker->clients[i];
+
+        hub_flush_queue(client);
+        hub_flush(client, &client->control);
+        hub_client_pump(client);
+        hub_send(client, FRAME_CLOSE, NULL, 0);
+        hub_close(client);
+    }
+    hub_worker_sweep(worker);
+
+    return NULL;
+}
+
+/**
+ * @brief start a worker thread, with its own epoll instance
+ *
+ * the worker waits on its eventfd, which is written whenever the feed of a session it has clients in has new records,
+ * and on the pipe that the hub hands clients over through.
+ * signals are left to the hub, so the caller should block them before this.
+ *
+ * @param hub the hub the worker belongs to
+ * @param worker the worker to start
+ * @param index the index of the worker in hub->workers
+ * @return 0 on success, -1 on error
+ */
+int hub_worker_start(struct server_hub* hub, struct hub_worker* worker, int index)
+{
+    struct epoll_event event;
+
+    memset(worker, 0, sizeof(*worker));
+    worker->hub = hub;
+    worker->index = index;
+    pthread_mutex_init(&worker->lock, NULL);
+
+    worker->epoll = epoll_create1(0);
+    worker->wake = eventfd(0, EFD_NONBLOCK);
+    worker->buffer = malloc(HUB_OUTPUT_SIZE);
+
+    if(worker->epoll < 0 || worker->wake < 0 || worker->buffer == NULL || pipe(worker->inbox) < 0) return -1;
+
+    // Everything the hub has handed over is taken in one go
+    fcntl(worker->inbox[0], F_SETFL, fcntl(worker->inbox[0], F_GETFL) | O_NONBLOCK);
+
+    worker->wake_watch.kind = HUB_WATCH_WAKE;
+    worker->inbox_watch.kind = HUB_WATCH_INBOX;
+
+    event.events = EPOLLIN;
+    event.data.ptr = &worker->wake_watch;
+    epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->wake, &event);
+
+    event.data.ptr = &worker->inbox_watch;
+    epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->inbox[0], &event);
+
+    errno = pthread_create(&worker->thread, NULL, hub_worker_run, worker);
+    return errno ? -1 : 0;
+}
+
+/**
+ * @brief hand a client over to a worker
+ *
+ * a pointer is smaller than PIPE_BUF, so it is always written in one piece.
+ *
+ * @param worker the worker that owns the client from now on
+ * @param client the client, which the worker frees once it disconnects
+ */
+void hub_worker_add(struct hub_worker* worker, struct hub_client* client)
+{
+    atomic_fetch_add(&worker->assigned, 1);
+    write(worker->inbox[1], &client, sizeof(client));
+}
+
+/**
+ * @brief tell a worker that a feed has new records
+ *
+ * the eventfd adds up every write until the worker reads it,
+ * so a burst of records only wakes the worker once.
+ *
+ * @param worker the worker to wake
+ */
+void hub_worker_wake(struct hub_worker* worker)
+{
+    uint64_t one = 1;
+    write(worker->wake, &one, sizeof(one));
+}
+
+/**
+ * @brief wait for a worker to close its clients and exit, once hub->stopping is set
+ *
+ * @param worker the worker to stop
+ */
+void hub_worker_stop(struct hub_worker* worker)
+{
+    hub_worker_wake(worker);
+    pthread_join(worker->thread, NULL);
+
+    close(worker->epoll);
+    close(worker->wake);
+    close(worker->inbox[0]);
+    close(worker->inbox[1]);
+    free(worker->clients);
+    free(worker->groups);
+    free(worker->buffer);
+    pthread_mutex_destroy(&worker->lock);
+}
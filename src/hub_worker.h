@@ -0,0 +1,18 @@
+#ifndef HUB_WORKER_HEADER_FILE
+#define HUB_WORKER_HEADER_FILE 1
+
+#include "server_hub.h"
+
+// Start a worker thread with its own epoll instance, returns 0 on success
+int hub_worker_start(struct server_hub*, struct hub_worker*, int index);
+
+// Hand a client that finished its handshake over to a worker
+void hub_worker_add(struct hub_worker*, struct hub_client*);
+
+// Tell a worker that a feed has new records
+void hub_worker_wake(struct hub_worker*);
+
+// Close every client of a stopping worker, and wait for its thread to exit
+void hub_worker_stop(struct hub_worker*);
+
+#endif
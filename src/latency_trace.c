@@ -0,0 +1,239 @@
+#include "latency_trace.h"
+
+#include <time.h>
+#include <sys/mman.h>
+
+struct latency_trace_table* latency_trace_shared = NULL;
+struct latency_trace_marks* latency_trace_session = NULL;
+
+// Names of the hops, in the JSON that latency_trace_print(...) prints
+static const char* latency_trace_names[TRACE_HOPS] =
+{
+    "client_to_worker",
+    "worker_to_shell",
+    "shell_run",
+    "shell_to_hub",
+    "hub_flush",
+    "feed_to_worker",
+    "worker_to_client",
+    "round_trip",
+};
+
+long long latency_trace_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief map memory that stays shared with every child forked after this
+ *
+ * @param size the number of bytes to map, which are all zero
+ * @return the memory, or NULL if it couldn't be mapped
+ */
+static void* latency_trace_map(size_t size)
+{
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+struct latency_trace_table* latency_trace_create()
+{
+    return latency_trace_map(sizeof(struct latency_trace_table));
+}
+
+struct latency_trace_marks* latency_trace_marks_create()
+{
+    return latency_trace_map(sizeof(struct latency_trace_marks));
+}
+
+void latency_trace_free(struct latency_trace_table* table)
+{
+    if(table) munmap(table, sizeof(*table));
+}
+
+void latency_trace_marks_free(struct latency_trace_marks* marks)
+{
+    if(marks) munmap(marks, sizeof(*marks));
+}
+
+/**
+ * @brief find the bucket of a latency
+ *
+ * below 1 << TRACE_SUB_BITS every value has its own bucket. above that, the highest bit
+ * picks the power of two, and the TRACE_SUB_BITS bits under it pick the bucket inside of it.
+ *
+ * @param ns the latency
+ * @return the index of its bucket
+ */
+static int latency_trace_bucket(uint64_t ns)
+{
+    int top, index;
+
+    if(ns < 1 << TRACE_SUB_BITS) return ns;
+
+    top = 63 - __builtin_clzll(ns);
+    index = ((top - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS) + ((ns >> (top - TRACE_SUB_BITS)) & ((1 << TRACE_SUB_BITS) - 1));
+
+    return index < TRACE_BUCKETS ? index : TRACE_BUCKETS - 1;
+}
+
+/**
+ * @return the smallest latency that goes in a bucket
+ */
+static uint64_t latency_trace_bucket_low(int index)
+{
+    int top;
+
+    if(index < 1 << TRACE_SUB_BITS) return index;
+
+    top = (index >> TRACE_SUB_BITS) + TRACE_SUB_BITS - 1;
+    return (uint64_t)((1 << TRACE_SUB_BITS) + (index & ((1 << TRACE_SUB_BITS) - 1))) << (top - TRACE_SUB_BITS);
+}
+
+/**
+ * @return the largest latency that goes in a bucket
+ */
+static uint64_t latency_trace_bucket_high(int index)
+{
+    if(index < 1 << TRACE_SUB_BITS) return index;
+    return latency_trace_bucket_low(index) + ((uint64_t)1 << ((index >> TRACE_SUB_BITS) - 1)) - 1;
+}
+
+/**
+ * @brief add a latency to the histogram of a hop
+ *
+ * the workers, the hub and the shells all record at the same time,
+ * so every counter is a relaxed atomic add, and the max is raised with a compare and swap.
+ *
+ * @param table the histograms to record into, or NULL if tracing is off
+ * @param hop the hop that was measured
+ * @param ns the latency of the hop
+ */
+void latency_trace_record(struct latency_trace_table* table, int hop, long long ns)
+{
+    struct latency_trace_histogram* histogram;
+    uint64_t max;
+
+    if(table == NULL || ns < 0) return;
+    histogram = &table->hops[hop];
+
+    atomic_fetch_add_explicit(&histogram->buckets[latency_trace_bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+
+    max = atomic_load_explicit(&histogram->max_ns, memory_order_relaxed);
+    while((uint64_t)ns > max && !atomic_compare_exchange_weak_explicit(&histogram->max_ns, &max, ns, memory_order_relaxed, memory_order_relaxed));
+}
+
+/**
+ * @brief end one hop of a sampled line, and start the next one
+ *
+ * @param table the histograms to record into
+ * @param hop the hop that ends
+ * @param from the mark that the hop started with, which is cleared
+ * @param next the mark of the next hop, or NULL if it isn't kept in a mark
+ * @return the time the hop ended, or 0 if no sampled line was waiting in from
+ */
+long long latency_trace_hand_off(struct latency_trace_table* table, int hop, _Atomic long long* from, _Atomic long long* next)
+{
+    long long started, now;
+
+    if(table == NULL) return 0;
+
+    started = atomic_exchange(from, 0);
+    if(started == 0) return 0;
+
+    now = latency_trace_now_ns();
+    latency_trace_record(table, hop, now - started);
+    if(next) atomic_store(next, now);
+
+    return now;
+}
+
+/**
+ * @brief find the latency that a fraction of the samples of a hop are under
+ *
+ * the high end of the bucket is used, so a percentile is never lower than the real one
+ * by more than the width of its bucket, and never above the max.
+ *
+ * @param histogram the histogram of the hop
+ * @param count the number of samples, read once so every percentile agrees
+ * @param fraction the fraction of the samples, like 0.99
+ * @return the percentile in nanoseconds
+ */
+static uint64_t latency_trace_percentile(struct latency_trace_histogram* histogram, uint64_t count, double fraction)
+{
+    uint64_t seen = 0, wanted = fraction * count, max = atomic_load(&histogram->max_ns), high;
+    int i;
+
+    if(wanted == 0) wanted = 1;
+
+    for(i = 0; i < TRACE_BUCKETS; ++i)
+    {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if(seen < wanted) continue;
+
+        high = latency_trace_bucket_high(i);
+        return high < max ? high : max;
+    }
+
+    return max;
+}
+
+/**
+ * @brief print the histograms of every hop that has samples as JSON
+ *
+ * every hop has its count, mean, percentiles and max, and every bucket
+ * that isn't empty as [lowest ns, count]. the histograms keep changing while
+ * they are printed, so the buckets can add up to a little more than the count.
+ *
+ * @param stream where the JSON is printed
+ * @param table the histograms to print, prints null if it is NULL
+ */
+void latency_trace_print(FILE* stream, struct latency_trace_table* table)
+{
+    static const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char* percentiles[] = { "p50_ns", "p90_ns", "p99_ns", "p999_ns" };
+    struct latency_trace_histogram* histogram;
+    uint64_t count, bucket;
+    int hop, i, first = 1, first_bucket;
+
+    if(table == NULL)
+    {
+        fprintf(stream, "null");
+        return;
+    }
+
+    fprintf(stream, "{");
+
+    for(hop = 0; hop < TRACE_HOPS; ++hop)
+    {
+        histogram = &table->hops[hop];
+        count = atomic_load(&histogram->count);
+        if(count == 0) continue;
+
+        fprintf(stream, "%s\n  \"%s\": {\"count\": %llu, \"mean_ns\": %llu", first ? "" : ",", latency_trace_names[hop],
+            (unsigned long long)count, (unsigned long long)(atomic_load(&histogram->total_ns) / count));
+
+        for(i = 0; i < 4; ++i)
+            fprintf(stream, ", \"%s\": %llu", percentiles[i], (unsigned long long)latency_trace_percentile(histogram, count, fractions[i]));
+
+        fprintf(stream, ", \"max_ns\": %llu, \"buckets\": [", (unsigned long long)atomic_load(&histogram->max_ns));
+
+        for(i = 0, first_bucket = 1; i < TRACE_BUCKETS; ++i)
+        {
+            bucket = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+            if(bucket == 0) continue;
+
+            fprintf(stream, "%s[%llu, %llu]", first_bucket ? "" : ", ", (unsigned long long)latency_trace_bucket_low(i), (unsigned long long)bucket);
+            first_bucket = 0;
+        }
+
+        fprintf(stream, "]}");
+        first = 0;
+    }
+
+    fprintf(stream, "}");
+}
@@ -0,0 +1,76 @@
+#ifndef LATENCY_TRACE_HEADER_FILE
+#define LATENCY_TRACE_HEADER_FILE 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// The hops that a sampled line is timed across, in the order it takes them.
+// every hop is measured by the side that ends it, with CLOCK_MONOTONIC,
+// which is the same clock in every process on the machine
+#define TRACE_HOP_CLIENT_TO_WORKER 0    // client sends the line     -> its worker reads the frame
+#define TRACE_HOP_WORKER_TO_SHELL 1     // worker writes the shell   -> shell_readline() has the line
+#define TRACE_HOP_SHELL_RUN 2           // shell has the line        -> shell writes its next prompt
+#define TRACE_HOP_SHELL_TO_HUB 3        // shell writes the prompt   -> hub reads it
+#define TRACE_HOP_HUB_FLUSH 4           // hub reads the prompt      -> hub publishes it to the feed
+#define TRACE_HOP_FEED_TO_WORKER 5      // hub publishes the prompt  -> a worker writes it to a client
+#define TRACE_HOP_WORKER_TO_CLIENT 6    // worker writes the prompt  -> the client that sent the line reads it
+#define TRACE_HOP_ROUND_TRIP 7          // client sends the line     -> the client reads the prompt
+#define TRACE_HOPS 8
+
+// Every power of two is split into 1 << TRACE_SUB_BITS buckets, so a bucket is never
+// more than 1 / (1 << TRACE_SUB_BITS) wider than the values in it. values are in nanoseconds,
+// and anything past 1 << TRACE_MAX_BITS (about 18 minutes) goes in the last bucket
+#define TRACE_SUB_BITS 3
+#define TRACE_MAX_BITS 40
+#define TRACE_BUCKETS ((TRACE_MAX_BITS - TRACE_SUB_BITS + 2) << TRACE_SUB_BITS)
+
+// Log-bucketed latencies of one hop, which any thread or process can record into at once
+struct latency_trace_histogram
+{
+    _Atomic uint64_t count;
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[TRACE_BUCKETS];
+};
+
+struct latency_trace_table
+{
+    struct latency_trace_histogram hops[TRACE_HOPS];
+};
+
+// Timestamps that hand a sampled line from the hub to the shell of a session and back.
+// each one is set by the hop that starts, and taken by the hop that ends, 0 means nothing is waiting
+struct latency_trace_marks
+{
+    _Atomic long long input_ns;
+    _Atomic long long line_ns;
+    _Atomic long long prompt_ns;
+};
+
+// Histograms of the server, and the marks of the session whose shell is being started.
+// both are shared memory, so a forked shell records into the same histograms as the server.
+// NULL while tracing is off
+extern struct latency_trace_table* latency_trace_shared;
+extern struct latency_trace_marks* latency_trace_session;
+
+// CLOCK_MONOTONIC in nanoseconds
+long long latency_trace_now_ns();
+
+// Map zeroed histograms / marks that forked children share, returns NULL on failure
+struct latency_trace_table* latency_trace_create();
+struct latency_trace_marks* latency_trace_marks_create();
+void latency_trace_free(struct latency_trace_table*);
+void latency_trace_marks_free(struct latency_trace_marks*);
+
+// Add a latency to the histogram of a hop, does nothing if table is NULL
+void latency_trace_record(struct latency_trace_table*, int hop, long long ns);
+
+// Take the timestamp in from, record the time since it as hop, and pass the time on to next.
+// returns the time now, or 0 if nothing was waiting in from
+long long latency_trace_hand_off(struct latency_trace_table*, int hop, _Atomic long long* from, _Atomic long long* next);
+
+// Print every hop that has samples as a JSON object, with its percentiles and buckets
+void latency_trace_print(FILE*, struct latency_trace_table*);
+
+#endif
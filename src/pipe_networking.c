@@ -1,25 +1,22 @@
+#define _GNU_SOURCE
 #include "pipe_networking.h"
 
+#include <poll.h>
+#include <stddef.h>
+
 /*=========================
-  server_handshake
-  args: int * to_client
+  server_listen
+  args: int * keep_open
 
-  Performs the client side pipe 3 way handshake.
-  Sets *to_client to the file descriptor to the downstream pipe.
+  Creates the WKP once and opens it without blocking,
+  so that it can be waited on with select() for as long as the server runs.
+  Sets *keep_open to a write end of the WKP that the server holds onto,
+  so the WKP doesn't look closed every time the last client finishes writing to it.
 
-  returns the file descriptor for the upstream pipe.
+  returns the file descriptor for the WKP.
   =========================*/
-int server_handshake(int *to_client) {
-    // Reset File Descriptors
+int server_listen(int *keep_open) {
     int from_client;
-    
-    // Create Buffer
-    char private_pipe[BUFFER_SIZE] = {}, ack[HANDSHAKE_BUFFER_SIZE];
-    int bytes_read;
-
-    // Reset File Descriptors
-    from_client = -1;
-    *to_client = -1;
 
     // Create WKP
     remove(WKP);
@@ -30,103 +27,704 @@ int server_handshake(int *to_client) {
     }
     else server_printf("Created WKP\n");
 
-    // Open the WKP
-    from_client = open(WKP, O_RDONLY);
-    if(from_client < 0)
+    // Open the WKP, but don't wait for a client to open the other end
+    from_client = open(WKP, O_RDONLY | O_NONBLOCK);
+    *keep_open = open(WKP, O_WRONLY | O_NONBLOCK);
+    if(from_client < 0 || *keep_open < 0)
     {
         server_printf("Error when opening WKP: %s [%d]\n", strerror(errno), errno);
         exit(-1);
     }
     else server_printf("Opened WKP\n");
-    remove(WKP);
 
-    // Read name of private pipe from client and open it
-    bytes_read = read(from_client, private_pipe, BUFFER_SIZE);
-    server_printf("Recieved %d bytes of input from WKP, closing\n", bytes_read);
-    *to_client = open(private_pipe, O_WRONLY);
+    return from_client;
+}
 
-    if(*to_client < 0)
-         server_printf("Error Opening Pipe %s: %s [%d]\n", private_pipe, strerror(errno), errno);
-    else server_printf("Opened Pipe %s\n", private_pipe);
 
-    // Write ACK to server
-    write(*to_client, ACK, sizeof(ACK));
-    server_printf("Sent ACK\n");
+/*=========================
+  handshake_session
+  args: char * session, const char * requested
+
+  Copies the session a client asked for into session, which holds HANDSHAKE_SESSION_SIZE bytes.
+  Clients that didn't ask for one join DEFAULT_SESSION.
+  =========================*/
+static void handshake_session(char *session, const char *requested) {
+    snprintf(session, HANDSHAKE_SESSION_SIZE, "%.*s", HANDSHAKE_SESSION_SIZE - 1, requested && *requested ? requested : DEFAULT_SESSION);
+}
+
+
+/*=========================
+  server_accept
+  args: int listener, bi_file * client, char * session, int full
+
+  Reads one connection request from the WKP and opens both private pipes of the client
+  without blocking. If full is set, the client is sent NAK and the pipes are closed,
+  otherwise it is sent ACK and the handshake is finished by server_finish_accept.
+  The session the client asked for is copied into session.
+
+  returns 1 if the handshake was started, 0 if the request was rejected,
+          -1 if there are no more requests waiting on the WKP.
+  =========================*/
+int server_accept(int listener, bi_file *client, char *session, int full) {
+    struct handshake_request request;
+    char private_pipe[HANDSHAKE_PIPE_SIZE + 8];
+    int bytes_read;
+
+    client->from = -1;
+    client->to = -1;
+
+    // Requests are written with a single write that is smaller than PIPE_BUF,
+    // so they never get mixed up with each other
+    bytes_read = read(listener, &request, sizeof(request));
+    if(bytes_read < 0) return -1;
+    if(bytes_read != sizeof(request))
+    {
+        server_printf("Recieved %d bytes of input from WKP, ignoring\n", bytes_read);
+        return bytes_read ? 0 : -1;
+    }
+    request.private_pipe[HANDSHAKE_PIPE_SIZE - 1] = '\0';
+    request.session[HANDSHAKE_SESSION_SIZE - 1] = '\0';
+    handshake_session(session, request.session);
+
+    // The client is already reading from its downstream pipe, so this doesn't block
+    sprintf(private_pipe, "%s.down", request.private_pipe);
+    client->to = open(private_pipe, O_WRONLY | O_NONBLOCK);
+    if(client->to < 0)
+    {
+        server_printf("Error Opening Pipe %s: %s [%d]\n", private_pipe, strerror(errno), errno);
+        return 0;
+    }
+
+    if(full)
+    {
+        write(client->to, NAK, sizeof(NAK));
+        server_printf("Sent NAK to %s\n", request.private_pipe);
+        close(client->to);
+        client->to = -1;
+        return 0;
+    }
+
+    sprintf(private_pipe, "%s.up", request.private_pipe);
+    client->from = open(private_pipe, O_RDONLY | O_NONBLOCK);
+    if(client->from < 0)
+    {
+        server_printf("Error Opening Pipe %s: %s [%d]\n", private_pipe, strerror(errno), errno);
+        close(client->to);
+        client->to = -1;
+        return 0;
+    }
+
+    // Write ACK to client
+    write(client->to, ACK, sizeof(ACK));
+    server_printf("Sent ACK to %s\n", request.private_pipe);
+
+    return 1;
+}
+
+
+/*=========================
+  server_finish_accept
+  args: bi_file * client
+
+  Reads the ACK of a client that was accepted by server_accept,
+  once its upstream pipe is readable. The pipes are made blocking again.
+
+  returns 1 if the handshake is done, -1 if it failed.
+  =========================*/
+int server_finish_accept(bi_file *client) {
+    char ack[HANDSHAKE_BUFFER_SIZE] = {};
 
     // Recieve ACK from client
-    if(read(from_client, ack, HANDSHAKE_BUFFER_SIZE) != sizeof(ACK))
-         server_printf("Error Recieving ACK, but I don't care [%s]\n", ack);
-    else server_printf("Recieved ACK [%s]\n", ack); 
+    if(read(client->from, ack, sizeof(ACK)) != sizeof(ACK) || strcmp(ack, ACK) != 0)
+    {
+        server_printf("Error Recieving ACK [%s]\n", ack);
+        return -1;
+    }
+    else server_printf("Recieved ACK [%s]\n", ack);
 
-    return from_client;
+    fcntl(client->from, F_SETFL, fcntl(client->from, F_GETFL) & ~O_NONBLOCK);
+    fcntl(client->to, F_SETFL, fcntl(client->to, F_GETFL) & ~O_NONBLOCK);
+
+    return 1;
 }
 
 
 /*=========================
   client_handshake
-  args: int * to_server
+  args: int * to_server, const char * session
 
-  Performs the client side pipe 3 way handshake.
+  Performs the client side pipe 3 way handshake, asking to join session.
   Sets *to_server to the file descriptor for the upstream pipe.
 
   returns the file descriptor for the downstream pipe.
   =========================*/
-int client_handshake(int *to_server) {
-    int from_server;
+int client_handshake(int *to_server, const char *session) {
+    static int connections = 0;
 
-    // Create Buffer
-    char private_pipe[BUFFER_SIZE] = {}, ack[HANDSHAKE_BUFFER_SIZE];
-    sprintf(private_pipe, "%d", getpid());
+    struct handshake_request request;
+    char down_pipe[HANDSHAKE_PIPE_SIZE + 8], up_pipe[HANDSHAKE_PIPE_SIZE + 8];
+    char ack[HANDSHAKE_BUFFER_SIZE] = {};
+    struct pollfd wait_for_ack;
+    int from_server, wkp;
 
     // Reset File Descriptors
     from_server = -1;
     *to_server = -1;
 
-    // Set Private Pipe
-    sprintf(private_pipe, "%d", getpid());
+    // Set Private Pipes, which are unique to this connection
+    memset(&request, 0, sizeof(request));
+    sprintf(request.private_pipe, "%d_%d", getpid(), connections++);
+    handshake_session(request.session, session);
+    sprintf(down_pipe, "%s.down", request.private_pipe);
+    sprintf(up_pipe, "%s.up", request.private_pipe);
+
+    // Create private pipes
+    remove(down_pipe);
+    remove(up_pipe);
+    if(mkfifo(down_pipe, 0666) || mkfifo(up_pipe, 0666))
+    {
+        client_printf("Error when creating private pipes %s: %s [%d]\n", request.private_pipe, strerror(errno), errno);
+        goto cleanup;
+    }
+    else client_printf("Created private pipes %s\n", request.private_pipe);
+
+    // Open downstream pipe first, so the server can open it without blocking
+    from_server = open(down_pipe, O_RDONLY | O_NONBLOCK);
+    if(from_server < 0)
+    {
+        client_printf("Error Opening Pipe %s: %s [%d]\n", down_pipe, strerror(errno), errno);
+        goto cleanup;
+    }
 
     // Try To Open WKP
-    *to_server = open(WKP, O_WRONLY);
-    
-    // Create Pipe
-    if(*to_server < 0)
+    wkp = open(WKP, O_WRONLY | O_NONBLOCK);
+    if(wkp < 0)
     {
         client_printf("Error when opening WKP: %s [%d]\n", strerror(errno), errno);
-        return from_server;
+        goto fail;
     }
     else client_printf("Opened WKP\n");
 
-    // Create private pipe
-    remove(private_pipe);
-    if(mkfifo(private_pipe, 0666))
+    // Write name of private pipes to server
+    write(wkp, &request, sizeof(request));
+    close(wkp);
+    client_printf("Wrote %s to WKP\n", request.private_pipe);
+
+    // Wait for ACK from server
+    wait_for_ack.fd = from_server;
+    wait_for_ack.events = POLLIN;
+    if(poll(&wait_for_ack, 1, HANDSHAKE_TIMEOUT_MS) <= 0)
     {
-        client_printf("Error when creating private pipe %s: %s [%d]\n", private_pipe, strerror(errno), errno);
-        return from_server;
+        client_printf("Timed out waiting for ACK\n");
+        goto fail;
     }
-    else client_printf("Created private pipe %s\n", private_pipe);
 
-    // Write name of private_pipe to server
-    write(*to_server, private_pipe, BUFFER_SIZE);
-    client_printf("Wrote %s to WKP\n", private_pipe);
+    if(read(from_server, ack, sizeof(ACK)) != sizeof(ACK) || strcmp(ack, ACK) != 0)
+    {
+        if(strcmp(ack, NAK) == 0) client_printf("Server is full\n");
+        else client_printf("Error Recieving ACK [%s]\n", ack);
+        goto fail;
+    }
+    else client_printf("Recieved ACK [%s]\n", ack); 
 
-    // Open private pipe to read from server
-    from_server = open(private_pipe, O_RDONLY);
-    if(from_server < 0)
+    // The server is already reading from the upstream pipe
+    *to_server = open(up_pipe, O_WRONLY | O_NONBLOCK);
+    if(*to_server < 0)
     {
-        client_printf("Error Opening Pipe %s: %s [%d]\n", private_pipe, strerror(errno), errno);
-        return from_server;
+        client_printf("Error Opening Pipe %s: %s [%d]\n", up_pipe, strerror(errno), errno);
+        goto fail;
     }
-    else client_printf("Opened Pipe %s\n", private_pipe);
-    remove(private_pipe);
 
-    // Wait for ACK from server
-    if(read(from_server, ack, HANDSHAKE_BUFFER_SIZE) != sizeof(ACK))
-         client_printf("Error Recieving ACK, but I don't care [%s]\n", ack);
-    else client_printf("Recieved ACK [%s]\n", ack); 
+    fcntl(from_server, F_SETFL, fcntl(from_server, F_GETFL) & ~O_NONBLOCK);
+    fcntl(*to_server, F_SETFL, fcntl(*to_server, F_GETFL) & ~O_NONBLOCK);
 
     // Write ACK to server
     write(*to_server, ACK, sizeof(ACK));
     client_printf("Sent ACK\n");
 
+    goto cleanup;
+
+    fail:
+    close(from_server);
+    from_server = -1;
+
+    cleanup:
+    remove(down_pipe);
+    remove(up_pipe);
+
     return from_server;
+}
+
+
+/*=========================
+  socket_address
+  args: struct sockaddr_un * address
+
+  Fills in the address of the server's socket in the abstract namespace.
+
+  returns the length of the address.
+  =========================*/
+static socklen_t socket_address(struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    // The first byte of sun_path is left as 0 for the abstract namespace
+    memcpy(address->sun_path + 1, SOCKET_NAME, sizeof(SOCKET_NAME) - 1);
+    return offsetof(struct sockaddr_un, sun_path) + sizeof(SOCKET_NAME);
+}
+
+
+/*=========================
+  server_socket_listen
+  args: none
+
+  Creates the unix socket that clients can connect to instead of the WKP.
+
+  returns the file descriptor of the listening socket, or -1 if it couldn't be created.
+  =========================*/
+int server_socket_listen() {
+    struct sockaddr_un address;
+    socklen_t length = socket_address(&address);
+    int listener;
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listener < 0 || bind(listener, (struct sockaddr*)&address, length) < 0 || listen(listener, SOMAXCONN) < 0)
+    {
+        server_printf("Error when creating socket: %s [%d]\n", strerror(errno), errno);
+        if(listener >= 0) close(listener);
+        return -1;
+    }
+    else server_printf("Listening on socket @%s\n", SOCKET_NAME);
+
+    return listener;
+}
+
+
+/*=========================
+  server_stats_listen
+  args: none
+
+  Creates the stats socket in the current directory, replacing one left behind by an old server.
+  Nothing is ever read from it, so it is only ever written to.
+
+  returns the file descriptor of the listening socket, or -1 if it couldn't be created.
+  =========================*/
+int server_stats_listen() {
+    struct sockaddr_un address;
+    int listener;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, STATS_NAME, sizeof(STATS_NAME));
+
+    remove(STATS_NAME);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0)
+    {
+        server_printf("Error when creating stats socket: %s [%d]\n", strerror(errno), errno);
+        if(listener >= 0) close(listener);
+        return -1;
+    }
+    else server_printf("Serving stats on %s\n", STATS_NAME);
+
+    return listener;
+}
+
+
+/*=========================
+  server_socket_accept
+  args: int listener
+
+  Accepts the next connection on the socket, and checks with SO_PEERCRED
+  that the client is run by the same user as the server (or root).
+  Connections from anyone else are closed right away.
+
+  returns the file descriptor of the connection, or -1 if there are no more waiting.
+  =========================*/
+int server_socket_accept(int listener) {
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    int connection;
+
+    while(1)
+    {
+        connection = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(connection < 0) return -1;
+
+        if(getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0
+        && (credentials.uid == getuid() || credentials.uid == 0))
+        {
+            server_printf("Accepted socket from pid %d [uid %d]\n", credentials.pid, credentials.uid);
+            return connection;
+        }
+
+        server_printf("Rejected socket from pid %d [uid %d]\n", credentials.pid, credentials.uid);
+        close(connection);
+    }
+}
+
+
+/*=========================
+  server_socket_finish_accept
+  args: int socket_fd, bi_file * client, bi_file * terminal, char * session, int full
+
+  Reads the socket_request of a client once the socket is readable, and answers it with ACK,
+  or NAK if full is set or the descriptors it passed were cut off. If the client attached
+  its terminal, *terminal is set to the two file descriptors it passed, otherwise both are -1.
+  Any other descriptors that come with the request are closed.
+  The session the client asked for is copied into session.
+  Sets client to the socket, with a separate descriptor for each direction.
+
+  returns 1 if the client is connected, -1 if it failed or was rejected.
+  =========================*/
+int server_socket_finish_accept(int socket_fd, bi_file *client, bi_file *terminal, char *session, int full) {
+    struct socket_request request;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct msghdr message;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    int fds[2], *passed;
+    size_t i, count;
+    ssize_t received;
+
+    terminal->from = -1;
+    terminal->to = -1;
+
+    memset(&message, 0, sizeof(message));
+    iov.iov_base = &request;
+    iov.iov_len = sizeof(request);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+
+    // Take the terminal of the client if it asked to attach and passed exactly two descriptors.
+    // Any other descriptors that came with the request are closed, so they never leak
+    for(cmsg = CMSG_FIRSTHDR(&message); received > 0 && cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        passed = (int *)CMSG_DATA(cmsg);
+
+        if(received == sizeof(request) && (request.flags & SOCKET_ATTACH) && count == 2 && terminal->from < 0)
+        {
+            memcpy(fds, passed, sizeof(fds));
+            terminal->from = fds[0];
+            terminal->to = fds[1];
+            continue;
+        }
+
+        for(i = 0; i < count; ++i)
+        {
+            memcpy(fds, passed + i, sizeof(int));
+            close(fds[0]);
+        }
+    }
+
+    if(received != sizeof(request))
+    {
+        server_printf("Error Recieving Socket Request\n");
+        close(socket_fd);
+        if(terminal->from >= 0) { close(terminal->from); close(terminal->to); }
+        terminal->from = terminal->to = -1;
+        return -1;
+    }
+
+    request.session[HANDSHAKE_SESSION_SIZE - 1] = '\0';
+    handshake_session(session, request.session);
+
+    // The kernel cut off some of the descriptors that were passed, so the request is turned down
+    if(message.msg_flags & MSG_CTRUNC)
+    {
+        server_printf("Socket Request had its Descriptors Cut Off\n");
+        full = 1;
+    }
+
+    if(full || ((request.flags & SOCKET_ATTACH) && terminal->from < 0))
+    {
+        write(socket_fd, NAK, sizeof(NAK));
+        server_printf("Sent NAK to socket\n");
+
+        close(socket_fd);
+        if(terminal->from >= 0) { close(terminal->from); close(terminal->to); }
+        terminal->from = terminal->to = -1;
+        return -1;
+    }
+
+    fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) & ~O_NONBLOCK);
+
+    write(socket_fd, ACK, sizeof(ACK));
+    server_printf("Sent ACK to socket%s\n", terminal->from >= 0 ? " [attached]" : "");
+
+    client->from = socket_fd;
+    client->to = dup(socket_fd);
+    return 1;
+}
+
+
+/*=========================
+  client_socket_handshake
+  args: int * to_server, int attach, const char * session
+
+  Connects to the server's unix socket, which only takes a single round trip,
+  asking to join session.
+  The server is checked with SO_PEERCRED to be run by the same user (or root).
+  If attach is set, stdin and stdout are passed to the server with SCM_RIGHTS.
+  Sets *to_server to the file descriptor for the upstream direction.
+
+  returns the file descriptor for the downstream direction, or -1 on error.
+  =========================*/
+int client_socket_handshake(int *to_server, int attach, const char *session) {
+    struct sockaddr_un address;
+    socklen_t length = socket_address(&address);
+    struct socket_request request;
+    struct ucred credentials;
+    socklen_t credentials_length = sizeof(credentials);
+    char control[CMSG_SPACE(2 * sizeof(int))], ack[HANDSHAKE_BUFFER_SIZE] = {};
+    int fds[2] = { STDIN_FILENO, STDOUT_FILENO };
+    struct msghdr message;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    int from_server;
+
+    *to_server = -1;
+
+    from_server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(from_server < 0 || connect(from_server, (struct sockaddr*)&address, length) < 0)
+    {
+        client_printf("Error when connecting to socket @%s: %s [%d]\n", SOCKET_NAME, strerror(errno), errno);
+        goto fail;
+    }
+    else client_printf("Connected to socket @%s\n", SOCKET_NAME);
+
+    if(getsockopt(from_server, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_length) < 0
+    || (credentials.uid != getuid() && credentials.uid != 0))
+    {
+        client_printf("Server is run by a different user, closing\n");
+        goto fail;
+    }
+
+    // Send the request, with the terminal attached to it
+    memset(&message, 0, sizeof(message));
+    memset(&request, 0, sizeof(request));
+    request.flags = attach ? SOCKET_ATTACH : 0;
+    handshake_session(request.session, session);
+    iov.iov_base = &request;
+    iov.iov_len = sizeof(request);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    if(attach)
+    {
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+
+    if(sendmsg(from_server, &message, 0) != sizeof(request))
+    {
+        client_printf("Error when sending request: %s [%d]\n", strerror(errno), errno);
+        goto fail;
+    }
+
+    // Wait for ACK from server
+    if(read(from_server, ack, sizeof(ACK)) != sizeof(ACK) || strcmp(ack, ACK) != 0)
+    {
+        if(strcmp(ack, NAK) == 0) client_printf("Server is full\n");
+        else client_printf("Error Recieving ACK [%s]\n", ack);
+        goto fail;
+    }
+    else client_printf("Recieved ACK [%s]%s\n", ack, attach ? " [attached]" : "");
+
+    *to_server = dup(from_server);
+    return from_server;
+
+    fail:
+    if(from_server >= 0) close(from_server);
+    return -1;
+}
+
+
+/*=========================
+  frame_header_init
+  args: struct frame_header * header, int type, uint32_t sequence, uint32_t length
+
+  Fills in the header of a frame.
+  =========================*/
+void frame_header_init(struct frame_header *header, int type, uint32_t sequence, uint32_t length) {
+    memset(header, 0, sizeof(*header));
+    header->type = type;
+    header->length = length;
+    header->sequence = sequence;
+}
+
+
+/*=========================
+  frame_write
+  args: int fd, int type, uint32_t sequence, const void * payload, uint32_t length
+
+  Writes a single frame to fd, with the header and payload in the same writev().
+  Short writes are continued until the whole frame is written.
+
+  returns the number of bytes written, or -1 if the write failed.
+  =========================*/
+int frame_write(int fd, int type, uint32_t sequence, const void *payload, uint32_t length) {
+    struct frame_header header;
+    struct iovec iov[2];
+    int count = 2, total = 0, written;
+
+    frame_header_init(&header, type, sequence, length);
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = length;
+
+    while(count)
+    {
+        written = writev(fd, iov + 2 - count, count);
+        if(written < 0)
+        {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+
+        total += written;
+
+        // Skip over everything that was written
+        while(count && written >= iov[2 - count].iov_len)
+        {
+            written -= iov[2 - count].iov_len;
+            --count;
+        }
+
+        if(count)
+        {
+            iov[2 - count].iov_base = (char*)iov[2 - count].iov_base + written;
+            iov[2 - count].iov_len -= written;
+        }
+    }
+
+    return total;
+}
+
+
+/*=========================
+  frame_reader_init
+  args: struct frame_reader * reader
+
+  Creates an empty frame reader.
+  =========================*/
+void frame_reader_init(struct frame_reader *reader) {
+    reader->capacity = BUFFER_SIZE + sizeof(struct frame_header);
+    reader->buffer = malloc(reader->capacity);
+    reader->start = 0;
+    reader->end = 0;
+    reader->sequence = 0;
+}
+
+
+/*=========================
+  frame_reader_fill
+  args: struct frame_reader * reader, int fd
+
+  Reads everything that fits into the buffer of the reader with a single read().
+  The buffer grows if the frame at the front of it doesn't fit.
+
+  returns the number of bytes read, 0 if fd was closed,
+  -1 on error or if the buffer couldn't grow, which should drop the connection.
+  =========================*/
+int frame_reader_fill(struct frame_reader *reader, int fd) {
+    struct frame_header* header;
+    uint32_t needed;
+    char* buffer;
+    int bytes_read;
+
+    // Move the unread bytes to the front
+    if(reader->start)
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    // Make sure the whole frame at the front fits
+    if(reader->end >= sizeof(struct frame_header))
+    {
+        header = (struct frame_header*)reader->buffer;
+        if(header->length > FRAME_MAX_LENGTH) { errno = EMSGSIZE; return -1; }
+
+        needed = sizeof(struct frame_header) + header->length;
+        if(needed > reader->capacity)
+        {
+            // The old buffer is kept on failure, so the caller can still free the reader
+            buffer = realloc(reader->buffer, needed);
+            if(buffer == NULL) return -1;
+
+            reader->buffer = buffer;
+            reader->capacity = needed;
+        }
+    }
+
+    do bytes_read = read(fd, reader->buffer + reader->end, reader->capacity - reader->end);
+    while(bytes_read < 0 && errno == EINTR);
+
+    if(bytes_read > 0) reader->end += bytes_read;
+    return bytes_read;
+}
+
+
+/*=========================
+  frame_reader_next
+  args: struct frame_reader * reader, struct frame * frame
+
+  Takes the next complete frame out of the reader.
+  frame->payload points into the reader, and is only valid until the next frame_reader_fill.
+  A frame with an unexpected sequence number is still returned, but a warning is printed.
+
+  returns 1 if a frame was found, 0 if more bytes need to be read.
+  =========================*/
+int frame_reader_next(struct frame_reader *reader, struct frame *frame) {
+    struct frame_header header;
+    uint32_t available = reader->end - reader->start;
+
+    if(available < sizeof(header)) return 0;
+
+    memcpy(&header, reader->buffer + reader->start, sizeof(header));
+    if(available - sizeof(header) < header.length) return 0;
+
+    if(header.sequence != reader->sequence)
+        fprintf(stderr, "[FRAME] Expected sequence %u, recieved %u\n", reader->sequence, header.sequence);
+    reader->sequence = header.sequence + 1;
+
+    frame->type = header.type;
+    frame->length = header.length;
+    frame->sequence = header.sequence;
+    frame->payload = reader->buffer + reader->start + sizeof(header);
+
+    reader->start += sizeof(header) + header.length;
+    return 1;
+}
+
+
+/*=========================
+  frame_reader_free
+  args: struct frame_reader * reader
+
+  Frees the buffer of a frame reader.
+  =========================*/
+void frame_reader_free(struct frame_reader *reader) {
+    free(reader->buffer);
+    reader->buffer = NULL;
+    reader->capacity = reader->start = reader->end = 0;
 }
\ No newline at end of file
@@ -7,6 +7,11 @@
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <stdint.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #ifndef NETWORKING_H
 #define NETWORKING_H
@@ -15,16 +20,143 @@
 #define PIPE_OUTPUT 0
 
 #define ACK "HOLA"
+#define NAK "FULL"
 #define WKP "multi_shell_pipe"
-#define PANIC "THE_PROGRAM_IS_ENDING_AND_YOU_NEED_TO_CLOSE"
+
+// Name of the unix socket in the abstract namespace, so there is no file to clean up
+#define SOCKET_NAME "multi_shell_socket"
+
+// Unix socket next to the WKP, which sends the counters of the server as JSON to anyone who connects
+#define STATS_NAME "multi_shell_stats"
 
 #define server_printf(args...) fprintf(stderr, "[SERVER] " args)
 #define client_printf(args...) fprintf(stderr, "[CLIENT] " args)
 
 #define HANDSHAKE_BUFFER_SIZE 10
+#define HANDSHAKE_PIPE_SIZE 64
+#define HANDSHAKE_SESSION_SIZE 32
+#define HANDSHAKE_TIMEOUT_MS 1000
 #define BUFFER_SIZE 1000
 
-int server_handshake(int *to_client);
-int client_handshake(int *to_server);
+// Session that clients join if they don't ask for one
+#define DEFAULT_SESSION "default"
+
+// Written to the WKP to ask for a connection.
+// The client has already created <private_pipe>.down and <private_pipe>.up,
+// and is reading from <private_pipe>.down.
+// session is the name of the shell to join, which the server starts if it isn't running yet.
+struct handshake_request
+{
+    char private_pipe[HANDSHAKE_PIPE_SIZE];
+    char session[HANDSHAKE_SESSION_SIZE];
+};
+
+// A pair of file descriptors, one to read from and one to write to
+typedef union {
+    struct {
+        int from;
+        int to;
+    };
+
+    int pipe[2];
+} bi_file;
+
+// Every message between a client and the server is sent as a frame,
+// which is a frame_header followed by length bytes of payload.
+// Both sides are on the same machine, so the header is in native byte order.
+#define FRAME_DATA 1
+#define FRAME_CLOSE 2
+#define FRAME_RESIZE 3
+#define FRAME_PING 4
+#define FRAME_PONG 5
+#define FRAME_RING 6
+#define FRAME_TRACE 7
+
+// Frames larger than this are treated as a broken connection
+#define FRAME_MAX_LENGTH (1 << 24)
+
+struct frame_header
+{
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint32_t sequence;
+};
+
+// Payload of a FRAME_RESIZE frame
+struct frame_resize
+{
+    uint16_t rows;
+    uint16_t cols;
+};
+
+// A client sends an empty FRAME_RING to ask for shell output through shared memory.
+// The server answers with a FRAME_RING holding this, or an empty one
+// if the client has to keep using its FIFO. cursor is where the output for this client starts.
+#define FRAME_RING_NAME_SIZE 64
+
+struct frame_ring
+{
+    uint64_t cursor;
+    char name[FRAME_RING_NAME_SIZE];
+};
+
+// A client sends a FRAME_TRACE holding this right before a line it samples,
+// and its worker sends one back once it writes the prompt that the line led to.
+// sent_ns is CLOCK_MONOTONIC of the sender, see latency_trace.h
+struct frame_trace
+{
+    uint64_t sent_ns;
+};
+
+struct frame
+{
+    int type;
+    uint32_t length;
+    uint32_t sequence;
+    char* payload;
+};
+
+// Buffers the bytes read from a file descriptor and splits them into frames
+struct frame_reader
+{
+    char* buffer;
+    uint32_t capacity;
+    uint32_t start;
+    uint32_t end;
+
+    // The sequence number the next frame should have
+    uint32_t sequence;
+};
+
+void frame_header_init(struct frame_header *header, int type, uint32_t sequence, uint32_t length);
+int frame_write(int fd, int type, uint32_t sequence, const void *payload, uint32_t length);
+
+void frame_reader_init(struct frame_reader *reader);
+int frame_reader_fill(struct frame_reader *reader, int fd);
+int frame_reader_next(struct frame_reader *reader, struct frame *frame);
+void frame_reader_free(struct frame_reader *reader);
+
+// Sent by a client right after it connects to the socket.
+// With SOCKET_ATTACH, the client's stdin and stdout are passed along with it,
+// and the server reads and writes the client's terminal directly.
+#define SOCKET_ATTACH 1
+
+struct socket_request
+{
+    uint32_t flags;
+    char session[HANDSHAKE_SESSION_SIZE];
+};
+
+int server_listen(int *keep_open);
+int server_accept(int listener, bi_file *client, char *session, int full);
+int server_finish_accept(bi_file *client);
+int client_handshake(int *to_server, const char *session);
+
+int server_socket_listen();
+int server_stats_listen();
+int server_socket_accept(int listener);
+int server_socket_finish_accept(int socket_fd, bi_file *client, bi_file *terminal, char *session, int full);
+int client_socket_handshake(int *to_server, int attach, const char *session);
 
 #endif
\ No newline at end of file
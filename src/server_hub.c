@@ -0,0 +1,1118 @@
+#define _GNU_SOURCE
+#include "server_hub.h"
+#include "hub_worker.h"
+#include "hub_stats.h"
+
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Set by SIGTERM, so the hub can clean up the WKP and the ring before exiting
+static volatile sig_atomic_t hub_stopping = 0;
+
+// Set by SIGUSR1, so the hub prints the latency histograms
+static volatile sig_atomic_t hub_dumping = 0;
+
+static void hub_stop(int signal)
+{
+    hub_stopping = 1;
+}
+
+static void hub_dump(int signal)
+{
+    hub_dumping = 1;
+}
+
+long long hub_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief add bytes to the end of a queue, of a client or of the input of a session
+ *
+ * the queue is moved to the front of its buffer before it grows,
+ * and it only grows as far as it needs to.
+ *
+ * @param queue the queue to add to
+ * @param buffer the bytes to add
+ * @param size the number of bytes to add
+ * @return 0 on success, -1 if there is no memory left
+ */
+int hub_queue_push(struct hub_queue* queue, const char* buffer, uint32_t size)
+{
+    uint32_t capacity;
+    char* grown;
+
+    if(queue->end + size > queue->capacity && queue->start > 0)
+    {
+        memmove(queue->buffer, queue->buffer + queue->start, queue->end - queue->start);
+        queue->end -= queue->start;
+        queue->start = 0;
+    }
+
+    if(queue->end + size > queue->capacity)
+    {
+        for(capacity = queue->capacity ? queue->capacity : HUB_OUTPUT_SIZE; capacity < queue->end + size; capacity *= 2);
+
+        grown = realloc(queue->buffer, capacity);
+        if(grown == NULL) return -1;
+
+        queue->buffer = grown;
+        queue->capacity = capacity;
+    }
+
+    memcpy(queue->buffer + queue->end, buffer, size);
+    queue->end += size;
+    return 0;
+}
+
+/**
+ * @brief initialize the hub, without starting any sessions yet
+ *
+ * SIGPIPE is ignored from here on, so that a client disappearing
+ * in the middle of a write only disconnects that client.
+ * SIGTERM makes server_hub_run(...) return after cleaning up.
+ * the stats socket is always served, see hub_stats.c.
+ * every session and client takes a couple of file descriptors,
+ * so the limit on open files is raised as far as it goes.
+ *
+ * @param hub the hub to initialize
+ * @param start_shell starts the shell of a session when the first client asks for it
+ */
+void server_hub_init(struct server_hub* hub, hub_shell_start start_shell)
+{
+    struct rlimit files;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, hub_stop);
+
+    if(getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max)
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    hub->start_shell = start_shell;
+    hub->sessions = NULL;
+    hub->session_count = 0;
+    hub->session_capacity = 0;
+    hub->next_session_id = 0;
+
+    hub->listener = server_listen(&hub->listener_keep_open);
+    hub->socket_listener = -1;
+    hub->stats_listener = server_stats_listen();
+    hub->pending_count = 0;
+
+    hub->connect_count = 0;
+    hub->connect_total_us = 0;
+    hub->connect_max_us = 0;
+
+    memset(&hub->closed, 0, sizeof(hub->closed));
+    hub->disconnect_count = 0;
+    hub->started_us = hub_now_us();
+
+    hub->flush_delay_us = HUB_FLUSH_DELAY_US;
+    hub->scrollback_size = (size_t)HUB_SCROLLBACK_MB << 20;
+
+    hub->zero_copy = 0;
+    hub->dev_null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    hub->queue_limit = HUB_QUEUE_LIMIT;
+    hub->overflow = HUB_OVERFLOW_DROP;
+
+    hub->worker_count = 0;
+    hub->workers = NULL;
+    hub->trace = NULL;
+    hub->trace_every = 0;
+    hub->wake = eventfd(0, EFD_NONBLOCK);
+    hub->stopping = 0;
+
+    hub->next_id = 0;
+    hub->client_count = 0;
+}
+
+/**
+ * @brief start timing every hop that a sampled line takes, see latency_trace.h
+ *
+ * the histograms are shared memory, so the shells that are forked from here on
+ * record the hops inside of them into the same histograms.
+ * SIGUSR1 prints them, and they are part of the stats.
+ *
+ * @param hub the hub to trace, which must not have any sessions yet
+ * @param every a worker samples every n-th input on its own, 0 to only sample what clients ask for
+ * @return 0 on success, -1 if the histograms couldn't be mapped
+ */
+int hub_trace_start(struct server_hub* hub, int every)
+{
+    hub->trace = latency_trace_create();
+    if(hub->trace == NULL)
+    {
+        server_printf("Unable to Start Tracing: %s [%d]\n", strerror(errno), errno);
+        return -1;
+    }
+
+    hub->trace_every = every;
+    latency_trace_shared = hub->trace;
+    signal(SIGUSR1, hub_dump);
+
+    if(every > 0) server_printf("Tracing Latency [1 in %d lines] [kill -USR1 %d to print]\n", every, getpid());
+    else server_printf("Tracing Latency [lines the clients sample] [kill -USR1 %d to print]\n", getpid());
+    return 0;
+}
+
+/**
+ * @brief find the session with a name, and start it if it isn't running yet
+ *
+ * sessions are looked up by name, which only happens once per client when it joins.
+ * a new session only holds the pipes of its shell until it has output,
+ * so idle sessions cost a couple of file descriptors and a process.
+ * its feed is at least twice as big as the queue limit, but pages of it
+ * are only backed by memory once output reaches them.
+ *
+ * @param hub the hub with the sessions
+ * @param name the name of the session
+ * @return the session, or NULL if it had to be started and couldn't be
+ */
+static struct hub_session* hub_session_get(struct server_hub* hub, const char* name)
+{
+    struct hub_session *session, **sessions;
+    uint32_t feed_size;
+    int i;
+
+    for(i = 0; i < hub->session_count; ++i)
+        if(hub->sessions[i]->shell.from >= 0 && strcmp(hub->sessions[i]->name, name) == 0) return hub->sessions[i];
+
+    if(hub->session_count == hub->session_capacity)
+    {
+        sessions = realloc(hub->sessions, (hub->session_capacity + HUB_SESSION_GROWTH) * sizeof(*sessions));
+        if(sessions == NULL) return NULL;
+
+        hub->sessions = sessions;
+        hub->session_capacity += HUB_SESSION_GROWTH;
+    }
+
+    session = calloc(1, sizeof(*session));
+    if(session == NULL) return NULL;
+
+    for(feed_size = HUB_FEED_SIZE; feed_size < 2ULL * hub->queue_limit && feed_size < 1U << 31; feed_size <<= 1);
+
+    if(broadcast_ring_init(&session->feed, feed_size) < 0)
+    {
+        server_printf("Unable to Allocate Feed For Session \"%s\": %s [%d]\n", name, strerror(errno), errno);
+        free(session);
+        return NULL;
+    }
+
+    // The shell is forked with the marks of its own session
+    if(hub->trace) session->trace = latency_trace_marks_create();
+    latency_trace_session = session->trace;
+
+    session->pid = hub->start_shell(&session->shell);
+    if(session->pid < 0)
+    {
+        server_printf("Unable to Start Session \"%s\": %s [%d]\n", name, strerror(errno), errno);
+        latency_trace_marks_free(session->trace);
+        broadcast_ring_close(&session->feed);
+        free(session);
+        return NULL;
+    }
+
+    pthread_mutex_init(&session->lock, NULL);
+
+    // The shell is drained until it has nothing left, so reads must not block,
+    // and a shell that is busy must never block the worker that writes it input
+    fcntl(session->shell.from, F_SETFL, fcntl(session->shell.from, F_GETFL) | O_NONBLOCK);
+    fcntl(session->shell.to, F_SETFL, fcntl(session->shell.to, F_GETFL) | O_NONBLOCK);
+
+    session->id = ++hub->next_session_id;
+    snprintf(session->name, HANDSHAKE_SESSION_SIZE, "%s", name);
+    session->flush_deadline_us = -1;
+    session->scrollback.size = hub->scrollback_size;
+    for(i = 0; i < HUB_MAX_WORKERS; ++i) session->splice[i] = -1;
+    session->ring.header = NULL;
+
+    hub->sessions[hub->session_count++] = session;
+    server_printf("Started Session \"%s\" [#%d] [pid %d] [%d sessions]\n", session->name, session->id, session->pid, hub->session_count);
+
+    return session;
+}
+
+/**
+ * @brief stop a session and free it
+ *
+ * the session must not have any clients left. a shell that is still running
+ * sees its input close and exits on its own, a shell that already exited is reaped.
+ *
+ * @param hub the hub with the session
+ * @param index the index of the session in hub->sessions
+ */
+static void hub_session_close(struct server_hub* hub, int index)
+{
+    struct hub_session* session = hub->sessions[index];
+
+    close(session->shell.to);
+    if(session->shell.from >= 0) close(session->shell.from);
+    else waitpid(session->pid, NULL, 0);
+
+    for(; session->splicing; session->splicing &= session->splicing - 1) close(session->splice[__builtin_ctzll(session->splicing)]);
+
+    free(session->output);
+    free(session->input.buffer);
+    free(session->scrollback.buffer);
+    if(session->ring.header) broadcast_ring_close(&session->ring);
+    broadcast_ring_close(&session->feed);
+    latency_trace_marks_free(session->trace);
+    pthread_mutex_destroy(&session->lock);
+
+    server_printf("Closed Session \"%s\" [#%d] [%d sessions]\n", session->name, session->id, hub->session_count - 1);
+
+    free(session);
+    hub->sessions[index] = hub->sessions[--hub->session_count];
+}
+
+/**
+ * @brief start the handshake of every client that has written to the WKP
+ *
+ * requests are read until the WKP is empty or the pending table is full,
+ * so a burst of clients is answered in one go. if the hub already has
+ * MAX_CLIENTS clients (counting the ones still in their handshake), the client is sent NAK.
+ *
+ * @param hub the hub to add the clients to
+ */
+static void hub_accept(struct server_hub* hub)
+{
+    struct hub_pending* pending;
+    int status;
+
+    while(hub->pending_count < HUB_MAX_PENDING)
+    {
+        pending = &hub->pending[hub->pending_count];
+        status = server_accept(hub->listener, &pending->pipe, pending->session, atomic_load(&hub->client_count) + hub->pending_count >= MAX_CLIENTS);
+
+        if(status < 0) break;
+        if(status == 0) continue;
+
+        pending->started = hub_now_us();
+        pending->socket = 0;
+        ++hub->pending_count;
+    }
+}
+
+/**
+ * @brief accept every connection waiting on the unix socket
+ *
+ * the connection is added to the pending table until its socket_request arrives,
+ * which is checked against MAX_CLIENTS when it does.
+ *
+ * @param hub the hub to add the clients to
+ */
+static void hub_socket_accept(struct server_hub* hub)
+{
+    struct hub_pending* pending;
+    int connection;
+
+    while(hub->pending_count < HUB_MAX_PENDING && (connection = server_socket_accept(hub->socket_listener)) >= 0)
+    {
+        pending = &hub->pending[hub->pending_count++];
+        pending->pipe.from = connection;
+        pending->pipe.to = -1;
+        pending->started = hub_now_us();
+        pending->socket = 1;
+    }
+}
+
+/**
+ * @brief remove a handshake from the pending table
+ *
+ * @param hub the hub the handshake is in
+ * @param index the index of the handshake in hub->pending
+ */
+static void hub_pending_remove(struct server_hub* hub, int index)
+{
+    hub->pending[index] = hub->pending[--hub->pending_count];
+}
+
+/**
+ * @brief close the pipes of a handshake that didn't finish, and remove it
+ *
+ * @param hub the hub the handshake is in
+ * @param index the index of the handshake in hub->pending
+ */
+static void hub_pending_close(struct server_hub* hub, int index)
+{
+    if(hub->pending[index].pipe.from >= 0) close(hub->pending[index].pipe.from);
+    if(hub->pending[index].pipe.to >= 0) close(hub->pending[index].pipe.to);
+    hub_pending_remove(hub, index);
+}
+
+/**
+ * @brief drop every handshake that has taken longer than HUB_HANDSHAKE_TIMEOUT_MS
+ *
+ * @param hub the hub with the handshakes
+ * @return milliseconds until the next handshake times out, or -1 if there are none
+ */
+static int hub_pending_expire(struct server_hub* hub)
+{
+    long long now = hub_now_us(), left, next = -1;
+    int i;
+
+    for(i = hub->pending_count - 1; i >= 0; --i)
+    {
+        left = hub->pending[i].started + HUB_HANDSHAKE_TIMEOUT_MS * 1000LL - now;
+
+        if(left <= 0)
+        {
+            server_printf("Handshake Timed Out [%d ms]\n", HUB_HANDSHAKE_TIMEOUT_MS);
+            hub_pending_close(hub, i);
+        }
+        else if(next < 0 || left < next) next = left;
+    }
+
+    return next < 0 ? -1 : (int)(next / 1000) + 1;
+}
+
+/**
+ * @brief keep output that was sent to the clients in the scrollback
+ *
+ * the scrollback is a ring, so only the last scrollback.size bytes are kept,
+ * and it is only allocated once there is something to keep.
+ *
+ * @param session the session with the scrollback
+ * @param buffer the output that was sent
+ * @param size the length of the output
+ */
+static void hub_scrollback_write(struct hub_session* session, const char* buffer, size_t size)
+{
+    struct hub_scrollback* scrollback = &session->scrollback;
+    size_t first;
+
+    if(scrollback->buffer == NULL)
+    {
+        scrollback->buffer = malloc(scrollback->size);
+        if(scrollback->buffer == NULL)
+        {
+            server_printf("Unable to Allocate Scrollback [%zu MB], Turning It Off\n", scrollback->size >> 20);
+            scrollback->size = 0;
+            return;
+        }
+    }
+
+    // Only the end of the output fits
+    if(size >= scrollback->size)
+    {
+        memcpy(scrollback->buffer, buffer + size - scrollback->size, scrollback->size);
+        scrollback->head = 0;
+        scrollback->wrapped = 1;
+        return;
+    }
+
+    first = scrollback->size - scrollback->head;
+    if(first > size) first = size;
+
+    memcpy(scrollback->buffer + scrollback->head, buffer, first);
+    memcpy(scrollback->buffer, buffer + first, size - first);
+
+    scrollback->head += size;
+    if(scrollback->head >= scrollback->size)
+    {
+        scrollback->head -= scrollback->size;
+        scrollback->wrapped = 1;
+    }
+}
+
+/**
+ * @brief open a new, non-blocking file description for a terminal that a client handed over
+ *
+ * the terminal is shared with the client, so setting O_NONBLOCK on it directly
+ * would also change it for the client, and for the shell the client was started from.
+ * opening it again through /proc gives the hub a description of its own.
+ *
+ * @param fd the terminal
+ * @param mode O_RDONLY for the side that is read, O_WRONLY for the side that is written
+ * @return the new file descriptor, or fd if the terminal can't be opened again
+ */
+static int hub_reopen_nonblocking(int fd, int mode)
+{
+    char path[64];
+    int reopened;
+
+    sprintf(path, "/proc/self/fd/%d", fd);
+    reopened = open(path, mode | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if(reopened < 0) return fd;
+
+    close(fd);
+    return reopened;
+}
+
+/**
+ * @brief finish a handshake once the client has written its ACK, and add it to the session it asked for
+ *
+ * the client is handed to the worker with the fewest clients, which owns it from then on.
+ *
+ * @param hub the hub to add the client to
+ * @param index the index of the handshake in hub->pending
+ */
+static void hub_pending_finish(struct server_hub* hub, int index)
+{
+    struct hub_pending* pending = &hub->pending[index];
+    struct hub_worker* worker = &hub->workers[0];
+    struct hub_session* session;
+    struct hub_client* client;
+    struct stat info;
+    bi_file terminal;
+    long long latency;
+    int i;
+
+    terminal.from = -1;
+    terminal.to = -1;
+
+    if(pending->socket)
+    {
+        if(server_socket_finish_accept(pending->pipe.from, &pending->pipe, &terminal, pending->session, atomic_load(&hub->client_count) >= MAX_CLIENTS) < 0)
+        {
+            hub_pending_remove(hub, index);
+            return;
+        }
+    }
+
+    else if(server_finish_accept(&pending->pipe) < 0)
+    {
+        hub_pending_close(hub, index);
+        return;
+    }
+
+    session = hub_session_get(hub, pending->session);
+    client = calloc(1, sizeof(*client));
+    if(session == NULL || client == NULL)
+    {
+        free(client);
+        if(terminal.from >= 0) { close(terminal.from); close(terminal.to); }
+        hub_pending_close(hub, index);
+        return;
+    }
+
+    latency = hub_now_us() - pending->started;
+    ++hub->connect_count;
+    hub->connect_total_us += latency;
+    if(latency > hub->connect_max_us) hub->connect_max_us = latency;
+
+    client->id = ++hub->next_id;
+    client->pipe = pending->pipe;
+    client->session = session;
+    client->terminal = terminal;
+    frame_reader_init(&client->reader);
+
+    // Writes to the client must never block its worker
+    fcntl(client->pipe.to, F_SETFL, fcntl(client->pipe.to, F_GETFL) | O_NONBLOCK);
+    client->fifo = terminal.to < 0 && fstat(client->pipe.to, &info) == 0 && S_ISFIFO(info.st_mode);
+    if(client->terminal.from >= 0) client->terminal.from = hub_reopen_nonblocking(client->terminal.from, O_RDONLY);
+    if(client->terminal.to >= 0) client->terminal.to = hub_reopen_nonblocking(client->terminal.to, O_WRONLY);
+
+    hub_pending_remove(hub, index);
+
+    atomic_fetch_add(&session->client_count, 1);
+    atomic_fetch_add(&hub->client_count, 1);
+
+    for(i = 1; i < hub->worker_count; ++i)
+        if(atomic_load(&hub->workers[i].assigned) < atomic_load(&worker->assigned)) worker = &hub->workers[i];
+
+    server_printf("Connected Client [ID: #%d] [SESSION: \"%s\"] [WORKER: %d] [%d clients] [handshake %lld us, average %lld us, max %lld us]\n", 
+        client->id, session->name, worker->index, atomic_load(&hub->client_count), latency, hub->connect_total_us / hub->connect_count, hub->connect_max_us);
+
+    hub_worker_add(worker, client);
+}
+
+/**
+ * @brief publish a message to every client in a session
+ *
+ * the message is written to the feed once, as records of up to HUB_OUTPUT_SIZE,
+ * and every worker sends it on to its own clients. shell output is also
+ * written to the shared memory ring for the clients that read from it.
+ * the session has to be locked, and the workers woken up afterwards.
+ *
+ * @param session the session the message is for
+ * @param source the id of the client that typed the message, or 0 for shell output
+ * @param buffer the message
+ * @param size the length of the message
+ */
+void hub_session_publish(struct hub_session* session, uint32_t source, const char* buffer, int size)
+{
+    struct hub_record record;
+    struct iovec iov[2];
+    int offset, length;
+
+    if(source == 0 && session->ring_clients) broadcast_ring_write(&session->ring, buffer, size);
+    if(session->scrollback.size) hub_scrollback_write(session, buffer, size);
+
+    record.source = source;
+    iov[0].iov_base = &record;
+    iov[0].iov_len = sizeof(record);
+
+    for(offset = 0; offset < size; offset += length)
+    {
+        length = size - offset < HUB_OUTPUT_SIZE ? size - offset : HUB_OUTPUT_SIZE;
+
+        record.length = length;
+        iov[1].iov_base = (char*)buffer + offset;
+        iov[1].iov_len = length;
+
+        broadcast_ring_writev(&session->feed, iov, 2);
+    }
+}
+
+/**
+ * @brief publish every byte of shell output that is waiting in the buffer of a session
+ *
+ * the buffer is freed once it is empty, so idle sessions don't hold onto it.
+ * the session has to be locked, and the workers woken up afterwards.
+ * if a traced prompt is in the buffer, the workers are told where it ends in the feed.
+ *
+ * @param hub the hub with the session
+ * @param session the session with the buffer
+ */
+void hub_session_flush(struct server_hub* hub, struct hub_session* session)
+{
+    long long now;
+
+    if(session->output_size > 0) hub_session_publish(session, 0, session->output, session->output_size);
+
+    if(session->trace_read_ns && session->output_size > 0)
+    {
+        now = latency_trace_now_ns();
+        latency_trace_record(hub->trace, TRACE_HOP_HUB_FLUSH, now - session->trace_read_ns);
+        session->trace_read_ns = 0;
+
+        atomic_store_explicit(&session->trace_published_ns, now, memory_order_relaxed);
+        atomic_store_explicit(&session->trace_published_at, atomic_load(&session->feed.header->head), memory_order_release);
+    }
+
+    free(session->output);
+    session->output = NULL;
+    session->output_size = 0;
+    session->last_flush_us = hub_now_us();
+    session->flush_deadline_us = -1;
+}
+
+/**
+ * @brief write input to the shell of a session, without ever blocking
+ *
+ * if nothing is waiting for the shell, the input is written straight away,
+ * and whatever its pipe has no room for is queued. otherwise everything is queued
+ * behind what is already there, so the order never changes. the hub is woken up
+ * the first time anything is queued, and writes it once the pipe has room, see hub_session_drain(...).
+ * input for a shell that has exited is thrown away, the hub sees it close on shell.from.
+ * the session has to be locked.
+ *
+ * @param hub the hub with the session
+ * @param session the session to write to
+ * @param buffer the input
+ * @param size the length of the input
+ * @return the number of bytes that are waiting for the shell
+ */
+uint32_t hub_session_input(struct server_hub* hub, struct hub_session* session, const char* buffer, int size)
+{
+    struct hub_queue* input = &session->input;
+    uint64_t one = 1;
+    int written = 0;
+
+    if(input->end == input->start)
+    {
+        while((written = write(session->shell.to, buffer, size)) < 0 && errno == EINTR);
+
+        if(written < 0)
+        {
+            if(errno != EAGAIN) return 0;
+            written = 0;
+        }
+
+        if(written == size) return 0;
+    }
+
+    if(hub_queue_push(input, buffer + written, size - written) < 0)
+        server_printf("Unable to Queue Input [SESSION: \"%s\"]: %s [%d]\n", session->name, strerror(errno), errno);
+
+    if(input->end > input->start && !atomic_exchange(&session->input_waiting, 1)) write(hub->wake, &one, sizeof(one));
+    return input->end - input->start;
+}
+
+/**
+ * @brief write as much of the input waiting for a shell as its pipe has room for
+ *
+ * the queue is freed once the shell has taken all of it, and the workers are woken up
+ * once it is under half of HUB_INPUT_LIMIT, so they start reading the clients they stopped.
+ *
+ * @param hub the hub with the session
+ * @param session the session whose shell can take more input
+ */
+static void hub_session_drain(struct server_hub* hub, struct hub_session* session)
+{
+    struct hub_queue* input = &session->input;
+    int written, resume;
+
+    pthread_mutex_lock(&session->lock);
+
+    while((written = write(session->shell.to, input->buffer + input->start, input->end - input->start)) < 0 && errno == EINTR);
+
+    // The shell exited, so nothing is going to read the rest
+    if(written < 0 && errno != EAGAIN) input->start = input->end;
+    else if(written > 0) input->start += written;
+
+    resume = input->end - input->start < HUB_INPUT_LIMIT / 2 && atomic_load(&session->input_blocked) > 0;
+
+    if(input->end == input->start)
+    {
+        free(input->buffer);
+        memset(input, 0, sizeof(*input));
+        atomic_store(&session->input_waiting, 0);
+    }
+
+    pthread_mutex_unlock(&session->lock);
+
+    if(resume) hub_session_wake(hub, session);
+}
+
+/**
+ * @brief tell the workers with clients in a session that its feed has new records
+ *
+ * workers without clients in the session are left asleep.
+ * a worker sets its bit before it reads the head of the feed for a new client,
+ * so a record is either already behind the client, or wakes the worker.
+ *
+ * @param hub the hub with the workers
+ * @param session the session whose feed has new records
+ */
+void hub_session_wake(struct server_hub* hub, struct hub_session* session)
+{
+    uint64_t workers = atomic_load(&session->workers);
+
+    for(; workers; workers &= workers - 1) hub_worker_wake(&hub->workers[__builtin_ctzll(workers)]);
+}
+
+/**
+ * @brief tee the shell output that is waiting into the pipe of every worker that splices the session
+ *
+ * tee() only takes references to the pages in the pipe of the shell, so nothing is copied,
+ * and the same bytes are still there for the read that follows. the session has to be locked.
+ *
+ * @param session the session to read the shell of
+ * @param size the most that is about to be read
+ * @param teed set to how much went into the pipe of every worker, by the index of the worker
+ */
+static void hub_splice_tee(struct hub_session* session, int size, int* teed)
+{
+    uint64_t workers;
+    int i, available;
+
+    if(ioctl(session->shell.from, FIONREAD, &available) < 0) available = 0;
+    if(available > size) available = size;
+
+    for(workers = session->splicing; workers; workers &= workers - 1)
+    {
+        i = __builtin_ctzll(workers);
+
+        teed[i] = available > 0 ? tee(session->shell.from, session->splice[i], available, SPLICE_F_NONBLOCK) : 0;
+        if(teed[i] < 0) teed[i] = 0;
+    }
+}
+
+/**
+ * @brief write what tee() didn't get to into the pipe of every worker, once it has been read
+ *
+ * a pipe that has no room for the rest either belongs to a worker that fell too far behind,
+ * so it is closed. its worker then finds less in it than the feed says,
+ * and goes back to copying, see hub_group_splice(...).
+ *
+ * @param session the session that was read
+ * @param buffer what was read
+ * @param size the number of bytes that were read
+ * @param teed how much every worker already got, from hub_splice_tee(...)
+ */
+static void hub_splice_rest(struct hub_session* session, const char* buffer, int size, int* teed)
+{
+    uint64_t workers;
+    int i, written;
+
+    for(workers = session->splicing; workers; workers &= workers - 1)
+    {
+        i = __builtin_ctzll(workers);
+        if(teed[i] >= size) continue;
+
+        written = write(session->splice[i], buffer + teed[i], size - teed[i]);
+        if(written == size - teed[i]) continue;
+
+        server_printf("Worker Fell Behind, Copying Output [SESSION: \"%s\"] [WORKER: %d]\n", session->name, i);
+        close(session->splice[i]);
+        session->splice[i] = -1;
+        session->splicing &= ~(1ULL << i);
+    }
+}
+
+/**
+ * @brief drain the output of a shell into the buffer of its session, and decide when to send it
+ *
+ * the shell is read until it has nothing left or the buffer is full.
+ * what was read is sent right away if:
+ *
+ *  1) at least HUB_FLUSH_SIZE bytes are waiting, or
+ *  2) the shell isn't streaming, and this read emptied its pipe with less than HUB_STREAM_SIZE,
+ *     so the output is probably a prompt or an echo that someone is waiting for
+ *
+ * otherwise the shell is streaming output, and it is held until flush_deadline_us,
+ * so a flood turns into one large frame every flush_delay_us instead of one per read,
+ * and no byte ever waits longer than flush_delay_us.
+ * the shell counts as streaming from a read that got HUB_STREAM_SIZE or more,
+ * or didn't empty its pipe, until a read that empties it with less than that.
+ * with -z, every read is first tee()d into the pipes of the workers that splice the session.
+ * the reads never block, so the session stays locked the whole time.
+ *
+ * @param hub the hub with the clients
+ * @param session the session to read the shell of
+ * @return 0 if the shell closed, 1 otherwise
+ */
+static int hub_read_shell(struct server_hub* hub, struct hub_session* session)
+{
+    int read_size, open = 1, flush = 0, drained = 0, total = 0, quiet, room;
+    int teed[HUB_MAX_WORKERS];
+    long long trace_ns;
+
+    pthread_mutex_lock(&session->lock);
+
+    if(session->output == NULL)
+    {
+        session->output = malloc(HUB_OUTPUT_SIZE);
+        if(session->output == NULL)
+        {
+            pthread_mutex_unlock(&session->lock);
+            return 1;
+        }
+    }
+
+    while(session->output_size < HUB_OUTPUT_SIZE)
+    {
+        room = HUB_OUTPUT_SIZE - session->output_size;
+        if(session->splicing) hub_splice_tee(session, room, teed);
+
+        read_size = read(session->shell.from, session->output + session->output_size, room);
+
+        if(read_size > 0)
+        {
+            if(session->splicing) hub_splice_rest(session, session->output + session->output_size, read_size, teed);
+            session->output_size += read_size;
+            total += read_size;
+        }
+        else if(read_size < 0 && errno == EINTR) continue;
+        else
+        {
+            open = read_size < 0 && errno == EAGAIN;
+            drained = open;
+            break;
+        }
+    }
+
+    // The shell stamps its prompt right before writing it
+    if(session->trace)
+    {
+        trace_ns = latency_trace_hand_off(hub->trace, TRACE_HOP_SHELL_TO_HUB, &session->trace->prompt_ns, NULL);
+        if(trace_ns) session->trace_read_ns = trace_ns;
+    }
+
+    quiet = drained && total < HUB_STREAM_SIZE;
+    flush = !open || session->output_size >= HUB_FLUSH_SIZE || (quiet && !session->streaming) || hub->flush_delay_us <= 0;
+    session->streaming = !quiet;
+
+    if(flush) hub_session_flush(hub, session);
+    else if(session->flush_deadline_us < 0) session->flush_deadline_us = session->last_flush_us + hub->flush_delay_us;
+
+    pthread_mutex_unlock(&session->lock);
+
+    if(flush) hub_session_wake(hub, session);
+    return open;
+}
+
+/**
+ * @brief end a session whose shell has exited
+ *
+ * whatever the shell wrote last is published, and then the session is marked as ended,
+ * so the workers tell every client in it to close once they have sent it.
+ * the session is freed by the main loop once all of them are gone,
+ * and the next client that asks for its name starts a new shell.
+ *
+ * @param hub the hub with the clients
+ * @param session the session that ended
+ */
+static void hub_session_end(struct server_hub* hub, struct hub_session* session)
+{
+    pthread_mutex_lock(&session->lock);
+    hub_session_flush(hub, session);
+    pthread_mutex_unlock(&session->lock);
+
+    close(session->shell.from);
+    session->shell.from = -1;
+
+    atomic_store(&session->ended, 1);
+    hub_session_wake(hub, session);
+
+    server_printf("Session Ended [SESSION: \"%s\"]\n", session->name);
+}
+
+/**
+ * @brief add a file descriptor to the array that is given to ppoll(...)
+ *
+ * every file descriptor is added at a fixed place, so the main loop can find it again.
+ * a negative fd is ignored by ppoll(...), which leaves the place empty.
+ *
+ * @param fds the array of file descriptors
+ * @param count the number of entries in fds, which is incremented
+ * @param fd the file descriptor to wait on
+ * @param events the events to wait for
+ */
+static void hub_poll_add(struct pollfd* fds, int* count, int fd, short events)
+{
+    fds[*count].fd = fd;
+    fds[*count].events = events;
+    fds[*count].revents = 0;
+    ++*count;
+}
+
+/**
+ * @param fds the array that was given to ppoll(...)
+ * @param index the index of the file descriptor
+ * @return non-zero if the file descriptor can be read, or has been closed
+ */
+static int hub_poll_readable(struct pollfd* fds, int index)
+{
+    return fds[index].fd >= 0 && (fds[index].revents & (POLLIN | POLLHUP | POLLERR));
+}
+
+/**
+ * @param fds the array that was given to ppoll(...)
+ * @param index the index of the file descriptor
+ * @return non-zero if the file descriptor can be written, or its reader has gone away
+ */
+static int hub_poll_writable(struct pollfd* fds, int index)
+{
+    return fds[index].fd >= 0 && (fds[index].revents & (POLLOUT | POLLHUP | POLLERR));
+}
+
+/**
+ * @brief start every worker, with signals blocked so that only the hub handles them
+ *
+ * @param hub the hub to start the workers of
+ * @return 0 on success, -1 on error
+ */
+static int hub_start_workers(struct server_hub* hub)
+{
+    sigset_t all, old;
+    int count = hub->worker_count;
+    long cpus;
+
+    if(count <= 0)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? cpus : 1;
+    }
+    if(count > HUB_MAX_WORKERS) count = HUB_MAX_WORKERS;
+
+    hub->workers = calloc(count, sizeof(*hub->workers));
+    if(hub->workers == NULL) return -1;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    for(hub->worker_count = 0; hub->worker_count < count; ++hub->worker_count)
+    {
+        if(hub_worker_start(hub, &hub->workers[hub->worker_count], hub->worker_count) < 0)
+        {
+            server_printf("Unable to Start Worker %d: %s [%d]\n", hub->worker_count, strerror(errno), errno);
+            break;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if(hub->worker_count == 0) return -1;
+
+    server_printf("Started %d Workers\n", hub->worker_count);
+    return 0;
+}
+
+/**
+ * @brief relay messages between the sessions and the clients until the hub is stopped
+ *
+ * the relay is split across threads, so that it scales with the number of cpus:
+ *  - this loop owns the listeners, the handshakes and the pipes of every session.
+ *    output from a shell is batched by hub_read_shell(...), and published once to the feed of its session
+ *  - every client belongs to one worker, which waits on its shard of the clients with epoll,
+ *    and sends each of them the records of its feed, see hub_worker.c
+ *
+ * the feed is only ever locked by writers, so no matter how many workers and clients
+ * there are, output is copied into the hub once and read by all of them without waiting.
+ * the loop wakes up when the oldest waiting output of any session reaches its deadline,
+ * when a worker says that a paused session can be read again, and when a busy shell
+ * can take more of the input that is waiting for it.
+ *
+ * ppoll(...) is used instead of select(...), as hundreds of sessions
+ * easily have file descriptors past FD_SETSIZE.
+ *
+ * @param hub the hub to run
+ * @return the exit code of the server
+ */
+int server_hub_run(struct server_hub* hub)
+{
+    int i, timeout, count, paused, capacity = 0;
+    int sessions_at, pending_at;
+    struct hub_session* session;
+    struct pollfd* fds = NULL;
+    struct timespec wait_time;
+    long long wait_us, now;
+    uint64_t value;
+
+    if(hub->wake < 0 || hub_start_workers(hub) < 0)
+    {
+        server_printf("Unable to Start Workers: %s [%d]\n", strerror(errno), errno);
+        return -1;
+    }
+
+    while(!hub_stopping)
+    {
+        if(hub_dumping)
+        {
+            hub_dumping = 0;
+            server_printf("Latency: ");
+            latency_trace_print(stderr, hub->trace);
+            fprintf(stderr, "\n");
+        }
+
+        // Drop handshakes that are taking too long, and wake up in time for the next one
+        timeout = hub_pending_expire(hub);
+        wait_us = timeout < 0 ? -1 : timeout * 1000LL;
+
+        // Publish shell output that has waited long enough, and wake up in time for the rest
+        now = hub_now_us();
+        for(i = 0; i < hub->session_count; ++i)
+        {
+            session = hub->sessions[i];
+            pthread_mutex_lock(&session->lock);
+
+            if(session->flush_deadline_us >= 0 && session->flush_deadline_us <= now)
+            {
+                hub_session_flush(hub, session);
+                pthread_mutex_unlock(&session->lock);
+                hub_session_wake(hub, session);
+                continue;
+            }
+
+            if(session->flush_deadline_us >= 0 && (wait_us < 0 || session->flush_deadline_us - now < wait_us)) wait_us = session->flush_deadline_us - now;
+            pthread_mutex_unlock(&session->lock);
+        }
+
+        // Every session and handshake has a fixed place in the array, sessions have two
+        if(capacity < 4 + 2 * hub->session_count + hub->pending_count)
+        {
+            capacity = 4 + 2 * (hub->session_count + HUB_SESSION_GROWTH) + HUB_MAX_PENDING;
+            free(fds);
+            fds = malloc(capacity * sizeof(struct pollfd));
+
+            if(fds == NULL)
+            {
+                server_printf("Unable to Allocate Poll Array\n");
+                break;
+            }
+        }
+
+        count = 0;
+
+        // Only take new requests if there is room to start their handshake
+        hub_poll_add(fds, &count, hub->pending_count < HUB_MAX_PENDING ? hub->listener : -1, POLLIN);
+        hub_poll_add(fds, &count, hub->pending_count < HUB_MAX_PENDING ? hub->socket_listener : -1, POLLIN);
+        hub_poll_add(fds, &count, hub->wake, POLLIN);
+        hub_poll_add(fds, &count, hub->stats_listener, POLLIN);
+
+        // A shell is left alone while a paused client catches up,
+        // and is only waited on to take more input while some is waiting for it
+        sessions_at = count;
+        for(i = 0; i < hub->session_count; ++i)
+        {
+            session = hub->sessions[i];
+            paused = atomic_load(&session->lagging) > 0;
+
+            if(paused && !session->paused) server_printf("Session Paused For A Slow Client [SESSION: \"%s\"]\n", session->name);
+            if(!paused && session->paused) server_printf("Session Resumed [SESSION: \"%s\"]\n", session->name);
+            session->paused = paused;
+
+            hub_poll_add(fds, &count, paused ? -1 : session->shell.from, POLLIN);
+            hub_poll_add(fds, &count, atomic_load(&session->input_waiting) ? session->shell.to : -1, POLLOUT);
+        }
+
+        pending_at = count;
+        for(i = 0; i < hub->pending_count; ++i) hub_poll_add(fds, &count, hub->pending[i].pipe.from, POLLIN);
+
+        wait_time.tv_sec = wait_us / 1000000;
+        wait_time.tv_nsec = wait_us % 1000000 * 1000;
+
+        if(ppoll(fds, count, wait_us < 0 ? NULL : &wait_time, NULL) < 0)
+        {
+            if(errno == EINTR) continue;
+
+            server_printf("Error in ppoll: %s [%d]\n", strerror(errno), errno);
+            break;
+        }
+
+        // A worker resumed a session or queued input, or a session that ended lost its last client
+        if(hub_poll_readable(fds, 2)) read(hub->wake, &value, sizeof(value));
+
+        // Output from a shell is published to its session, and input that it had no room for is written
+        for(i = 0; i < hub->session_count; ++i)
+        {
+            session = hub->sessions[i];
+            if(hub_poll_readable(fds, sessions_at + 2 * i) && !hub_read_shell(hub, session)) hub_session_end(hub, session);
+            if(hub_poll_writable(fds, sessions_at + 2 * i + 1)) hub_session_drain(hub, session);
+        }
+
+        // Free every session whose shell exited, once its clients are gone
+        for(i = hub->session_count - 1; i >= 0; --i)
+        {
+            if(hub->sessions[i]->shell.from < 0 && atomic_load(&hub->sessions[i]->client_count) == 0) hub_session_close(hub, i);
+        }
+
+        for(i = hub->pending_count - 1; i >= 0; --i)
+        {
+            if(hub_poll_readable(fds, pending_at + i)) hub_pending_finish(hub, i);
+        }
+
+        if(hub_poll_readable(fds, 0)) hub_accept(hub);
+        if(hub_poll_readable(fds, 1)) hub_socket_accept(hub);
+        if(hub_poll_readable(fds, 3)) hub_stats_serve(hub);
+    }
+
+    // The hub is stopping, so every worker tells its clients to close
+    atomic_store(&hub->stopping, 1);
+    for(i = 0; i < hub->worker_count; ++i) hub_worker_stop(&hub->workers[i]);
+
+    while(hub->pending_count) hub_pending_close(hub, hub->pending_count - 1);
+    while(hub->session_count) hub_session_close(hub, hub->session_count - 1);
+
+    close(hub->listener);
+    if(hub->socket_listener >= 0) close(hub->socket_listener);
+    if(hub->stats_listener >= 0)
+    {
+        close(hub->stats_listener);
+        remove(STATS_NAME);
+    }
+    close(hub->listener_keep_open);
+    close(hub->dev_null);
+    close(hub->wake);
+    free(hub->workers);
+    free(hub->sessions);
+    free(fds);
+    latency_trace_free(hub->trace);
+    remove(WKP);
+
+    return hub_stopping ? 0 : -1;
+}
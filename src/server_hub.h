@@ -0,0 +1,429 @@
+#ifndef SERVER_HUB_HEADER_FILE
+#define SERVER_HUB_HEADER_FILE 1
+
+#include "pipe_networking.h"
+#include "broadcast_ring.h"
+#include "latency_trace.h"
+
+#include <pthread.h>
+
+#define MAX_CLIENTS (1 << 12)
+
+// Clients are spread across one worker thread per cpu by default, up to this many
+#define HUB_MAX_WORKERS 64
+
+// Most events a worker handles per epoll_wait(...)
+#define HUB_WORKER_EVENTS 256
+
+// Shell output is gathered into a buffer this big before it is sent to the clients,
+// and is sent as soon as HUB_FLUSH_SIZE bytes are waiting.
+// nothing bigger than HUB_OUTPUT_SIZE is ever published to a feed at once
+#define HUB_OUTPUT_SIZE (1 << 16)
+#define HUB_FLUSH_SIZE (1 << 14)
+
+// Longest that shell output waits in the buffer by default, in microseconds
+#define HUB_FLUSH_DELAY_US 2000
+
+// A read of the shell that empties its pipe with less than this is a prompt or an echo, not a stream
+#define HUB_STREAM_SIZE (1 << 12)
+
+// Size asked for the pipe that shell output is tee()d into for every worker with -z.
+// a worker that falls further behind than its pipe holds goes back to copying
+#define HUB_SPLICE_PIPE_SIZE (1 << 20)
+
+// Most output that can wait for a slow client by default,
+// and what happens to the client once it has that much waiting
+#define HUB_QUEUE_LIMIT (1 << 20)
+#define HUB_QUEUE_MAX (1 << 30)
+#define HUB_OVERFLOW_DISCONNECT 0
+#define HUB_OVERFLOW_DROP 1
+#define HUB_OVERFLOW_PAUSE 2
+
+// Scrollback that is replayed to new clients, in MB. 0 turns it off
+#define HUB_SCROLLBACK_MB 0
+#define HUB_SCROLLBACK_MAX_MB (1 << 10)
+
+// Most input that can wait for a shell that is too busy to read it.
+// a client that pushes it past this isn't read until the shell has taken all but half of it
+#define HUB_INPUT_LIMIT (1 << 20)
+
+// Size of the shared memory ring that clients can read shell output from
+#define HUB_RING_SIZE (1 << 20)
+
+// Smallest feed a session publishes to, feeds are made at least twice as big as the queue limit
+// so that a client is always dealt with before the feed laps it
+#define HUB_FEED_SIZE (1 << 21)
+
+// Room for sessions is grown by this many at a time
+#define HUB_SESSION_GROWTH (1 << 4)
+
+// Number of handshakes that can be in progress at the same time,
+// and how long a client gets to finish its handshake
+#define HUB_MAX_PENDING 64
+#define HUB_HANDSHAKE_TIMEOUT_MS HANDSHAKE_TIMEOUT_MS
+
+// Output that couldn't be written to a client yet, because its pipe / terminal was full.
+// the backlog of a client is kept in the feed of its session, so this only ever holds
+// the rest of the last frame, the scrollback, and the odd control frame
+struct hub_queue
+{
+    char* buffer;
+    uint32_t capacity;
+    uint32_t start;
+    uint32_t end;
+};
+
+// Counters of the relay, kept for every client, and for every client that has left.
+// each client's counters are only written by its worker, and can be read by the hub at any time
+struct hub_stats
+{
+    _Atomic long long bytes_in;
+    _Atomic long long bytes_out;
+    _Atomic long long reads;
+    _Atomic long long writes;
+
+    // Writes that the client couldn't take all of, and the time spent inside of every write
+    _Atomic long long short_writes;
+    _Atomic long long write_ns;
+
+    // Time the client had output queued because it couldn't take any more
+    _Atomic long long blocked_us;
+
+    // Bytes the client is behind the feed of its session, now and at most
+    _Atomic long long queue_depth;
+    _Atomic long long queue_max;
+};
+
+// Add to a counter that only a single thread writes, which doesn't need a locked add
+#define hub_stats_add(counter, value) atomic_store_explicit(&(counter), atomic_load_explicit(&(counter), memory_order_relaxed) + (value), memory_order_relaxed)
+
+// Every message in a feed starts with this, source is the id of the client
+// that typed it, or 0 for shell output
+struct hub_record
+{
+    uint32_t source;
+    uint32_t length;
+};
+
+// The last output the clients saw, kept so that new clients can be shown it when they join
+struct hub_scrollback
+{
+    // Allocated the first time there is output, NULL if scrollback is off
+    char* buffer;
+    size_t size;
+
+    // Where the next byte is written, and if the buffer has been filled at least once
+    size_t head;
+    int wrapped;
+};
+
+// A shell that any number of clients share, found by the name clients ask for in their handshake.
+// sessions are started when the first client asks for them, and keep running when every client leaves.
+struct hub_session
+{
+    int id;
+    char name[HANDSHAKE_SESSION_SIZE];
+
+    // Pipes of the shell, shell.from is -1 once the shell has exited
+    bi_file shell;
+    pid_t pid;
+
+    _Atomic int client_count;
+
+    // Held by every thread that publishes to the session, and around everything below it.
+    // readers of the feed never take it
+    pthread_mutex_t lock;
+
+    // Shell output and echoes, published once for every worker to read with its own cursors
+    struct broadcast_ring feed;
+
+    // Input that the pipe of the shell had no room for, which the hub writes once it does.
+    // input_waiting tells the hub to watch the pipe without locking the session,
+    // and input_blocked counts the clients that aren't read until the input goes down
+    struct hub_queue input;
+    _Atomic int input_waiting;
+    _Atomic int input_blocked;
+
+    // Shell output that hasn't been published yet, see hub_read_shell(...).
+    // the buffer is only allocated while output is waiting, so idle sessions stay small
+    char* output;
+    int output_size;
+    int streaming;
+    long long last_flush_us;
+    long long flush_deadline_us;
+
+    // Output and echoes that new clients are shown first, size is 0 if it is off
+    struct hub_scrollback scrollback;
+
+    // Shell output is also written here once any client asks for it
+    struct broadcast_ring ring;
+    int ring_clients;
+
+    // Clients over the queue limit with HUB_OVERFLOW_PAUSE, the shell isn't read while there are any.
+    // paused is what the hub last saw, so it only logs changes
+    _Atomic int lagging;
+    int paused;
+
+    // Set once the shell has exited and its last output was published
+    _Atomic int ended;
+
+    // Workers that have clients in the session, one bit for each, so new records only wake them.
+    // a worker sets and clears its own bit while the session is locked
+    _Atomic uint64_t workers;
+
+    // With -z, the pipe of every worker that shell output is tee()d into as it is read, or -1.
+    // splicing has a bit for every worker that has one, both only change while the session is locked
+    int splice[HUB_MAX_WORKERS];
+    uint64_t splicing;
+
+    // Shared with the shell, to pass it a sampled line and get its prompt back, NULL while tracing is off.
+    // once the hub reads the prompt, it is timed until it is published, and then up to every client.
+    // trace_client is the id of the client that is sent a FRAME_TRACE with the prompt, or 0
+    struct latency_trace_marks* trace;
+    long long trace_read_ns;
+    _Atomic long long trace_published_ns;
+    _Atomic uint64_t trace_published_at;
+    _Atomic int trace_client;
+};
+
+struct hub_client;
+struct hub_worker;
+
+// What an epoll event of a worker is about
+#define HUB_WATCH_WAKE 0
+#define HUB_WATCH_INBOX 1
+#define HUB_WATCH_INPUT 2
+#define HUB_WATCH_TERMINAL 3
+#define HUB_WATCH_OUTPUT 4
+#define HUB_WATCH_CONTROL 5
+
+struct hub_watch
+{
+    struct hub_client* client;
+    int kind;
+};
+
+// The clients that a worker has in one session, so new records in its feed only touch them
+struct hub_group
+{
+    struct hub_session* session;
+    struct hub_client** clients;
+    int client_count;
+    int client_capacity;
+
+    // Head of the feed the last time every client in the group was sent what it hadn't got
+    uint64_t seen;
+
+    // With -z, the read end of the pipe the hub tees the shell output of the session into, or -1,
+    // and the position in the feed up to which that output has been taken out of the pipe
+    int splice;
+    uint64_t spliced;
+};
+
+// A client is only ever touched by the worker that owns it, once the hub hands it over
+struct hub_client
+{
+    int id;
+    bi_file pipe;
+
+    // Session the client joined, the worker it belongs to, and the other clients of the worker in the session
+    struct hub_session* session;
+    struct hub_worker* worker;
+    struct hub_group* group;
+
+    // Terminal of a client that attached over the socket, or -1 if it didn't.
+    // Input is read from it and output is written to it directly, without frames.
+    bi_file terminal;
+
+    // Frames coming from the client, and the sequence number of the next frame sent to it
+    struct frame_reader reader;
+    uint32_t sequence;
+
+    // If set, the client gets its frames through a FIFO, so shell output can be tee()d into it with -z
+    int fifo;
+
+    // Position of the next record in session->feed, the client is behind by head - cursor
+    uint64_t cursor;
+
+    // Output waiting to be written to the client, which never blocks its worker.
+    // the frames that an attached client still gets wait in control, for its socket
+    struct hub_queue queue;
+    struct hub_queue control;
+    int watching;
+    int watching_control;
+
+    // If set, the client isn't read, as the shell of its session has too much input waiting
+    int input_paused;
+
+    // When the client started falling behind, or 0 if it isn't,
+    // and if it is counted in session->lagging
+    long long lagging_since;
+    int pausing;
+
+    // If set, the client reads shell output from session->ring instead of its FIFO.
+    // shell output from before ring_from in the feed was never written to the ring,
+    // so it is still sent through the FIFO
+    int ring;
+    uint64_t ring_from;
+
+    // Counters of the client, and when its queue last stopped being empty, or 0 if it is empty
+    struct hub_stats stats;
+    long long blocked_since;
+
+    // If set, the next input of the client is traced, because it sent a FRAME_TRACE.
+    // trace_seen is the end of the last traced prompt in the feed that the client was sent
+    int trace_next;
+    uint64_t trace_seen;
+
+    struct hub_watch watches[4];
+};
+
+// A thread that owns a shard of the clients, and waits on all of them with its own epoll instance
+struct hub_worker
+{
+    struct server_hub* hub;
+    int index;
+    pthread_t thread;
+    int epoll;
+
+    // eventfd that is written whenever the feed of a session the worker has clients in has new records
+    int wake;
+
+    // Pipe the hub sends new clients through, as pointers
+    int inbox[2];
+
+    // Held while clients are added to or removed from clients, so the hub can read their stats
+    pthread_mutex_t lock;
+    struct hub_client** clients;
+    int client_count;
+    int client_capacity;
+
+    // Clients that were closed, and haven't been removed yet
+    int closing;
+
+    // Clients by session, only ever touched by the worker. groups are allocated one by one, so clients can point at them
+    struct hub_group** groups;
+    int group_count;
+    int group_capacity;
+
+    // Clients handed to the worker and not disconnected yet, which the hub balances on
+    _Atomic int assigned;
+
+    // Records are gathered here before they are sent
+    char* buffer;
+
+    // Input left until the worker samples one on its own, when tracing is on
+    int trace_countdown;
+
+    struct hub_watch wake_watch;
+    struct hub_watch inbox_watch;
+};
+
+// A client that has been sent an ACK, but hasn't sent one back yet
+struct hub_pending
+{
+    bi_file pipe;
+    long long started;
+
+    // If set, pipe.from is a socket that hasn't sent its socket_request yet
+    int socket;
+
+    // Session the client asked for, filled in once it is known
+    char session[HANDSHAKE_SESSION_SIZE];
+};
+
+// Starts a shell that reads from shell->to and writes to shell->from,
+// and returns its pid, or -1 if it couldn't be started
+typedef pid_t (*hub_shell_start)(bi_file* shell);
+
+// The hub owns the listeners, the handshakes and the pipes of every session.
+// clients are handed to the workers once they finish their handshake
+struct server_hub
+{
+    hub_shell_start start_shell;
+
+    // Every running session. sessions are allocated one by one, so clients can point at them
+    struct hub_session** sessions;
+    int session_count;
+    int session_capacity;
+    int next_session_id;
+
+    // WKP that clients write connection requests to, for as long as the hub runs
+    int listener;
+    int listener_keep_open;
+
+    // Unix socket that clients can connect to instead, or -1 if it is disabled
+    int socket_listener;
+
+    // Unix socket that the stats are served on, or -1 if it couldn't be created
+    int stats_listener;
+
+    int pending_count;
+    struct hub_pending pending[HUB_MAX_PENDING];
+
+    // How long handshakes took, from the request to the client's ACK
+    long long connect_count;
+    long long connect_total_us;
+    long long connect_max_us;
+
+    // Counters of every client that has disconnected, added up by the workers
+    struct hub_stats closed;
+    _Atomic long long disconnect_count;
+    long long started_us;
+
+    // How much output can wait for a single client, and what to do when there is more
+    int queue_limit;
+    int overflow;
+
+    // Longest that shell output is held back, and the scrollback every session keeps
+    int flush_delay_us;
+    size_t scrollback_size;
+
+    // If set, shell output is tee()d to the workers and into the FIFOs of clients that are caught up,
+    // see hub_group_splice(...), and dev_null is where the workers splice what they are done with
+    int zero_copy;
+    int dev_null;
+
+    int worker_count;
+    struct hub_worker* workers;
+
+    // Histograms of every hop of a sampled line, NULL while tracing is off.
+    // every trace_every-th input is sampled, as well as every input that a client asks to trace
+    struct latency_trace_table* trace;
+    int trace_every;
+
+    // eventfd the workers write when a paused session can be read again
+    int wake;
+    _Atomic int stopping;
+
+    int next_id;
+    _Atomic int client_count;
+};
+
+// Initialize the hub, which starts a shell with start_shell for every session clients ask for
+void server_hub_init(struct server_hub*, hub_shell_start start_shell);
+
+// Relay messages between the sessions and the clients until the hub is stopped
+int server_hub_run(struct server_hub*);
+
+// Shared by the hub and its workers
+long long hub_now_us();
+int hub_queue_push(struct hub_queue*, const char* buffer, uint32_t size);
+
+// Write input to the shell of a session without blocking, which has to be locked.
+// returns the number of bytes the shell still has waiting for it
+uint32_t hub_session_input(struct server_hub*, struct hub_session*, const char* buffer, int size);
+
+// Publish a message to a session, which has to be locked
+void hub_session_publish(struct hub_session*, uint32_t source, const char* buffer, int size);
+
+// Publish the shell output of a session that is waiting, which has to be locked
+void hub_session_flush(struct server_hub*, struct hub_session*);
+
+// Tell the workers with clients in a session that its feed has new records
+void hub_session_wake(struct server_hub*, struct hub_session*);
+
+// Start timing the hops of sampled lines, sampling every n-th input on top of what clients ask for
+int hub_trace_start(struct server_hub*, int every);
+
+#endif
@@ -1,9 +1,27 @@
+#define _GNU_SOURCE
 #include "shell.h"
+#include "shell_job.h"
+
+#include <spawn.h>
+
+extern char** environ;
+
+// How external commands are started, see shell_set_engine(...)
+static int shell_engine = SH_ENGINE_SPAWN;
+
+struct shell_stats shell_stats;
+
+// The prompt, which is only rendered again when the directory changes
+static struct
+{
+    char text[SH_PROMPT_SIZE];
+    int length;
+} shell_prompt;
 
 /**
  * @return a string that represents the home directory of the current user
  */
-static const char* shell_get_home()
+const char* shell_get_home()
 {
     static const char* home_dir = NULL;
 
@@ -12,6 +30,45 @@ static const char* shell_get_home()
     return home_dir;
 }
 
+/**
+ * @brief render the prompt into the prompt cache
+ * 
+ * the hostname and home directory never change during a session,
+ * so they are only looked up the first time. the cwd is looked up
+ * every time this is called, which is only at startup and after a successful cd.
+ */
+void shell_prompt_update()
+{
+    static char usr[SH_USR_SIZE] = {};
+    static const char* home_dir = NULL;
+    static int home_dir_len = 0;
+
+    char cwd[SH_CWD_SIZE] = {};
+    const char* shown = cwd;
+    int length;
+
+    // get information about the host and the home directory
+    if(home_dir == NULL)
+    {
+        gethostname(usr, SH_USR_SIZE - 1);
+        home_dir = shell_get_home();
+        home_dir_len = strlen(home_dir);
+    }
+
+    getcwd(cwd, SH_CWD_SIZE);
+
+    // simplify the directory if it is in the home directory
+    if(strncmp(cwd, home_dir, home_dir_len) == 0) shown = cwd + home_dir_len;
+
+    length = snprintf(shell_prompt.text, SH_PROMPT_SIZE,
+        SH_COLOR_RESET "\n─────╮ " SH_COLOR_RED SH_PROGRAM_NAME SH_COLOR_RESET " : " SH_COLOR_GREEN "%s"
+        SH_COLOR_RESET "\n ╭───╯ " SH_COLOR_BLUE "%s%s"
+        SH_COLOR_RESET "\n─╯ ",
+        usr, shown == cwd ? "" : "~", shown);
+
+    shell_prompt.length = length < SH_PROMPT_SIZE ? length : SH_PROMPT_SIZE - 1;
+}
+
 /**
  * @brief Display a prompt for the user to type into and reads data
  * 
@@ -19,51 +76,526 @@ static const char* shell_get_home()
  * which is simplified if it is in the home directory
  * along with the user and the name of the shell.
  * 
- * @return the input that the user has typed
+ * the prompt is rendered ahead of time by shell_prompt_update(...),
+ * so showing it is a single write, which the server relays as a single chunk.
+ * 
+ * when the server traces latency, the shell times a sampled line from when the server
+ * wrote it to when it was read, and from then to the next prompt, which it stamps
+ * right before writing it, see latency_trace.h.
+ * 
+ * @return the parsed line that the user has typed
  */
-struct shell_command* shell_readline()
+struct shell_line* shell_readline()
 {
-    // create really large buffers
-    char cwd[SH_CWD_SIZE] = {};
-    char usr[SH_USR_SIZE] = {};
-    char line[SH_USER_INPUT_BUFFER + 1] = {};
+    // the line grows to fit whatever the user types, and is kept between calls
+    static char* line = NULL;
+    static size_t line_size = 0;
 
-    // get information about home directory
-    const char* home_dir = shell_get_home();
-    int home_dir_len = strlen(home_dir);
+    if(shell_prompt.length == 0) shell_prompt_update();
 
-    // copy cwd and hostname into buffers
-    getcwd(cwd, SH_CWD_SIZE);
-    gethostname(usr, SH_USR_SIZE);
+    // jobs that finished while the last line ran are reported above the prompt
+    shell_job_notify();
+
+    if(latency_trace_session) latency_trace_hand_off(latency_trace_shared, TRACE_HOP_SHELL_RUN, &latency_trace_session->line_ns, &latency_trace_session->prompt_ns);
 
-    // build prompt for user
-    fprintf(stderr, SH_COLOR_RESET "\n─────╮ " SH_COLOR_RED SH_PROGRAM_NAME SH_COLOR_RESET " : " SH_COLOR_GREEN "%s", usr);
-    if(strncmp(cwd, home_dir, home_dir_len) == 0)
-         fprintf(stderr, SH_COLOR_RESET "\n ╭───╯ " SH_COLOR_BLUE "~%s", cwd + home_dir_len);
-    else fprintf(stderr, SH_COLOR_RESET "\n ╭───╯ " SH_COLOR_BLUE "%s", cwd);
-    fprintf(stderr, SH_COLOR_RESET "\n─╯ ");
+    write(SH_STDERR, shell_prompt.text, shell_prompt.length);
 
     // read input from user
-    fgets(line, SH_USER_INPUT_BUFFER, stdin);
+    if(getline(&line, &line_size, stdin) < 0) return shell_line_create("");
+
+    if(latency_trace_session) latency_trace_hand_off(latency_trace_shared, TRACE_HOP_WORKER_TO_SHELL, &latency_trace_session->input_ns, &latency_trace_session->line_ns);
+
+    // return the parsed line, which might come straight out of the parse cache
+    return shell_line_create(line);
+}
+
+/**
+ * @brief execute every pipeline of a line
+ * 
+ * the execution is done with shell_execute(...) which deals with every special case,
+ * unless the pipeline has more than one command, in which case it
+ * is handed to shell_execute_pipeline(...) so every stage runs at the same time.
+ * pipelines that end with '&' are started by shell_execute_background(...) and never waited on.
+ * a pipeline after '&&' is skipped unless the last pipeline that ran succeeded,
+ * and one after '||' is skipped unless it failed, so a && b || c runs c if a or b failed.
+ * a line that didn't parse only has its error printed.
+ * 
+ * @param line the parsed line to execute
+ */
+void shell_execute_line(struct shell_line* line)
+{
+    struct shell_pipeline* pipeline;
+    int status = 0;
+
+    if(line->error)
+    {
+        fprintf(stderr, SH_PROGRAM_NAME ": error: %s\n", line->error);
+        return;
+    }
+
+    for(pipeline = line->pipelines; pipeline != NULL; pipeline = pipeline->next_pipeline)
+    {
+        if(pipeline->condition == SH_TOKEN_AND && status != 0) continue;
+        if(pipeline->condition == SH_TOKEN_OR && status == 0) continue;
+
+        if(pipeline->background) status = shell_execute_background(pipeline);
+        else if(pipeline->length > 1) status = shell_execute_pipeline(pipeline);
+        else status = shell_execute(pipeline->commands);
+    }
+}
+
+/**
+ * @brief set up a process to use the standard file descriptors
+ * 
+ * @param process the process to set up
+ */
+static void shell_process_init(struct shell_process* process)
+{
+    process->redir_stdin = SH_STDIN;
+    process->redir_stdout = SH_STDOUT;
+    process->redir_stderr = SH_STDERR;
+
+    process->pid = -1;
+    process->status = 0;
+}
+
+/**
+ * @brief close every file descriptor that a process was redirected to
+ * 
+ * @param process the process to close the file descriptors of
+ */
+static void shell_process_close(struct shell_process* process)
+{
+    safe_close(process->redir_stdin,  SH_STDIN);
+    safe_close(process->redir_stdout, SH_STDOUT);
+    safe_close(process->redir_stderr, SH_STDERR);
+}
+
+/**
+ * @brief open the redirects of a command for a process that is about to run it
+ * 
+ * a redirect is skipped if the stream it redirects was already redirected or piped.
+ * the files are opened close-on-exec, so only the command they are moved onto keeps them.
+ * 
+ * @param command the command with the redirects
+ * @param process the process to redirect
+ */
+static void shell_process_redirect(const struct shell_command* command, struct shell_process* process)
+{
+    struct shell_redirect* redirect;
+    int *target, fd;
+
+    for(redirect = command->redirects; redirect; redirect = redirect->next)
+    {
+        if(redirect->type == SH_TOKEN_REDIRECT_IN) target = &process->redir_stdin;
+        else target = &process->redir_stdout;
+
+        if(*target != (redirect->type == SH_TOKEN_REDIRECT_IN ? SH_STDIN : SH_STDOUT))
+        {
+            fprintf(stderr, SH_PROGRAM_NAME ": error: unable to redirect %s: command already redirected / piped\n", redirect->path);
+            continue;
+        }
+
+        switch(redirect->type)
+        {
+            case SH_TOKEN_REDIRECT_IN:     fd = open(redirect->path, O_RDONLY | O_CLOEXEC); break;
+            case SH_TOKEN_REDIRECT_OUT:    fd = open(redirect->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666); break;
+            case SH_TOKEN_REDIRECT_APPEND: fd = open(redirect->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666); break;
+            default: continue;
+        }
+
+        if(fd < 0) fprintf(stderr, SH_PROGRAM_NAME ": error: unable to redirect %s: %s [%d]\n", redirect->path, strerror(errno), errno);
+        else *target = fd;
+    }
+}
+
+/**
+ * @brief choose how external commands are started
+ * 
+ * SH_ENGINE_SPAWN uses posix_spawn(...), which never copies the shell and never
+ * touches the shell's own stdin / stdout / stderr. SH_ENGINE_FORK is the old
+ * fork() / exec() path, which is kept around to benchmark against.
+ * 
+ * @param engine SH_ENGINE_SPAWN or SH_ENGINE_FORK
+ */
+void shell_set_engine(int engine)
+{ shell_engine = engine; }
+
+/**
+ * @brief wait for a child, and count the time spent waiting
+ *
+ * @param pid the child to wait for
+ * @param status where the status of the child is stored
+ * @return the pid of the child, or -1 if it couldn't be waited on
+ */
+pid_t shell_waitpid(pid_t pid, int* status)
+{
+    struct timespec start, end;
+    pid_t reaped;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while((reaped = waitpid(pid, status, 0)) < 0 && errno == EINTR);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    shell_stats.waitpid_ns += (end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec;
+    return reaped;
+}
+
+/**
+ * @brief turn the status from waitpid(...) into an exit status
+ *
+ * @param status the status of a child that was waited on
+ * @return its exit code, or 128 + the signal that killed it
+ */
+static int shell_exit_status(int status)
+{
+    if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+/**
+ * @brief print why a command couldn't be started
+ * 
+ * @param command the command that failed
+ * @param error the errno of the failure
+ * @return the exit status to give the command
+ */
+static int shell_exec_error(struct shell_command* command, int error)
+{
+    // "No such file or directory" = Command doesn't exist
+    if(error == ENOENT)
+    {
+        fprintf(stderr, SH_PROGRAM_NAME ": command not found: %s\n", command->argv[0]);
+        return 127;
+    }
+
+    // Handle every other error
+    fprintf(stderr, SH_PROGRAM_NAME ": %s [%d]\n", strerror(error), error);
+    return 126;
+}
+
+/**
+ * @brief replace the current process with the command
+ * 
+ * this is only ever called inside of a forked child, 
+ * and it never returns. the path was already found by the parent
+ * with shell_path_lookup(...), so $PATH is never searched here.
+ * if the exec fails, the error is printed and the child exits with the status.
+ * 
+ * @param command command to execute
+ * @param path the path of the command, or NULL if it wasn't found
+ */
+static void shell_exec_child(struct shell_command* command, const char* path)
+{
+    errno = ENOENT;
+    if(path)
+    {
+        execv(path, command->argv);
+
+        // Scripts without a #! line are left to execvp, which runs them with /bin/sh
+        if(errno == ENOEXEC) execvp(path, command->argv);
+    }
+
+    exit(shell_exec_error(command, errno));
+}
+
+/**
+ * @brief start a command with posix_spawn(...)
+ * 
+ * the redirects of the process are moved onto stdin / stdout / stderr
+ * by file actions that only run in the child. every other pipe and file
+ * in the pipeline is close-on-exec, so nothing has to be closed explicitly.
+ * 
+ * glibc starts the child with clone(CLONE_VM | CLONE_VFORK), so this costs
+ * the same no matter how much memory the shell is using.
+ * 
+ * @param command the command to start
+ * @param path the path of the command, or NULL if it wasn't found
+ * @param process the redirects of the command, the pid is stored in here
+ * @return the pid of the command, or -1 if it couldn't be started
+ */
+static pid_t shell_spawn(struct shell_command* command, const char* path, struct shell_process* process)
+{
+    posix_spawn_file_actions_t actions;
+    char** argv;
+    int error = ENOENT;
+
+    process->pid = -1;
+
+    if(path)
+    {
+        posix_spawn_file_actions_init(&actions);
+
+        if(process->redir_stdin  != SH_STDIN)  posix_spawn_file_actions_adddup2(&actions, process->redir_stdin,  SH_STDIN);
+        if(process->redir_stdout != SH_STDOUT) posix_spawn_file_actions_adddup2(&actions, process->redir_stdout, SH_STDOUT);
+        if(process->redir_stderr != SH_STDERR) posix_spawn_file_actions_adddup2(&actions, process->redir_stderr, SH_STDERR);
+
+        error = posix_spawn(&process->pid, path, &actions, NULL, command->argv, environ);
+
+        // Scripts without a #! line are run with /bin/sh, the same way execvp does
+        if(error == ENOEXEC && (argv = malloc((command->argc + 2) * sizeof(char*))))
+        {
+            argv[0] = "/bin/sh";
+            argv[1] = (char*)path;
+            memcpy(argv + 2, command->argv + 1, command->argc * sizeof(char*));
+
+            error = posix_spawn(&process->pid, argv[0], &actions, NULL, argv, environ);
+            free(argv);
+        }
+
+        posix_spawn_file_actions_destroy(&actions);
+    }
+
+    if(error)
+    {
+        if(error == EAGAIN || error == ENOMEM) ++shell_stats.fork_failures;
+        else ++shell_stats.exec_failures;
+
+        process->pid = -1;
+        process->status = shell_exec_error(command, error);
+    }
+
+    return process->pid;
+}
+
+/**
+ * @brief start every stage of a pipeline concurrently
+ * 
+ * every stage is started before any of them are
+ * waited on, so a producer can never fill up the pipe and block forever
+ * waiting on a consumer that hasn't started yet.
+ * 
+ *  1) create the pipes between the stages, and open the redirects of every stage
+ *  2) start every stage with shell_spawn(...), or with fork()
+ *      2a) the child moves its redirects onto stdin / stdout / stderr, 
+ *          closes every other pipe in the pipeline and execv()'s
+ *      2b) the parent closes the pipe ends that were given to the child
+ * 
+ * builtins only fork when they have to. a builtin that is the last stage runs inside
+ * of the shell once every other stage has started, as nothing is waiting on it.
+ * any other builtin could fill up its pipe before its reader starts,
+ * so it is forked, and runs in the child without an exec.
+ * in the background every builtin is forked, since the shell has to move on to the next line.
+ * 
+ * a background pipeline reads /dev/null unless it was redirected, otherwise it would
+ * race the shell for the lines that the clients type.
+ * 
+ * @param pipeline the pipeline to start
+ * @param stages the state of every stage, stages that ran inside of the shell get a pid of 0
+ * @param background SH_TRUE if the pipeline will not be waited on
+ */
+static void shell_pipeline_start(struct shell_pipeline* pipeline, struct shell_process* stages, int background)
+{
+    const struct shell_builtin* builtin;
+    struct shell_command* command;
+    const char* path;
+    int i, j, fds[2];
+
+    for(i = 0; i < pipeline->length; ++i) shell_process_init(&stages[i]);
+
+    // Pipe every stage into the next one, then add the redirects on top
+    for(command = pipeline->commands, i = 0; command != NULL; command = command->next_command, ++i)
+    {
+        if(command->next_command != NULL)
+        {
+            if(pipe2(fds, O_CLOEXEC) < 0)
+            {
+                fprintf(stderr, SH_PROGRAM_NAME ": error: unable to pipe %s to %s: %s [%d]\n", command->argv[0], command->next_command->argv[0], strerror(errno), errno);
+            }
+            else
+            {
+                stages[i].redir_stdout = fds[1];
+                stages[i + 1].redir_stdin = fds[0];
+            }
+        }
+
+        shell_process_redirect(command, &stages[i]);
+    }
+
+    if(background && stages[0].redir_stdin == SH_STDIN)
+    {
+        fds[0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if(fds[0] >= 0) stages[0].redir_stdin = fds[0];
+    }
+
+    // Start every stage before waiting on any of them
+    for(command = pipeline->commands, i = 0; command != NULL; command = command->next_command, ++i)
+    {
+        if(command->argc == 0)
+        {
+            shell_process_close(&stages[i]);
+            continue;
+        }
+
+        builtin = shell_builtin_find(command->argv[0]);
+
+        ++shell_stats.commands;
+        if(builtin) ++shell_stats.builtins;
+
+        if(builtin && builtin->pure && command->next_command == NULL && !background)
+        {
+            stages[i].status = builtin->run(command, stages[i].redir_stdout, stages[i].redir_stderr);
+            stages[i].pid = 0;
+            shell_process_close(&stages[i]);
+            continue;
+        }
+
+        if(builtin)
+        {
+            stages[i].pid = fork();
+
+            // The child only needs its own pipe ends, and must not flush what the shell has buffered
+            if(stages[i].pid == 0)
+            {
+                for(j = 0; j < pipeline->length; ++j)
+                    if(j != i) shell_process_close(&stages[j]);
+
+                _exit(builtin->run(command, stages[i].redir_stdout, stages[i].redir_stderr));
+            }
+
+            else if(stages[i].pid < 0)
+            {
+                ++shell_stats.fork_failures;
+                fprintf(stderr, SH_PROGRAM_NAME ": unable to fork %s: %s [%d]\n", command->argv[0], strerror(errno), errno);
+            }
+
+            shell_process_close(&stages[i]);
+            continue;
+        }
+
+        // The path is found right before the command starts, while it is still valid
+        path = shell_path_lookup(command->argv[0]);
+
+        if(shell_engine == SH_ENGINE_SPAWN)
+        {
+            shell_spawn(command, path, &stages[i]);
+            shell_process_close(&stages[i]);
+            continue;
+        }
+
+        stages[i].pid = fork();
+
+        // Child
+        if(stages[i].pid == 0)
+        {
+            dup2(stages[i].redir_stdin,  SH_STDIN);
+            dup2(stages[i].redir_stdout, SH_STDOUT);
+            dup2(stages[i].redir_stderr, SH_STDERR);
 
-    // return command created from line
-    return shell_command_create(line);
+            // Close every file descriptor that belongs to the pipeline
+            // otherwise the readers will never see the end of their input
+            for(j = 0; j < pipeline->length; ++j) shell_process_close(&stages[j]);
+
+            shell_exec_child(command, path);
+        }
+
+        else if(stages[i].pid > 0 && path == NULL) ++shell_stats.exec_failures;
+
+        else if(stages[i].pid < 0)
+        {
+            fprintf(stderr, SH_PROGRAM_NAME ": unable to fork %s: %s [%d]\n", command->argv[0], strerror(errno), errno);
+        }
+
+        // The pipe ends now belong to the child
+        shell_process_close(&stages[i]);
+    }
 }
 
 /**
- * @brief execute all of the commands in the shell_command linked list
+ * @brief execute every stage of a pipeline concurrently, and wait for all of them
  * 
- * the execution is done with shell_execute(...) which deals with every special case. 
+ * the stages are started by shell_pipeline_start(...), and are then
+ * waitpid()'ed in order, storing the exit status of every one.
  * 
- * @param command list of commands to execute
+ * the state of every stage is kept in an array of shell_process,
+ * so the parsed pipeline is never modified and there is no limit on its length.
+ * 
+ * if any of the stages fail, the status of every stage is printed.
+ * a stage that was killed by SIGPIPE does not count as failing unless it was the last one.
+ * 
+ * @param pipeline the pipeline to execute
+ * @return the exit status of the last stage
  */
-void shell_execute_commands(struct shell_command* command)
+int shell_execute_pipeline(struct shell_pipeline* pipeline)
 {
-    while(command != NULL)
+    struct shell_process* stages;
+    int i, failed, status;
+
+    stages = malloc(pipeline->length * sizeof(struct shell_process));
+    if(stages == NULL)
+    {
+        fprintf(stderr, SH_PROGRAM_NAME ": unable to run pipeline: %s [%d]\n", strerror(errno), errno);
+        return 127;
+    }
+
+    shell_pipeline_start(pipeline, stages, SH_FALSE);
+
+    // Wait for the whole group
+    failed = SH_FALSE;
+    for(i = 0; i < pipeline->length; ++i)
+    {
+        if(stages[i].pid > 0 && shell_waitpid(stages[i].pid, &stages[i].status) == stages[i].pid)
+            stages[i].status = shell_exit_status(stages[i].status);
+        else if(stages[i].pid < 0 && stages[i].status == 0) stages[i].status = 127;
+
+        // Producers being killed by SIGPIPE is how pipelines normally end
+        if(stages[i].status && !(i < pipeline->length - 1 && stages[i].status == 128 + SIGPIPE)) failed = SH_TRUE;
+    }
+
+    // Report the status of every stage
+    if(failed)
     {
-        shell_execute(command);
-        command = command->next_command;
+        fprintf(stderr, SH_PROGRAM_NAME ": pipeline exit status: [");
+        for(i = 0; i < pipeline->length; ++i)
+            fprintf(stderr, i ? " %d" : "%d", stages[i].status);
+        fprintf(stderr, "]\n");
     }
+
+    status = stages[pipeline->length - 1].status;
+    free(stages);
+
+    return status;
+}
+
+/**
+ * @brief start a pipeline in the background, and add it to the job table
+ * 
+ * the stages are started the same way as shell_execute_pipeline(...),
+ * but the shell goes straight back to reading lines. the stages are reaped
+ * by the SIGCHLD handler of the job table when they exit, see shell_job_add(...).
+ * 
+ * the id of the job and the pid of its last stage are printed like bash does, "[1] 1234".
+ * 
+ * @param pipeline the pipeline to start
+ * @return 0 if the pipeline was started, 127 otherwise
+ */
+int shell_execute_background(struct shell_pipeline* pipeline)
+{
+    struct shell_process* stages;
+    int i, id;
+
+    stages = malloc(pipeline->length * sizeof(struct shell_process));
+    if(stages == NULL)
+    {
+        fprintf(stderr, SH_PROGRAM_NAME ": unable to run pipeline: %s [%d]\n", strerror(errno), errno);
+        return 127;
+    }
+
+    shell_pipeline_start(pipeline, stages, SH_TRUE);
+    ++shell_stats.jobs;
+
+    id = shell_job_add(pipeline, stages);
+    if(id < 0)
+    {
+        // Without a slot, the stages are waited on right away, so they are never left as zombies
+        fprintf(stderr, SH_PROGRAM_NAME ": too many jobs [SH_JOB_MAX=%d], waiting for this one in the foreground\n", SH_JOB_MAX);
+        for(i = 0; i < pipeline->length; ++i)
+            if(stages[i].pid > 0) shell_waitpid(stages[i].pid, NULL);
+    }
+    else fprintf(stderr, "[%d] %d\n", id, stages[pipeline->length - 1].pid);
+
+    free(stages);
+    return id < 0 ? 127 : 0;
 }
 
 /**
@@ -72,74 +604,69 @@ void shell_execute_commands(struct shell_command* command)
  * this function will detect:
  *  - if the command is NULL
  *  - if the command has no arguments
- *  - if the command is "cd"
- *      - the command will then change the directory of the shell
- *  - if the command is "exit" / "quit"
- *      - the command will then close the shell
+ *  - if the command is in the table of builtins, like cd, hash and exit, see shell_builtin_find(...)
+ *      - the builtin runs inside of the shell, writing straight to the redirects of the command
  * 
- * otherwise, the command will:
+ * otherwise, the command is started with shell_spawn(...) and waited on.
+ * with the fork engine, the command will instead:
  *  1) set stdin, stdout, stderr to the commands specifications
  *  2) fork()
- *      2a) execvp()
+ *      2a) execv() the path from shell_path_lookup(...)
  *      2b) waitpid()
  *  3) move the file descriptors back
  * 
  * @param command command to execute
+ * @return the exit status of the command
  */
-void shell_execute(struct shell_command* command)
+int shell_execute(struct shell_command* command)
 {
-    char dir[2 * SH_CWD_SIZE + 2] = {};
+    const struct shell_builtin* builtin;
+    struct shell_process process;
+    const char* path;
     int t_stdin, t_stdout, t_stderr;
-    int status, f;
+    int status = 0;
 
     // Throw out empty commands
-    if(command == NULL) return;
-    if(command->argc == 0) return;
+    if(command == NULL) return 0;
+    if(command->argc == 0) return 0;
+
+    ++shell_stats.commands;
 
-    // Handle CD
-    if(strcmp(command->argv[0], "cd") == 0)
+    // Builtins never fork, and write to the redirects directly
+    if((builtin = shell_builtin_find(command->argv[0])))
     {
-        if(command->argc != 2)
-        {
-            fprintf(stderr, SH_PROGRAM_NAME ": cd: 1 argument required, %d given\n", command->argc - 1);
-        } else
-        {
-            if(strlen(command->argv[1]) >= SH_CWD_SIZE)
-            { fprintf(stderr, SH_PROGRAM_NAME ": cd: length of given directory is too long [SH_CWD_SIZE=%d] \n", SH_CWD_SIZE); }
+        ++shell_stats.builtins;
+        shell_process_init(&process);
+        shell_process_redirect(command, &process);
 
-            else
-            {
-                // Check to see if the first character is '~'
-                // if it is, then add the home directory to the beginning
-                if(command->argv[1][0] == '~') sprintf(dir, "%.*s%.*s", SH_CWD_SIZE, shell_get_home(), SH_CWD_SIZE, command->argv[1] + 1);
-                else sprintf(dir, "%.*s", SH_CWD_SIZE, command->argv[1]);
+        status = builtin->run(command, process.redir_stdout, process.redir_stderr);
 
-                // change directories
-                status = chdir(dir);
+        shell_process_close(&process);
+    }
 
-                // print out error if cd fails
-                if(status) fprintf(stderr, SH_PROGRAM_NAME ": cd: %s [%d]\n", strerror(errno), errno);
-            }
+    // If no special command is entered
+    // spawn the process straight onto its redirects
+    else if(shell_engine == SH_ENGINE_SPAWN)
+    {
+        shell_process_init(&process);
+        shell_process_redirect(command, &process);
+
+        if(shell_spawn(command, shell_path_lookup(command->argv[0]), &process) > 0)
+        {
+            shell_waitpid(process.pid, &process.status);
+            status = shell_exit_status(process.status);
         }
-    }
+        else status = process.status;
 
-    // Handle quit
-    else if(
-        strcmp(command->argv[0], "quit") == 0 ||
-        strcmp(command->argv[0], "exit") == 0
-    ) {
-        close(SH_STDIN);
-        close(SH_STDOUT);
-        close(SH_STDERR);
-        exit(0);
+        shell_process_close(&process);
     }
 
-    // If no special command is entered
-    // fork and run process
+    // Or fork and run process
     else
     {
-        // Add redirects to the command
-        command = shell_command_add_redirects(command);
+        // Open the redirects of the command
+        shell_process_init(&process);
+        shell_process_redirect(command, &process);
 
         // Make copies of standard fds
         t_stdin  = dup(SH_STDIN);
@@ -147,53 +674,39 @@ void shell_execute(struct shell_command* command)
         t_stderr = dup(SH_STDERR);
 
         // Pipe outputs to the commands specified outputs
-        dup2(command->redir_stdin,  SH_STDIN);
-        dup2(command->redir_stdout, SH_STDOUT);
-        dup2(command->redir_stderr, SH_STDERR);
+        dup2(process.redir_stdin,  SH_STDIN);
+        dup2(process.redir_stdout, SH_STDOUT);
+        dup2(process.redir_stderr, SH_STDERR);
 
         // Fork Process
-        f = fork();
+        path = shell_path_lookup(command->argv[0]);
+        process.pid = fork();
             
         // Child
-        if(f == 0) 
-        {
-            status = execvp(command->argv[0], command->argv);
-            
-            // Handle different return values from child
-            switch(errno)
-            {
-                // Returned Correctly, no error
-                case 0: break;
-
-                // "No such file or directory" = Command doesn't exist
-                case 2:
-                    fprintf(stderr, SH_PROGRAM_NAME ": command not found: %s\n", command->argv[0]);
-                    break;
-                
-                // Handle every other error
-                default:
-                    fprintf(stderr, SH_PROGRAM_NAME ": %s [%d]\n", strerror(errno), errno);
-                    break;
-            }
+        if(process.pid == 0) shell_exec_child(command, path);
 
-            exit(status);
-        }
+        else if(process.pid < 0) ++shell_stats.fork_failures;
 
         // Have parent wait for child
-        else 
+        else
         {
-            waitpid(f, &status, 0);
-            status = WEXITSTATUS(status);
+            if(path == NULL) ++shell_stats.exec_failures;
+
+            shell_waitpid(process.pid, &process.status);
+            status = shell_exit_status(process.status);
         }
 
         // Close all of the outputs opened by the command
-        close(SH_STDIN);  safe_close(command->redir_stdin, SH_STDIN);
-        close(SH_STDOUT); safe_close(command->redir_stdout, SH_STDOUT);
-        close(SH_STDERR); safe_close(command->redir_stderr, SH_STDERR);
+        close(SH_STDIN);
+        close(SH_STDOUT);
+        close(SH_STDERR);
+        shell_process_close(&process);
     
         // Move the outputs back to their place
         dup2(t_stdin,  SH_STDIN);  close(t_stdin);
         dup2(t_stdout, SH_STDOUT); close(t_stdout);
         dup2(t_stderr, SH_STDERR); close(t_stderr);
     }
+
+    return status;
 }
\ No newline at end of file
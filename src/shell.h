@@ -5,6 +5,7 @@
 
 #include <unistd.h>
 #include <sys/wait.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <pwd.h>
 
@@ -14,14 +15,71 @@
 
 #include "constants.h"
 #include "shell_command.h"
+#include "shell_path.h"
+#include "shell_builtin.h"
+#include "latency_trace.h"
+
+// Ways that external commands can be started
+#define SH_ENGINE_SPAWN 0
+#define SH_ENGINE_FORK 1
+
+// The state of a command while it runs, which is kept out of the parsed line
+// so that the same line can be run again
+struct shell_process
+{
+    int redir_stdin;
+    int redir_stdout;
+    int redir_stderr;
+
+    pid_t pid;
+    int status;
+};
+
+// Counters of everything the shell has run, which the stats builtin prints
+struct shell_stats
+{
+    // Commands that were run, and how many of them were builtins
+    long long commands;
+    long long builtins;
+
+    // Pipelines that were started with '&'
+    long long jobs;
+
+    // Commands that couldn't get a process, and commands that got one but couldn't be run
+    long long fork_failures;
+    long long exec_failures;
+
+    // Time spent blocked in waitpid(...) for foreground commands and wait / fg
+    long long waitpid_ns;
+};
+
+extern struct shell_stats shell_stats;
+
+// waitpid(...) that retries on EINTR and adds the time it blocked to shell_stats
+pid_t shell_waitpid(pid_t, int* status);
+
+// Choose between posix_spawn() and fork() for starting external commands
+void shell_set_engine(int engine);
+
+// Home directory of the user, which a leading '~' stands for
+const char* shell_get_home();
+
+// Render the prompt again, after the directory of the shell changed
+void shell_prompt_update();
 
 // Print prompt and reads user input
-struct shell_command* shell_readline();
+struct shell_line* shell_readline();
+
+// Execute every pipeline in the line
+void shell_execute_line(struct shell_line*);
+
+// Execute a single command and handle file descriptors / forking, returns the exit status
+int shell_execute(struct shell_command*);
 
-// Execute every command in the chain
-void shell_execute_commands(struct shell_command*);
+// Start every stage of a pipeline, wait for all of them, and return the exit status of the last one
+int shell_execute_pipeline(struct shell_pipeline*);
 
-// Execute a single command and handle file descriptors / forking
-void shell_execute(struct shell_command*);
+// Start every stage of a pipeline as a job, without waiting for any of them
+int shell_execute_background(struct shell_pipeline*);
 
 #endif
\ No newline at end of file
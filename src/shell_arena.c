@@ -0,0 +1,150 @@
+#include "shell_arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+
+/**
+ * @brief allocate a new block for the arena
+ *
+ * the program exits if the memory can't be allocated,
+ * the same way that the parser does.
+ *
+ * @param size number of bytes the block can hold
+ * @return the new block
+ */
+static struct shell_arena_block* shell_arena_block_create(size_t size)
+{
+    struct shell_arena_block* block = malloc(sizeof(struct shell_arena_block) + size);
+
+    if(block == NULL)
+    {
+        fprintf(stderr, SH_PROGRAM_NAME ": fatal error: unable to allocate memory. exiting...\n");
+        exit(-1);
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+/**
+ * @brief create an arena with room for at least size bytes
+ *
+ * @param size number of bytes the first block can hold
+ * @return the new arena
+ */
+struct shell_arena* shell_arena_create(size_t size)
+{
+    struct shell_arena* arena = malloc(sizeof(struct shell_arena));
+
+    if(arena == NULL)
+    {
+        fprintf(stderr, SH_PROGRAM_NAME ": fatal error: unable to allocate memory. exiting...\n");
+        exit(-1);
+    }
+
+    arena->first = arena->current = shell_arena_block_create(size < SH_ARENA_MIN_BLOCK ? SH_ARENA_MIN_BLOCK : size);
+
+    return arena;
+}
+
+/**
+ * @brief allocate memory from the arena
+ *
+ * the memory is taken from the end of the current block,
+ * and a new block is only allocated if the current one is full.
+ * the memory is not cleared.
+ *
+ * @param arena the arena to allocate from
+ * @param size the number of bytes to allocate
+ * @return pointer to the allocated memory
+ */
+void* shell_arena_alloc(struct shell_arena* arena, size_t size)
+{
+    struct shell_arena_block* block = arena->current;
+    void* memory;
+
+    size = (size + SH_ARENA_ALIGN - 1) & ~(SH_ARENA_ALIGN - 1);
+
+    if(block->used + size > block->size)
+    {
+        // Blocks double in size, so a huge line only needs a few of them
+        block->next = shell_arena_block_create(size > 2 * block->size ? size : 2 * block->size);
+        block = arena->current = block->next;
+    }
+
+    memory = block->data + block->used;
+    block->used += size;
+
+    return memory;
+}
+
+/**
+ * @brief copy a string into the arena
+ *
+ * @param arena the arena to copy the string into
+ * @param str the string to copy
+ * @param size the number of characters to copy
+ * @return the null terminated copy of the string
+ */
+char* shell_arena_strndup(struct shell_arena* arena, const char* str, size_t size)
+{
+    char* copy = shell_arena_alloc(arena, size + 1);
+
+    memcpy(copy, str, size);
+    copy[size] = '\0';
+
+    return copy;
+}
+
+/**
+ * @param arena the arena to check
+ * @return the number of bytes the first block of the arena can hold
+ */
+size_t shell_arena_capacity(struct shell_arena* arena)
+{
+    return arena->first->size;
+}
+
+/**
+ * @brief free every allocation at once
+ *
+ * every block except the first is freed,
+ * and the first one is emptied so it can be used again.
+ *
+ * @param arena the arena to reset
+ */
+void shell_arena_reset(struct shell_arena* arena)
+{
+    struct shell_arena_block *block, *next;
+
+    for(block = arena->first->next; block != NULL; block = next)
+    {
+        next = block->next;
+        free(block);
+    }
+
+    arena->first->next = NULL;
+    arena->first->used = 0;
+    arena->current = arena->first;
+}
+
+/**
+ * @brief free the arena and every block in it
+ *
+ * @param arena the arena to free
+ */
+void shell_arena_free(struct shell_arena* arena)
+{
+    if(arena)
+    {
+        shell_arena_reset(arena);
+        free(arena->first);
+        free(arena);
+    }
+}
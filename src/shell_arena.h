@@ -0,0 +1,46 @@
+#ifndef SHELL_ARENA_HEADER_FILE
+#define SHELL_ARENA_HEADER_FILE 1
+
+#include <stddef.h>
+
+// Every allocation is aligned to this many bytes
+#define SH_ARENA_ALIGN (sizeof(void*))
+
+// Smallest block the arena will allocate when it runs out of room
+#define SH_ARENA_MIN_BLOCK (1 << 12)
+
+struct shell_arena_block
+{
+    struct shell_arena_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+// A bump allocator that everything parsed from a single line is allocated in,
+// so that all of it can be freed at once
+struct shell_arena
+{
+    struct shell_arena_block* first;
+    struct shell_arena_block* current;
+};
+
+// Create an arena with room for at least size bytes
+struct shell_arena* shell_arena_create(size_t size);
+
+// Allocate size bytes from the arena, this never fails
+void* shell_arena_alloc(struct shell_arena*, size_t size);
+
+// Copy a string of size characters into the arena, and null terminate it
+char* shell_arena_strndup(struct shell_arena*, const char* str, size_t size);
+
+// Return the number of bytes the first block of the arena can hold
+size_t shell_arena_capacity(struct shell_arena*);
+
+// Free every allocation at once, keeping the first block to be reused
+void shell_arena_reset(struct shell_arena*);
+
+// Free the arena and every block in it
+void shell_arena_free(struct shell_arena*);
+
+#endif
@@ -0,0 +1,812 @@
+#define _GNU_SOURCE
+#include "shell_builtin.h"
+#include "shell_job.h"
+#include "shell_hash.h"
+
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern char** environ;
+
+/**
+ * @brief write everything that a builtin printed into a memory stream, with a single write
+ *
+ * @param stream the stream the output was printed into
+ * @param buffer the buffer of the stream
+ * @param size the size of the buffer
+ * @param out the file descriptor to write to
+ * @return 0 on success, 1 if the output couldn't be written
+ */
+static int shell_builtin_flush(FILE* stream, char** buffer, size_t* size, int out)
+{
+    size_t written = 0;
+    ssize_t step;
+
+    fclose(stream);
+
+    while(written < *size)
+    {
+        step = write(out, *buffer + written, *size - written);
+        if(step < 0 && errno == EINTR) continue;
+        if(step <= 0) break;
+
+        written += step;
+    }
+
+    free(*buffer);
+    return written < *size;
+}
+
+/**
+ * @brief print an argument of echo -e, replacing its backslash escapes
+ *
+ * @param stream the stream to print into
+ * @param text the argument to print
+ * @return SH_TRUE if the argument had a \c, after which echo prints nothing else
+ */
+static int shell_builtin_echo_escapes(FILE* stream, const char* text)
+{
+    const char* c;
+    int value, digits;
+
+    for(c = text; *c; ++c)
+    {
+        if(*c != '\\' || c[1] == '\0')
+        {
+            fputc(*c, stream);
+            continue;
+        }
+
+        switch(*++c)
+        {
+            case 'a': fputc('\a', stream); break;
+            case 'b': fputc('\b', stream); break;
+            case 'c': return SH_TRUE;
+            case 'e': fputc('\033', stream); break;
+            case 'f': fputc('\f', stream); break;
+            case 'n': fputc('\n', stream); break;
+            case 'r': fputc('\r', stream); break;
+            case 't': fputc('\t', stream); break;
+            case 'v': fputc('\v', stream); break;
+            case '\\': fputc('\\', stream); break;
+
+            // \0nnn is up to 3 octal digits, \xHH up to 2 hex digits
+            case '0':
+                for(value = 0, digits = 0; digits < 3 && c[1] >= '0' && c[1] <= '7'; ++digits) value = 8 * value + (*++c - '0');
+                fputc(value, stream);
+                break;
+
+            case 'x':
+                for(value = 0, digits = 0; digits < 2 && isxdigit((unsigned char)c[1]); ++digits)
+                {
+                    ++c;
+                    value = 16 * value + (isdigit((unsigned char)*c) ? *c - '0' : tolower((unsigned char)*c) - 'a' + 10);
+                }
+
+                if(digits) fputc(value, stream);
+                else fputs("\\x", stream);
+                break;
+
+            // Anything else is printed as it is, backslash and all
+            default:
+                fputc('\\', stream);
+                fputc(*c, stream);
+                break;
+        }
+    }
+
+    return SH_FALSE;
+}
+
+/**
+ * @brief print the arguments separated by spaces, with a newline
+ *
+ * the leading arguments made up of only -n, -e and -E are options, the same as in bash:
+ * -n leaves out the newline, -e replaces backslash escapes and -E doesn't (the default).
+ */
+static int shell_builtin_echo(struct shell_command* command, int out, int err)
+{
+    FILE* stream;
+    char* buffer;
+    size_t size;
+    const char* option;
+    int i, newline = SH_TRUE, escapes = SH_FALSE;
+
+    for(i = 1; i < command->argc; ++i)
+    {
+        option = command->argv[i];
+        if(option[0] != '-' || option[1] == '\0' || option[1 + strspn(option + 1, "neE")] != '\0') break;
+
+        for(++option; *option; ++option)
+        {
+            if(*option == 'n') newline = SH_FALSE;
+            else escapes = *option == 'e';
+        }
+    }
+
+    stream = open_memstream(&buffer, &size);
+    if(stream == NULL) return 1;
+
+    for(; i < command->argc; ++i)
+    {
+        if(!escapes) fputs(command->argv[i], stream);
+        else if(shell_builtin_echo_escapes(stream, command->argv[i]))
+        {
+            newline = SH_FALSE;
+            break;
+        }
+
+        if(i < command->argc - 1) fputc(' ', stream);
+    }
+    if(newline) fputc('\n', stream);
+
+    return shell_builtin_flush(stream, &buffer, &size, out);
+}
+
+/**
+ * @brief print the current directory
+ */
+static int shell_builtin_pwd(struct shell_command* command, int out, int err)
+{
+    char cwd[SH_CWD_SIZE];
+
+    if(getcwd(cwd, SH_CWD_SIZE) == NULL)
+    {
+        dprintf(err, SH_PROGRAM_NAME ": pwd: %s [%d]\n", strerror(errno), errno);
+        return 1;
+    }
+
+    return dprintf(out, "%s\n", cwd) < 0;
+}
+
+static int shell_builtin_true(struct shell_command* command, int out, int err)
+{ return 0; }
+
+static int shell_builtin_false(struct shell_command* command, int out, int err)
+{ return 1; }
+
+/**
+ * @brief print one conversion of a printf format
+ *
+ * the conversion is copied into its own format, with its flags, width and precision,
+ * and the argument is converted to the type that it asks for.
+ *
+ * @param stream the stream to print to
+ * @param spec the conversion, starting at the '%'
+ * @param length the length of the conversion, ending with the conversion character
+ * @param argument the argument to print, or NULL if there are none left
+ * @return 0 on success, -1 if the conversion character isn't known
+ */
+static int shell_builtin_printf_spec(FILE* stream, const char* spec, int length, const char* argument)
+{
+    char format[64];
+    char conversion = spec[length - 1];
+
+    if(length + 2 > (int)sizeof(format)) return -1;
+
+    switch(conversion)
+    {
+        case 'd': case 'i':
+            snprintf(format, sizeof(format), "%.*slld", length - 1, spec);
+            fprintf(stream, format, argument ? strtoll(argument, NULL, 0) : 0LL);
+            return 0;
+
+        case 'u': case 'o': case 'x': case 'X':
+            snprintf(format, sizeof(format), "%.*sll%c", length - 1, spec, conversion);
+            fprintf(stream, format, argument ? strtoull(argument, NULL, 0) : 0ULL);
+            return 0;
+
+        case 'f': case 'e': case 'g': case 'E': case 'G':
+            snprintf(format, sizeof(format), "%.*s", length, spec);
+            fprintf(stream, format, argument ? strtod(argument, NULL) : 0.0);
+            return 0;
+
+        case 'c':
+            if(argument && *argument) fputc(*argument, stream);
+            return 0;
+
+        case 's':
+            snprintf(format, sizeof(format), "%.*s", length, spec);
+            fprintf(stream, format, argument ? argument : "");
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief print the arguments with a format, the same way printf(1) does
+ *
+ * the format is used again for as long as there are arguments left,
+ * and conversions without an argument print 0 or nothing.
+ * the escapes in the format that the lexer didn't already replace are handled here.
+ */
+static int shell_builtin_printf(struct shell_command* command, int out, int err)
+{
+    const char *format, *c;
+    FILE* stream;
+    char* buffer;
+    size_t size;
+    int argument = 2, used, length;
+
+    if(command->argc < 2)
+    {
+        dprintf(err, SH_PROGRAM_NAME ": printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    stream = open_memstream(&buffer, &size);
+    if(stream == NULL) return 1;
+
+    format = command->argv[1];
+
+    do
+    {
+        used = SH_FALSE;
+
+        for(c = format; *c; ++c)
+        {
+            if(*c == '\\' && c[1])
+            {
+                ++c;
+                switch(*c)
+                {
+                    case 'n': fputc('\n', stream); break;
+                    case 't': fputc('\t', stream); break;
+                    case 'r': fputc('\r', stream); break;
+                    case 'a': fputc('\a', stream); break;
+                    case 'b': fputc('\b', stream); break;
+                    case 'f': fputc('\f', stream); break;
+                    case 'v': fputc('\v', stream); break;
+                    default: fputc(*c, stream); break;
+                }
+                continue;
+            }
+
+            if(*c != '%')
+            {
+                fputc(*c, stream);
+                continue;
+            }
+
+            if(c[1] == '%')
+            {
+                fputc('%', stream);
+                ++c;
+                continue;
+            }
+
+            // Flags, width and precision, and then the conversion character
+            length = 1 + strspn(c + 1, "-+ #0");
+            length += strspn(c + length, "0123456789");
+            if(c[length] == '.') length += 1 + strspn(c + length + 1, "0123456789");
+
+            if(c[length] == '\0' || shell_builtin_printf_spec(stream, c, length + 1, argument < command->argc ? command->argv[argument] : NULL) < 0)
+            {
+                fclose(stream);
+                free(buffer);
+                dprintf(err, SH_PROGRAM_NAME ": printf: %.*s: invalid conversion\n", length + 1, c);
+                return 1;
+            }
+
+            if(argument < command->argc) ++argument;
+            used = SH_TRUE;
+            c += length;
+        }
+    }
+    while(used && argument < command->argc);
+
+    return shell_builtin_flush(stream, &buffer, &size, out);
+}
+
+/**
+ * @brief check a unary test, like -f path or -z string
+ *
+ * @return 0 if it is true, 1 if it is false, 2 if the operator isn't known
+ */
+static int shell_builtin_test_unary(const char* op, const char* operand, int err)
+{
+    struct stat info;
+
+    if(strcmp(op, "-n") == 0) return *operand == '\0';
+    if(strcmp(op, "-z") == 0) return *operand != '\0';
+
+    if(op[0] != '-' || op[1] == '\0' || op[2] != '\0' || !strchr("efdrwxsLh", op[1]))
+    {
+        dprintf(err, SH_PROGRAM_NAME ": test: %s: unary operator expected\n", op);
+        return 2;
+    }
+
+    switch(op[1])
+    {
+        case 'r': return access(operand, R_OK) != 0;
+        case 'w': return access(operand, W_OK) != 0;
+        case 'x': return access(operand, X_OK) != 0;
+        case 'L': case 'h': return lstat(operand, &info) != 0 || !S_ISLNK(info.st_mode);
+    }
+
+    if(stat(operand, &info) != 0) return 1;
+
+    switch(op[1])
+    {
+        case 'f': return !S_ISREG(info.st_mode);
+        case 'd': return !S_ISDIR(info.st_mode);
+        case 's': return info.st_size == 0;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief check if an argument of test is one of the binary operators
+ */
+static int shell_builtin_test_is_binary(const char* op)
+{
+    static const char* binary[] = { "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+    int i;
+
+    for(i = 0; i < 9; ++i)
+        if(strcmp(op, binary[i]) == 0) return SH_TRUE;
+
+    return SH_FALSE;
+}
+
+/**
+ * @brief check a binary test, like a = b or 1 -lt 2
+ *
+ * @return 0 if it is true, 1 if it is false, 2 if the operator isn't known
+ */
+static int shell_builtin_test_binary(const char* left, const char* op, const char* right, int err)
+{
+    static const char* numeric[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+    long long a, b;
+    int i;
+
+    if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(left, right) != 0;
+    if(strcmp(op, "!=") == 0) return strcmp(left, right) == 0;
+
+    for(i = 0; i < 6 && strcmp(op, numeric[i]) != 0; ++i);
+
+    if(i == 6)
+    {
+        dprintf(err, SH_PROGRAM_NAME ": test: %s: binary operator expected\n", op);
+        return 2;
+    }
+
+    a = strtoll(left, NULL, 10);
+    b = strtoll(right, NULL, 10);
+
+    switch(i)
+    {
+        case 0: return !(a == b);
+        case 1: return !(a != b);
+        case 2: return !(a < b);
+        case 3: return !(a <= b);
+        case 4: return !(a > b);
+        default: return !(a >= b);
+    }
+}
+
+/**
+ * @brief check an expression of test, by how many arguments it has, the same way POSIX does
+ *
+ * @param argv the arguments of the expression
+ * @param argc the number of arguments
+ * @param err the file descriptor to print errors to
+ * @return 0 if it is true, 1 if it is false, 2 on error
+ */
+static int shell_builtin_test_expression(char** argv, int argc, int err)
+{
+    int status;
+
+    switch(argc)
+    {
+        case 0: return 1;
+        case 1: return argv[0][0] == '\0';
+        case 2:
+            if(strcmp(argv[0], "!") == 0) return argv[1][0] != '\0';
+            return shell_builtin_test_unary(argv[0], argv[1], err);
+        case 3:
+            // A binary operator comes first, so ! = x compares "!" with "x"
+            if(shell_builtin_test_is_binary(argv[1])) return shell_builtin_test_binary(argv[0], argv[1], argv[2], err);
+            if(strcmp(argv[0], "!") == 0)
+            {
+                status = shell_builtin_test_expression(argv + 1, 2, err);
+                return status == 2 ? 2 : !status;
+            }
+            return shell_builtin_test_binary(argv[0], argv[1], argv[2], err);
+        case 4:
+            if(strcmp(argv[0], "!") == 0)
+            {
+                status = shell_builtin_test_expression(argv + 1, 3, err);
+                return status == 2 ? 2 : !status;
+            }
+            break;
+    }
+
+    dprintf(err, SH_PROGRAM_NAME ": test: too many arguments\n");
+    return 2;
+}
+
+/**
+ * @brief check a condition, as test or [
+ */
+static int shell_builtin_test(struct shell_command* command, int out, int err)
+{
+    int argc = command->argc - 1;
+
+    if(strcmp(command->argv[0], "[") == 0)
+    {
+        if(argc == 0 || strcmp(command->argv[argc], "]") != 0)
+        {
+            dprintf(err, SH_PROGRAM_NAME ": [: missing ]\n");
+            return 2;
+        }
+        --argc;
+    }
+
+    return shell_builtin_test_expression(command->argv + 1, argc, err);
+}
+
+/**
+ * @brief set environment variables, which every command started after it gets
+ *
+ * NAME=value sets NAME, and a NAME on its own is already exported if it is set at all,
+ * as the shell has no variables of its own. without arguments, the environment is printed.
+ */
+static int shell_builtin_export(struct shell_command* command, int out, int err)
+{
+    const char* value;
+    char* name;
+    FILE* stream;
+    char* buffer;
+    size_t size;
+    int i, status = 0;
+
+    if(command->argc == 1)
+    {
+        stream = open_memstream(&buffer, &size);
+        if(stream == NULL) return 1;
+
+        for(i = 0; environ[i]; ++i)
+        {
+            value = strchr(environ[i], '=');
+            if(value) fprintf(stream, "export %.*s=\"%s\"\n", (int)(value - environ[i]), environ[i], value + 1);
+        }
+
+        return shell_builtin_flush(stream, &buffer, &size, out);
+    }
+
+    for(i = 1; i < command->argc; ++i)
+    {
+        value = strchr(command->argv[i], '=');
+        if(value == NULL) continue;
+
+        name = strndup(command->argv[i], value - command->argv[i]);
+
+        if(name == NULL || *name == '\0' || setenv(name, value + 1, 1) < 0)
+        {
+            dprintf(err, SH_PROGRAM_NAME ": export: %s: not a valid identifier\n", command->argv[i]);
+            status = 1;
+        }
+
+        free(name);
+    }
+
+    return status;
+}
+
+/**
+ * @brief wait for the total of every argument, in seconds, with an optional s / m / h / d suffix
+ */
+static int shell_builtin_sleep(struct shell_command* command, int out, int err)
+{
+    struct timespec left;
+    double seconds = 0, value;
+    char* end;
+    int i;
+
+    if(command->argc < 2)
+    {
+        dprintf(err, SH_PROGRAM_NAME ": sleep: missing operand\n");
+        return 1;
+    }
+
+    for(i = 1; i < command->argc; ++i)
+    {
+        value = strtod(command->argv[i], &end);
+
+        if(end == command->argv[i] || value < 0 || (*end && (end[1] || !strchr("smhd", *end))))
+        {
+            dprintf(err, SH_PROGRAM_NAME ": sleep: invalid time interval '%s'\n", command->argv[i]);
+            return 1;
+        }
+
+        if(*end == 'm') value *= 60;
+        else if(*end == 'h') value *= 60 * 60;
+        else if(*end == 'd') value *= 24 * 60 * 60;
+
+        seconds += value;
+    }
+
+    left.tv_sec = (time_t)seconds;
+    left.tv_nsec = (long)((seconds - left.tv_sec) * 1e9);
+
+    while(nanosleep(&left, &left) < 0 && errno == EINTR);
+
+    return 0;
+}
+
+/**
+ * @brief list the jobs running in the background, and the ones that finished since the last prompt
+ */
+static int shell_builtin_jobs(struct shell_command* command, int out, int err)
+{
+    shell_job_print(out);
+    return 0;
+}
+
+/**
+ * @brief wait for the jobs given as %n or pids, or for every job without arguments
+ *
+ * @return the exit status of the last job waited on, or 127 if it doesn't exist
+ */
+static int shell_builtin_wait(struct shell_command* command, int out, int err)
+{
+    int i, id, status = 0;
+
+    if(command->argc == 1)
+    {
+        while((id = shell_job_last())) shell_job_wait(id);
+        return 0;
+    }
+
+    for(i = 1; i < command->argc; ++i)
+    {
+        id = shell_job_find(command->argv[i]);
+
+        if(id) status = shell_job_wait(id);
+        else
+        {
+            dprintf(err, SH_PROGRAM_NAME ": wait: %s: no such job\n", command->argv[i]);
+            status = 127;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * @brief bring a job to the foreground, which is the last job started unless one is given,
+ * and wait for it. the shell has no terminal to hand over, so this is wait that prints the job.
+ */
+static int shell_builtin_fg(struct shell_command* command, int out, int err)
+{
+    int id = command->argc > 1 ? shell_job_find(command->argv[1]) : shell_job_last();
+
+    if(id == 0)
+    {
+        dprintf(err, SH_PROGRAM_NAME ": fg: %s: no such job\n", command->argc > 1 ? command->argv[1] : "current");
+        return 1;
+    }
+
+    dprintf(out, "%s\n", shell_job_command(id));
+    return shell_job_wait(id);
+}
+
+/**
+ * @brief change the directory of the shell, where a leading '~' is the home directory
+ *
+ * in a pipeline or in the background this runs in a forked child,
+ * so like in a subshell it only changes the directory of that child.
+ */
+static int shell_builtin_cd(struct shell_command* command, int out, int err)
+{
+    char dir[2 * SH_CWD_SIZE + 2];
+
+    if(command->argc != 2)
+    {
+        dprintf(err, SH_PROGRAM_NAME ": cd: 1 argument required, %d given\n", command->argc - 1);
+        return 1;
+    }
+
+    if(strlen(command->argv[1]) >= SH_CWD_SIZE)
+    {
+        dprintf(err, SH_PROGRAM_NAME ": cd: length of given directory is too long [SH_CWD_SIZE=%d]\n", SH_CWD_SIZE);
+        return 1;
+    }
+
+    if(command->argv[1][0] == '~') sprintf(dir, "%.*s%.*s", SH_CWD_SIZE, shell_get_home(), SH_CWD_SIZE, command->argv[1] + 1);
+    else sprintf(dir, "%.*s", SH_CWD_SIZE, command->argv[1]);
+
+    if(chdir(dir) < 0)
+    {
+        dprintf(err, SH_PROGRAM_NAME ": cd: %s [%d]\n", strerror(errno), errno);
+        return 1;
+    }
+
+    // The prompt has a new directory
+    shell_prompt_update();
+    return 0;
+}
+
+/**
+ * @brief show the cache of paths to commands, clear it with -r, or look up every command given
+ */
+static int shell_builtin_hash(struct shell_command* command, int out, int err)
+{
+    FILE* stream;
+    char* buffer;
+    size_t size;
+    int i, status = 0;
+
+    if(command->argc == 1)
+    {
+        stream = open_memstream(&buffer, &size);
+        if(stream == NULL) return 1;
+
+        shell_path_print(stream);
+        return shell_builtin_flush(stream, &buffer, &size, out);
+    }
+
+    if(strcmp(command->argv[1], "-r") == 0)
+    {
+        shell_path_clear();
+        return 0;
+    }
+
+    for(i = 1; i < command->argc; ++i)
+    {
+        if(shell_path_lookup(command->argv[i]) == NULL)
+        {
+            dprintf(err, SH_PROGRAM_NAME ": hash: %s: not found\n", command->argv[i]);
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * @brief close the shell, or only the forked child it runs in inside of a pipeline or the background
+ */
+static int shell_builtin_exit(struct shell_command* command, int out, int err)
+{
+    close(SH_STDIN);
+    close(SH_STDOUT);
+    close(SH_STDERR);
+    exit(0);
+}
+
+/**
+ * @brief copy the JSON snapshot of the server from its stats socket into a stream
+ *
+ * @param stream where the snapshot is printed
+ * @param path the path of the stats socket
+ * @return SH_TRUE if the whole snapshot was copied
+ */
+static int shell_builtin_stats_server(FILE* stream, const char* path)
+{
+    struct timeval timeout = { SH_STATS_TIMEOUT_MS / 1000, SH_STATS_TIMEOUT_MS % 1000 * 1000 };
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    char buffer[1 << 12];
+    ssize_t size;
+    int fd, copied = SH_FALSE;
+
+    if(strlen(path) >= sizeof(address.sun_path)) return SH_FALSE;
+    strcpy(address.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return SH_FALSE;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if(connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0)
+    {
+        while((size = read(fd, buffer, sizeof(buffer))) > 0 || (size < 0 && errno == EINTR))
+        {
+            if(size > 0) fwrite(buffer, 1, size, stream);
+            copied = SH_TRUE;
+        }
+
+        if(size < 0) copied = SH_FALSE;
+    }
+
+    close(fd);
+    return copied;
+}
+
+/**
+ * @brief print the counters of the shell as JSON, with the snapshot of the server that runs it
+ *
+ * the server puts the path of its stats socket in $MULTI_SHELL_STATS.
+ * "server" is null when the shell runs on its own, or the server doesn't answer in time.
+ */
+static int shell_builtin_stats(struct shell_command* command, int out, int err)
+{
+    const char* path = getenv(SH_STATS_ENV);
+    FILE* stream;
+    char* buffer;
+    size_t size;
+    long length;
+
+    stream = open_memstream(&buffer, &size);
+    if(stream == NULL) return 1;
+
+    fprintf(stream, "{\"shell\": {\"pid\": %d, \"commands\": %lld, \"builtins\": %lld, \"jobs\": %lld, "
+        "\"fork_failures\": %lld, \"exec_failures\": %lld, \"waitpid_us\": %lld},\n \"server\": ",
+        getpid(), shell_stats.commands, shell_stats.builtins, shell_stats.jobs,
+        shell_stats.fork_failures, shell_stats.exec_failures, shell_stats.waitpid_ns / 1000);
+
+    // A snapshot that was cut off is dropped, so the output is always valid JSON
+    length = ftell(stream);
+    if(path == NULL || !shell_builtin_stats_server(stream, path))
+    {
+        fseek(stream, length, SEEK_SET);
+        fprintf(stream, "null\n");
+    }
+
+    fprintf(stream, "}\n");
+    return shell_builtin_flush(stream, &buffer, &size, out);
+}
+
+// Every builtin, which are hashed into builtin_table the first time one is looked up
+static const struct shell_builtin builtins[] =
+{
+    { "echo",   shell_builtin_echo,   SH_TRUE  },
+    { "pwd",    shell_builtin_pwd,    SH_TRUE  },
+    { "true",   shell_builtin_true,   SH_TRUE  },
+    { "false",  shell_builtin_false,  SH_TRUE  },
+    { "printf", shell_builtin_printf, SH_TRUE  },
+    { "test",   shell_builtin_test,   SH_TRUE  },
+    { "[",      shell_builtin_test,   SH_TRUE  },
+    { "export", shell_builtin_export, SH_FALSE },
+    { "sleep",  shell_builtin_sleep,  SH_TRUE  },
+    { "jobs",   shell_builtin_jobs,   SH_FALSE },
+    { "wait",   shell_builtin_wait,   SH_FALSE },
+    { "fg",     shell_builtin_fg,     SH_FALSE },
+    { "stats",  shell_builtin_stats,  SH_TRUE  },
+    { "cd",     shell_builtin_cd,     SH_FALSE },
+    { "hash",   shell_builtin_hash,   SH_FALSE },
+    { "exit",   shell_builtin_exit,   SH_FALSE },
+    { "quit",   shell_builtin_exit,   SH_FALSE },
+};
+
+static const struct shell_builtin* builtin_table[SH_BUILTIN_TABLE_SIZE];
+
+/**
+ * @brief find the builtin with a name
+ *
+ * the builtins are hashed into a table with linear probing the first time this is called,
+ * which is big enough that probing almost never goes past the first slot.
+ *
+ * @param name the name of the command
+ * @return the builtin, or NULL if the command isn't a builtin
+ */
+const struct shell_builtin* shell_builtin_find(const char* name)
+{
+    static int filled = SH_FALSE;
+    const struct shell_builtin* builtin;
+    unsigned long slot;
+    size_t i;
+
+    if(!filled)
+    {
+        for(i = 0; i < sizeof(builtins) / sizeof(*builtins); ++i)
+        {
+            for(slot = shell_hash_string(builtins[i].name); builtin_table[slot & (SH_BUILTIN_TABLE_SIZE - 1)]; ++slot);
+            builtin_table[slot & (SH_BUILTIN_TABLE_SIZE - 1)] = &builtins[i];
+        }
+
+        filled = SH_TRUE;
+    }
+
+    for(slot = shell_hash_string(name);; ++slot)
+    {
+        builtin = builtin_table[slot & (SH_BUILTIN_TABLE_SIZE - 1)];
+        if(builtin == NULL || strcmp(builtin->name, name) == 0) return builtin;
+    }
+}
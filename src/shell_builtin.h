@@ -0,0 +1,26 @@
+#ifndef SHELL_BUILTIN_HEADER_FILE
+#define SHELL_BUILTIN_HEADER_FILE 1
+
+#include "shell_command.h"
+
+// Number of slots in the table of builtins, this must be a power of 2
+#define SH_BUILTIN_TABLE_SIZE (1 << 6)
+
+// A command that runs inside of the shell, instead of being started as a process
+struct shell_builtin
+{
+    const char* name;
+
+    // Runs the command, writing its output to out and its errors to err,
+    // and returns its exit status. builtins never read stdin.
+    int (*run)(struct shell_command*, int out, int err);
+
+    // SH_TRUE if the builtin doesn't change the shell, so it can run inside of it
+    // as the last stage of a pipeline, where it can't block the other stages
+    int pure;
+};
+
+// Find the builtin with a name, or NULL if the command isn't a builtin
+const struct shell_builtin* shell_builtin_find(const char* name);
+
+#endif
@@ -1,350 +1,331 @@
 #include "shell_command.h"
+#include "shell_hash.h"
 
-/**
- * @brief remove the first character from a string
- * 
- * @param str string to remove character from
- */
-static void remove_char(char* str)
-{ while(str && (str[0] = str[1])) ++str; }
+// Arenas bigger than this are freed instead of being kept for the next line
+#define SH_ARENA_KEEP_LIMIT (1 << 20)
 
-/**
- * @brief remove the first string from a list of strings
- * 
- * this function does not free the string, 
- * this must be done before hand
- * 
- * @param word list of strings to remove string from
- */
-static void remove_word(char** word)
-{ while(word && (word[0] = word[1])) ++word; }
+// Number of parsed lines that are kept around to be run again
+#define SH_PARSE_CACHE_SIZE (1 << 6)
+
+// Lines longer than this are never cached, so the cache stays small
+#define SH_PARSE_CACHE_MAX_LINE (1 << 12)
+
+// Arena of the last line that was freed, which is reused by the next line
+static struct shell_arena* spare_arena = NULL;
+
+// Parsed lines, indexed by the hash of their text
+static struct shell_line* parse_cache[SH_PARSE_CACHE_SIZE];
+
+// SH_FALSE if every line is parsed again, see shell_set_parse_cache(...)
+static int parse_cache_enabled = SH_TRUE;
 
 /**
  * @brief add an argument to the list of arguments in a shell_command
- * 
- * the argument that you are adding to the command is represented by
- * a beginning and end pointer.
- * 
- * this function allocates the argument on the heap, so it is important
- * to free the strings after you are done with executing the command
- * 
+ *
+ * the argument already lives in the arena of the command, where the lexer put it,
+ * so only the pointer is stored.
+ * there is no limit on the number of arguments, argv is doubled in size when it is full.
+ *
+ * @param arena the arena the command is allocated in
  * @param command the command to add the arguments to
- * @param begin the beginning character of the argument to add
- * @param end the ending character of the argument to add
+ * @param argument the null terminated argument to add
  */
-static void shell_command_add_argument(struct shell_command* command, char* begin, char* end)
+static void shell_command_add_argument(struct shell_arena* arena, struct shell_command* command, char* argument)
 {
-    int size;
-    char* buf;
-
-    // See how long buffer is
-    size = end - begin;
-    
-    // Get rid of empty space
-    if(size != 0) 
-    {    
-        if(command->argc < SH_MAX_ARGS)
-        {
-            // Copy buffer into command
-            buf = calloc(size + 1, sizeof(char));
-            strncpy(buf, begin, size);
-            command->argv[command->argc++] = buf;
-        }
-        else fprintf(stderr, SH_PROGRAM_NAME ": warning: too many arguments, ignoring \"%.*s\" [MAX_ARGS=%d]\n", size, begin, SH_MAX_ARGS);
+    char** argv;
+
+    // Make room for the argument and the NULL after it
+    if(command->argc + 1 >= command->argv_capacity)
+    {
+        argv = shell_arena_alloc(arena, 2 * command->argv_capacity * sizeof(char*));
+        memcpy(argv, command->argv, command->argc * sizeof(char*));
+
+        command->argv = argv;
+        command->argv_capacity *= 2;
     }
+
+    command->argv[command->argc++] = argument;
+    command->argv[command->argc] = NULL;
 }
 
 /**
- * @brief parse a shell_command from a string
- * 
- * this function parses a string into a shell_command and looks
- * for a couple of things, these things are:
- * 
- *  1) ' & " - to ignore special characters between quotes
- *  2) ' ' - to separate arguments
- *  3) '\n' & ';' - to separate commands
- *  4) '|' - to pipe commands
- *  5) '>', '>>', '<' - allow redirection without spaces surrounding the redirects
- *  6) '\' - allow escape characters
- * 
- * @param begin the first character of the string you want to parse
- * @return the parsed shell_command
+ * @brief add a redirect to the end of the redirects of a shell_command
+ *
+ * @param arena the arena the command is allocated in
+ * @param last the next pointer of the last redirect of the command
+ * @param type the type of the redirect token
+ * @param path the file to redirect to / from
+ * @return the next pointer of the new redirect
  */
-struct shell_command* shell_command_create(char *begin)
+static struct shell_redirect** shell_command_add_redirect(struct shell_arena* arena, struct shell_redirect** last, int type, char* path)
 {
-    char quote = '\0';
-    char *end, *buf;
-    int pipe_status, fds[2];
+    struct shell_redirect* redirect = shell_arena_alloc(arena, sizeof(struct shell_redirect));
 
-    struct shell_command* command = calloc(1, sizeof(struct shell_command));
+    redirect->type = type;
+    redirect->path = path;
+    redirect->next = NULL;
 
-    if(command == NULL)
-    {
-        fprintf(stderr, SH_PROGRAM_NAME ": fatal error: unable to allocate memory. exiting...\n");
-        exit(-1);
-    }
+    *last = redirect;
+    return &redirect->next;
+}
+
+/**
+ * @brief allocate an empty shell_command
+ *
+ * @param arena the arena to allocate the command in
+ * @return the new command
+ */
+static struct shell_command* shell_command_alloc(struct shell_arena* arena)
+{
+    struct shell_command* command = shell_arena_alloc(arena, sizeof(struct shell_command));
 
     command->argc = 0;
+    command->argv_capacity = SH_INITIAL_ARGS;
+    command->argv = shell_arena_alloc(arena, SH_INITIAL_ARGS * sizeof(char*));
+    command->argv[0] = NULL;
+    command->redirects = NULL;
     command->next_command = NULL;
 
-    command->redir_stdin = SH_STDIN;
-    command->redir_stdout = SH_STDOUT;
-    command->redir_stderr = SH_STDERR;
+    return command;
+}
+
+/**
+ * @brief give up on parsing a line, and keep why instead of its pipelines
+ *
+ * @param line the line that has a syntax error
+ * @param error the error, which has to live as long as the line
+ */
+static void shell_line_error(struct shell_line* line, const char* error)
+{
+    line->error = error;
+    line->pipelines = NULL;
+}
 
-    // Read input until the end of the command
-    for(end = begin;; ++end)
+/**
+ * @brief parse the tokens of a line into a shell_line
+ *
+ * the lexer has already dealt with quotes and escapes,
+ * so this only has to put the tokens together in a single loop:
+ *
+ *  1) words - are added to the arguments of the current command
+ *  2) '|' - starts a new command in the current pipeline
+ *  3) ';' & '\n' - start a new pipeline, '&' does too and marks the last one to run in the background
+ *  4) '&&' & '||' - start a new pipeline that only runs if the last one succeeded / failed
+ *  5) '>', '>>', '<' - are followed by the word to redirect to / from
+ *
+ * nothing is opened or created here, that is left to whoever runs the line.
+ * pipelines that are just an empty command (like the one after a trailing ';') are left out.
+ * a line with a syntax error keeps none of its pipelines, only the error,
+ * so it is never half run, and the error is there again if the line comes out of the cache.
+ *
+ * @param line the line to add the pipelines to
+ * @param lexer the lexer to read tokens from
+ */
+static void shell_line_parse(struct shell_line* line, struct shell_lexer* lexer)
+{
+    struct shell_arena* arena = line->arena;
+    struct shell_pipeline **last_pipeline = &line->pipelines, *pipeline = NULL;
+    struct shell_command* command = NULL;
+    struct shell_redirect** last_redirect = NULL;
+    struct shell_token token, path;
+    int more, empty, condition = 0;
+    const char* error;
+    char* message;
+
+    line->pipelines = NULL;
+    line->error = NULL;
+
+    more = shell_lexer_next(lexer, &token);
+    while(more || pipeline)
     {
-        // If you are in quote mode, follow special rules
-        if(quote)
+        // Start a new pipeline if the last one ended
+        if(pipeline == NULL)
         {
-            // If you reach the end of the quote, 
-            // then add it to the arguments
-            if(*end == quote)
-            {
-                shell_command_add_argument(command, begin, end);
-                begin = end + 1;
-                quote = '\0';
-            }
-
-            // If there is a backslash, escape it
-            else if(*end == '\\')
-            {
-                switch(end[1])
-                {
-                    // Escape codes built into the commands
-                    case 'a': end[1] = '\a'; remove_char(end); break;
-                    case 'b': end[1] = '\b'; remove_char(end); break;
-                    case 'f': end[1] = '\f'; remove_char(end); break;
-                    case 'n': end[1] = '\n'; remove_char(end); break;
-                    case 'r': end[1] = '\r'; remove_char(end); break;
-                    case 't': end[1] = '\t'; remove_char(end); break;
-                    case 'v': end[1] = '\v'; remove_char(end); break;
-                    default: remove_char(end); break;
-                }
-            }
-
-            // If your reach a null pointer, 
-            // just add everything before it
-            else if(*end == '\0')
-            {
-                shell_command_add_argument(command, begin, end);
-                return command;
-            }
+            pipeline = shell_arena_alloc(arena, sizeof(struct shell_pipeline));
+            pipeline->commands = command = shell_command_alloc(arena);
+            pipeline->length = 1;
+            pipeline->background = SH_FALSE;
+            pipeline->condition = condition;
+            pipeline->next_pipeline = NULL;
+
+            last_redirect = &command->redirects;
         }
-        
-        // There is no quote, so handle it normally
-        else switch(*end)
+
+        switch(token.type)
         {
-            // If there is a space, just add argument to arguments
-            case ' ':
-                shell_command_add_argument(command, begin, end);
-                begin = end + 1;
+            case SH_TOKEN_WORD:
+                shell_command_add_argument(arena, command, token.text);
                 break;
 
-            // Delimiters and Command Ends split up commands 
-            case ';': case '\n':
-                shell_command_add_argument(command, begin, end);
-                command->next_command = shell_command_create(end + 1);
-                return command;
-
-            case '|':
-                shell_command_add_argument(command, begin, end);
-                command->next_command = shell_command_create(end + 1);
+            case SH_TOKEN_PIPE:
+                command = command->next_command = shell_command_alloc(arena);
+                last_redirect = &command->redirects;
+                ++pipeline->length;
+                break;
 
-                if(command->next_command != NULL)
+            // Delimiters and Command Ends split up pipelines
+            case SH_TOKEN_BACKGROUND: case SH_TOKEN_SEPARATOR: case SH_TOKEN_END:
+            case SH_TOKEN_AND: case SH_TOKEN_OR:
+                pipeline->background = token.type == SH_TOKEN_BACKGROUND;
+                empty = pipeline->length == 1 && command->argc == 0 && command->redirects == NULL;
+
+                // && and || need a command on both sides, and only the last pipeline would end up in the background
+                error = NULL;
+                if(empty && (token.type == SH_TOKEN_AND || token.type == SH_TOKEN_OR))
+                    error = token.type == SH_TOKEN_AND ? "syntax error: missing command before '&&'" : "syntax error: missing command before '||'";
+                else if(empty && pipeline->condition)
+                    error = pipeline->condition == SH_TOKEN_AND ? "syntax error: missing command after '&&'" : "syntax error: missing command after '||'";
+                else if(pipeline->background && pipeline->condition)
+                    error = "unable to run commands joined with '&&' or '||' in the background";
+
+                if(error)
                 {
-                    pipe_status = pipe(fds);
-
-                    if(pipe_status < 0) 
-                    {
-                        fprintf(stderr, SH_PROGRAM_NAME ": error: unable to pipe %s to %s: %s [%d]\n", command->argv[0], command->next_command->argv[0], strerror(errno), errno);
-                    }
-                    else
-                    {
-                        command->redir_stdout = fds[1];
-                        command->next_command->redir_stdin = fds[0];
-                    }
+                    shell_line_error(line, error);
+                    return;
                 }
-                else
+
+                if(!empty)
                 {
-                    fprintf(stderr, SH_PROGRAM_NAME ": error: unable to pipe %s to (NULL COMMAND)\n", command->argv[0]);
+                    *last_pipeline = pipeline;
+                    last_pipeline = &pipeline->next_pipeline;
                 }
 
-                return command;
-
-            // Enter special interpretation mode with quotes
-            case '\'': case '\"':
-                quote = *end;
-                shell_command_add_argument(command, begin, end);
-                begin = end + 1;
+                condition = token.type == SH_TOKEN_AND || token.type == SH_TOKEN_OR ? token.type : 0;
+                pipeline = NULL;
                 break;
 
-            // If redirection character is seen, add it as its own argument
-            case '>':
-                shell_command_add_argument(command, begin, end);
-                begin = end;
-                if(end[1] == '>') ++end;
-                shell_command_add_argument(command, begin, end + 1);
-                begin = end + 1;
-                break;
+            case SH_TOKEN_UNSUPPORTED:
+                message = shell_arena_alloc(arena, 64);
+                snprintf(message, 64, "unable to redirect: '%s' isn't supported", token.text);
+                shell_line_error(line, message);
+                return;
 
-            case '<':
-                shell_command_add_argument(command, begin, end);
-                begin = end;
-                shell_command_add_argument(command, begin, end + 1);
-                begin = end + 1;
-                break;
-
-            // Null characters end the command
-            case '\0':
-                shell_command_add_argument(command, begin, end);
-                return command;
+            // The word after a redirect is the file to redirect to / from
+            default:
+                more = shell_lexer_next(lexer, &path);
 
-            case '\\':
-                switch(end[1])
+                if(path.type == SH_TOKEN_WORD)
                 {
-                    // Escape codes built into the commands
-                    case 'a': end[1] = '\a'; remove_char(end); break;
-                    case 'b': end[1] = '\b'; remove_char(end); break;
-                    case 'f': end[1] = '\f'; remove_char(end); break;
-                    case 'n': end[1] = '\n'; remove_char(end); break;
-                    case 'r': end[1] = '\r'; remove_char(end); break;
-                    case 't': end[1] = '\t'; remove_char(end); break;
-                    case 'v': end[1] = '\v'; remove_char(end); break;
-                    default: remove_char(end); break;
+                    last_redirect = shell_command_add_redirect(arena, last_redirect, token.type, path.text);
+                    break;
                 }
-                break;
 
-            default:
-                break;
+                shell_line_error(line, "unable to redirect: missing file name");
+                return;
         }
-    }
 
-    return command;
+        if(more) more = shell_lexer_next(lexer, &token);
+    }
 }
 
 /**
- * @brief scan arguments for redirections, and add them to the command
- * 
- * @param command command to add redirections to
- * @return pointer to the command which has the redirections in it
+ * @brief give the arena of a line back, keeping it for the next line if it is small enough
+ *
+ * @param line the line to free
  */
-struct shell_command* shell_command_add_redirects(struct shell_command* command)
+static void shell_line_release(struct shell_line* line)
 {
-    int i;
-    int status, fd;
+    struct shell_arena* arena = line->arena;
 
-    if(command)
+    if(spare_arena == NULL && shell_arena_capacity(arena) <= SH_ARENA_KEEP_LIMIT)
     {
-        for(i = 0; i < command->argc - 1; ++i)
-        {
-            status = 0;
-
-            // Check for the different types of redirection and update status
-            // If there was already a redirection, add -1 as a status.
-            if(strcmp(command->argv[i], ">") == 0)
-            {
-                if(command->redir_stdout != SH_STDOUT) status = -1;
-                else status = 1, fd = open(command->argv[i + 1], O_WRONLY | O_CREAT, 0666);
-            }
-
-            else if(strcmp(command->argv[i], ">>") == 0)
-            {
-                if(command->redir_stdout != SH_STDOUT) status = -1;
-                else status = 2, fd = open(command->argv[i + 1], O_WRONLY | O_APPEND | O_CREAT, 0666);
-            }
-
-            else if(strcmp(command->argv[i], "<") == 0)
-            {
-                if(command->redir_stdin != SH_STDIN) status = -1;
-                else status = 3, fd = open(command->argv[i + 1], O_RDONLY);
-            }
-
-            // Depending on the status, do different things
-            switch (status)
-            {
-            case 0: 
-                break;
+        shell_arena_reset(arena);
+        spare_arena = arena;
+    }
+    else shell_arena_free(arena);
+}
 
-            case -1:
-                fprintf(stderr, SH_PROGRAM_NAME ": error: unable to redirect %s: command already redirected / piped\n", command->argv[i + 1]);
+/**
+ * @brief parse a shell_line from a string
+ *
+ * lines that were parsed before are looked up in the parse cache first,
+ * and are returned without being parsed again. the cache is direct mapped,
+ * so a new line replaces whatever line had the same slot.
+ *
+ * every part of the line is allocated in a single arena,
+ * which is sized from the length of the line so that it usually
+ * only needs one block. the arena of the last freed line is reused when it is big enough.
+ *
+ * @param text the line you want to parse
+ * @return the parsed shell_line
+ */
+struct shell_line* shell_line_create(const char *text)
+{
+    struct shell_arena* arena;
+    struct shell_line *line, **slot;
+    struct shell_lexer lexer;
 
-                command->argc -= 2;
-                free(command->argv[i]); remove_word(&command->argv[i]);
-                free(command->argv[i]); remove_word(&command->argv[i]);
-                --i;
+    size_t length = strlen(text);
+    unsigned long hash = shell_hash(text, length);
+    size_t size = sizeof(struct shell_line) + 4 * (sizeof(struct shell_pipeline) + sizeof(struct shell_command) + SH_INITIAL_ARGS * sizeof(char*)) + (2 + sizeof(char*)) * length + 2;
 
-                break;
-            
-            default:
-                if(fd < 0)
-                {
-                    fprintf(stderr, SH_PROGRAM_NAME ": error: unable to redirect %s: %s [%d]\n", command->argv[i + 1], strerror(errno), errno);
-                } else
-                {
-                    if(status == 3) command->redir_stdin = fd;
-                    else command->redir_stdout = fd;
-                }
+    slot = &parse_cache[hash % SH_PARSE_CACHE_SIZE];
+    line = parse_cache_enabled ? *slot : NULL;
 
-                command->argc -= 2;
-                free(command->argv[i]); remove_word(&command->argv[i]);
-                free(command->argv[i]); remove_word(&command->argv[i]);
-                --i;
-                
-                break;
-            }
-        }
+    if(line && line->hash == hash && line->length == length && memcmp(line->text, text, length) == 0) return line;
+
+    if(spare_arena && shell_arena_capacity(spare_arena) >= size)
+    {
+        arena = spare_arena;
+        spare_arena = NULL;
+    }
+    else arena = shell_arena_create(size);
+
+    line = shell_arena_alloc(arena, sizeof(struct shell_line));
+    line->arena = arena;
+    line->text = shell_arena_strndup(arena, text, length);
+    line->length = length;
+    line->hash = hash;
+    line->cached = SH_FALSE;
+
+    shell_lexer_init(&lexer, arena, line->text, length);
+    shell_line_parse(line, &lexer);
+
+    if(parse_cache_enabled && length <= SH_PARSE_CACHE_MAX_LINE)
+    {
+        if(*slot) shell_line_release(*slot);
 
-        return command;
+        line->cached = SH_TRUE;
+        *slot = line;
     }
-    
-    return NULL;
+
+    return line;
 }
 
 /**
- * @brief free an individual command from the list of commands
- * 
- * this command frees a shell_command struct, by:
- *  1) freeing all of the strings in the command
- *  2) freeing the allocated memory
- *  3) returning the next command
- * 
- * @param command the command you want to free
- * @return the next command in the chain
+ * @brief turn the parse cache on or off
+ *
+ * turning it off forgets every cached line, so every line is parsed from scratch,
+ * which is what the parser benchmarks and the fuzzer measure.
+ * lines that were returned from the cache must not be used after this.
+ *
+ * @param enabled SH_TRUE to cache parsed lines, SH_FALSE to parse every line again
  */
-struct shell_command* shell_command_free_individual(struct shell_command* command)
+void shell_set_parse_cache(int enabled)
 {
     int i;
-    struct shell_command* next_command;
-
-    // If the command is not NULL, free the current command
-    // and then return the next command in the chain
-    if(command)
-    {
-        next_command = command->next_command;
-        
-        safe_close(command->redir_stdin, SH_STDIN);
-        safe_close(command->redir_stdout, SH_STDOUT);
-        safe_close(command->redir_stderr, SH_STDERR);
 
-        for(i = 0; i < SH_MAX_ARGS; ++i)
-            free(command->argv[i]);
+    parse_cache_enabled = enabled;
+    if(enabled) return;
 
-        free(command);
-
-        return next_command;
+    for(i = 0; i < SH_PARSE_CACHE_SIZE; ++i)
+    {
+        if(parse_cache[i]) shell_line_release(parse_cache[i]);
+        parse_cache[i] = NULL;
     }
-
-    else return NULL;
 }
 
 /**
- * @brief free every command in the shell_command chain
- * 
- * @param command the list of commands you want to free
+ * @brief free a line after it has been run
+ *
+ * the whole line lives in one arena, so it is freed with a single reset.
+ * lines in the parse cache are kept until they are replaced.
+ *
+ * @param line the line you want to free
  */
-void shell_command_free(struct shell_command* command)
-{ 
-    // Free all the commands until we hit the end of the chain
-    while((command = shell_command_free_individual(command)));
-}
\ No newline at end of file
+void shell_line_free(struct shell_line* line)
+{
+    if(line == NULL || line->cached) return;
+
+    shell_line_release(line);
+}
@@ -11,29 +11,81 @@
 #include <errno.h>
 
 #include "constants.h"
+#include "shell_arena.h"
+#include "shell_lexer.h"
 
+// A redirect written in a command, which is only opened when the command runs
+struct shell_redirect
+{
+    // SH_TOKEN_REDIRECT_IN, SH_TOKEN_REDIRECT_OUT or SH_TOKEN_REDIRECT_APPEND
+    int type;
+    char* path;
+
+    struct shell_redirect* next;
+};
+
+// A single command of a pipeline, with its arguments and redirects.
+// Nothing in here is touched when the command runs, so a parsed line can be run again.
 struct shell_command 
 {
+    // argv lives in the arena and is sized to the arguments of the command,
+    // doubling whenever it runs out of room
+    char** argv;
     int argc;
-    char* argv[SH_MAX_ARGS + 1];
+    int argv_capacity;
 
-    int redir_stdin;
-    int redir_stdout;
-    int redir_stderr;
+    // Redirects in the order they were written
+    struct shell_redirect* redirects;
 
+    // Next command in the pipeline, stdout of this command is piped into it
     struct shell_command* next_command;
 };
 
-// Initialize shell command
-struct shell_command* shell_command_create(char *);
+// Commands separated by '|'
+struct shell_pipeline
+{
+    struct shell_command* commands;
+    int length;
+
+    // SH_TRUE if the pipeline ended with '&', so the shell doesn't wait for it
+    int background;
+
+    // SH_TOKEN_AND if the pipeline only runs when the one before it succeeded,
+    // SH_TOKEN_OR if it only runs when the one before it failed, or 0 if it always runs
+    int condition;
+
+    // Next pipeline in the line, separated by ';', '&', '&&', '||' or '\n'
+    struct shell_pipeline* next_pipeline;
+};
+
+// Every pipeline parsed from a single line of input
+struct shell_line
+{
+    struct shell_pipeline* pipelines;
+
+    // Why the line couldn't be parsed, or NULL. a line with an error has no pipelines,
+    // and the error is reported every time the line is run, even out of the parse cache
+    const char* error;
+
+    // The text that was parsed, which is the key of the parse cache
+    char* text;
+    size_t length;
+    unsigned long hash;
+
+    // SH_TRUE if the line belongs to the parse cache, and must not be freed after it runs
+    int cached;
+
+    // Arena that the line and everything in it are allocated in
+    struct shell_arena* arena;
+};
 
-// Scan arguments for redirections, and add them to the command
-struct shell_command* shell_command_add_redirects(struct shell_command*);
+// Parse a line, or return the already parsed line if it is in the cache
+struct shell_line* shell_line_create(const char *);
 
-// Free command and return the next command in the chain
-struct shell_command* shell_command_free_individual(struct shell_command*);
+// Free a line once it has been run, unless it is in the cache
+void shell_line_free(struct shell_line*);
 
-// Free the entire chain of commands.
-void shell_command_free(struct shell_command*);
+// Turn the parse cache on or off, turning it off forgets every cached line
+void shell_set_parse_cache(int enabled);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "shell_hash.h"
+
+#define SH_HASH_OFFSET 2166136261UL
+#define SH_HASH_PRIME 16777619UL
+
+/**
+ * @brief hash some text with FNV-1a
+ *
+ * @param text the text to hash
+ * @param length the number of characters in the text
+ * @return the hash of the text
+ */
+unsigned long shell_hash(const char* text, size_t length)
+{
+    unsigned long hash = SH_HASH_OFFSET;
+    size_t i;
+
+    for(i = 0; i < length; ++i)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= SH_HASH_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief hash a null terminated string with FNV-1a, without finding its length first
+ *
+ * @param text the string to hash
+ * @return the hash of the string
+ */
+unsigned long shell_hash_string(const char* text)
+{
+    unsigned long hash = SH_HASH_OFFSET;
+
+    for(; *text; ++text)
+    {
+        hash ^= (unsigned char)*text;
+        hash *= SH_HASH_PRIME;
+    }
+
+    return hash;
+}
@@ -0,0 +1,12 @@
+#ifndef SHELL_HASH_HEADER_FILE
+#define SHELL_HASH_HEADER_FILE 1
+
+#include <stddef.h>
+
+// FNV-1a hash of length bytes of text, which the parse, path and builtin caches are indexed by
+unsigned long shell_hash(const char* text, size_t length);
+
+// FNV-1a hash of a null terminated string, the same as shell_hash(...) over its characters
+unsigned long shell_hash_string(const char* text);
+
+#endif
@@ -0,0 +1,367 @@
+#include "shell_job.h"
+
+// Every job, a job lives in slot id - 1 so finding it by id never searches
+static struct shell_job shell_jobs[SH_JOB_MAX];
+
+// Counts up every time a job starts
+static unsigned long shell_job_sequence = 0;
+
+/**
+ * @brief turn the status from waitpid(...) into an exit status, the same way pipelines do
+ */
+static int shell_job_decode(int status)
+{
+    if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+/**
+ * @brief reap every stage of a job that has exited, without blocking
+ *
+ * this is called from the SIGCHLD handler, so it only uses waitpid(...).
+ * only the pids of the job are waited on, so the foreground commands
+ * that the shell is waiting on itself are never taken away from it.
+ *
+ * @param job the job to reap
+ */
+static void shell_job_reap(struct shell_job* job)
+{
+    int k, status;
+
+    for(k = 0; k < job->length && job->running > 0; ++k)
+    {
+        if(job->status[k] != SH_JOB_RUNNING) continue;
+
+        if(waitpid(job->pids[k], &status, WNOHANG) == job->pids[k])
+        {
+            job->status[k] = shell_job_decode(status);
+            --job->running;
+        }
+    }
+}
+
+/**
+ * @brief reap the stages of every job that exited
+ *
+ * the shell blocks SIGCHLD whenever it changes the table,
+ * so the handler always sees whole jobs.
+ */
+static void shell_job_sigchld(int signal)
+{
+    int i, error = errno;
+
+    for(i = 0; i < SH_JOB_MAX; ++i)
+        if(shell_jobs[i].id && shell_jobs[i].running > 0) shell_job_reap(&shell_jobs[i]);
+
+    errno = error;
+}
+
+/**
+ * @brief stop the SIGCHLD handler from running while the job table changes
+ *
+ * @param old where the signal mask to restore is stored
+ */
+static void shell_job_block(sigset_t* old)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, old);
+}
+
+/**
+ * @brief install the SIGCHLD handler, the first time a job is added
+ *
+ * SA_RESTART keeps a finished job from interrupting the read of the next line
+ * or a foreground waitpid(...).
+ */
+static void shell_job_init()
+{
+    static int installed = SH_FALSE;
+    struct sigaction action;
+
+    if(installed) return;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = shell_job_sigchld;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGCHLD, &action, NULL);
+    installed = SH_TRUE;
+}
+
+/**
+ * @brief add a word to the text of a job, after a space unless it is the first word
+ *
+ * @param text the text to add to, or NULL to only measure it
+ * @param length the length of the text so far
+ * @param word the word to add
+ * @return the length of the text with the word
+ */
+static size_t shell_job_append(char* text, size_t length, const char* word)
+{
+    size_t size = strlen(word);
+
+    if(length)
+    {
+        if(text) text[length] = ' ';
+        ++length;
+    }
+
+    if(text) memcpy(text + length, word, size);
+    return length + size;
+}
+
+/**
+ * @brief write the commands of a pipeline into text, or only measure them if text is NULL
+ *
+ * @return the length of the text, without its null terminator
+ */
+static size_t shell_job_text(const struct shell_pipeline* pipeline, char* text)
+{
+    struct shell_command* command;
+    struct shell_redirect* redirect;
+    size_t length = 0;
+    int i;
+
+    for(command = pipeline->commands; command; command = command->next_command)
+    {
+        if(command != pipeline->commands) length = shell_job_append(text, length, "|");
+
+        for(i = 0; i < command->argc; ++i) length = shell_job_append(text, length, command->argv[i]);
+
+        for(redirect = command->redirects; redirect; redirect = redirect->next)
+        {
+            length = shell_job_append(text, length, redirect->type == SH_TOKEN_REDIRECT_IN ? "<" : redirect->type == SH_TOKEN_REDIRECT_APPEND ? ">>" : ">");
+            length = shell_job_append(text, length, redirect->path);
+        }
+    }
+
+    if(text) text[length] = '\0';
+    return length;
+}
+
+/**
+ * @brief forget a job, only call this with SIGCHLD blocked
+ */
+static void shell_job_release(struct shell_job* job)
+{
+    free(job->pids);
+    job->pids = NULL;
+    job->id = 0;
+}
+
+/**
+ * @brief add a pipeline that was started in the background to the job table
+ *
+ * the pids, statuses and text of the job share a single allocation.
+ * a stage can exit before its job is in the table, and its SIGCHLD is then
+ * already gone, so the job is reaped once as soon as it has been added.
+ *
+ * @param pipeline the pipeline that was started
+ * @param stages the started stages, a pid of -1 means the stage never started
+ * @return the id of the job, or -1 if the table is full
+ */
+int shell_job_add(const struct shell_pipeline* pipeline, const struct shell_process* stages)
+{
+    struct shell_job* job = NULL;
+    size_t text_length = shell_job_text(pipeline, NULL);
+    sigset_t old;
+    char* memory;
+    int i;
+
+    shell_job_init();
+
+    for(i = 0; i < SH_JOB_MAX && job == NULL; ++i)
+        if(shell_jobs[i].id == 0) job = &shell_jobs[i];
+
+    if(job == NULL) return -1;
+
+    memory = malloc(pipeline->length * (sizeof(pid_t) + sizeof(int)) + text_length + 1);
+    if(memory == NULL) return -1;
+
+    shell_job_block(&old);
+
+    job->pids = (pid_t*)memory;
+    job->status = (int*)(memory + pipeline->length * sizeof(pid_t));
+    job->text = memory + pipeline->length * (sizeof(pid_t) + sizeof(int));
+    job->length = pipeline->length;
+    job->running = 0;
+    job->started = ++shell_job_sequence;
+    shell_job_text(pipeline, job->text);
+
+    for(i = 0; i < pipeline->length; ++i)
+    {
+        job->pids[i] = stages[i].pid;
+
+        if(stages[i].pid > 0)
+        {
+            job->status[i] = SH_JOB_RUNNING;
+            ++job->running;
+        }
+        else job->status[i] = stages[i].status ? stages[i].status : 127;
+    }
+
+    job->id = job - shell_jobs + 1;
+    shell_job_reap(job);
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return job->id;
+}
+
+/**
+ * @brief print a line about a job, like "[1]  Running    sleep 10"
+ */
+static void shell_job_print_one(int out, const struct shell_job* job)
+{
+    int status = job->status[job->length - 1];
+
+    if(job->running > 0) dprintf(out, "[%d]  Running    %s\n", job->id, job->text);
+    else if(status == 0) dprintf(out, "[%d]  Done       %s\n", job->id, job->text);
+    else dprintf(out, "[%d]  Exit %-5d %s\n", job->id, status, job->text);
+}
+
+/**
+ * @brief print and forget every job that finished, right before the prompt is shown
+ */
+void shell_job_notify()
+{
+    sigset_t old;
+    int i;
+
+    if(shell_job_sequence == 0) return;
+
+    shell_job_block(&old);
+
+    for(i = 0; i < SH_JOB_MAX; ++i)
+    {
+        if(shell_jobs[i].id == 0 || shell_jobs[i].running > 0) continue;
+
+        shell_job_print_one(SH_STDERR, &shell_jobs[i]);
+        shell_job_release(&shell_jobs[i]);
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * @brief print every job, and forget the ones that finished
+ *
+ * @param out the file descriptor to print to
+ */
+void shell_job_print(int out)
+{
+    sigset_t old;
+    int i;
+
+    shell_job_block(&old);
+
+    for(i = 0; i < SH_JOB_MAX; ++i)
+    {
+        if(shell_jobs[i].id == 0) continue;
+
+        shell_job_print_one(out, &shell_jobs[i]);
+        if(shell_jobs[i].running == 0) shell_job_release(&shell_jobs[i]);
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * @return the id of the job that was started last, or 0 if there are no jobs
+ */
+int shell_job_last()
+{
+    unsigned long started = 0;
+    int i, id = 0;
+
+    for(i = 0; i < SH_JOB_MAX; ++i)
+    {
+        if(shell_jobs[i].id && shell_jobs[i].started > started)
+        {
+            started = shell_jobs[i].started;
+            id = shell_jobs[i].id;
+        }
+    }
+
+    return id;
+}
+
+/**
+ * @param id the id of the job
+ * @return the commands of the job, or NULL if there is no such job
+ */
+const char* shell_job_command(int id)
+{
+    if(id <= 0 || id > SH_JOB_MAX || shell_jobs[id - 1].id == 0) return NULL;
+    return shell_jobs[id - 1].text;
+}
+
+/**
+ * @brief find a job from a job spec
+ *
+ * %n is job n, %% and %+ are the last job that was started,
+ * and anything else is the pid of one of the stages of a job.
+ *
+ * @param spec the job spec
+ * @return the id of the job, or 0 if there is no such job
+ */
+int shell_job_find(const char* spec)
+{
+    char* end;
+    long number;
+    int i, k;
+
+    if(strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) return shell_job_last();
+
+    number = strtol(spec + (spec[0] == '%'), &end, 10);
+    if(*end != '\0' || end == spec + (spec[0] == '%') || number <= 0) return 0;
+
+    if(spec[0] == '%') return number <= SH_JOB_MAX && shell_jobs[number - 1].id ? number : 0;
+
+    for(i = 0; i < SH_JOB_MAX; ++i)
+        for(k = 0; shell_jobs[i].id && k < shell_jobs[i].length; ++k)
+            if(shell_jobs[i].pids[k] == number) return shell_jobs[i].id;
+
+    return 0;
+}
+
+/**
+ * @brief wait for every stage of a job that hasn't been reaped, and then forget the job
+ *
+ * SIGCHLD stays blocked while waiting, so the handler can't reap
+ * a stage out from under the blocking waitpid(...).
+ *
+ * @param id the id of the job
+ * @return the exit status of the last stage of the job, or 127 if there is no such job
+ */
+int shell_job_wait(int id)
+{
+    struct shell_job* job;
+    sigset_t old;
+    pid_t reaped;
+    int k, status;
+
+    if(id <= 0 || id > SH_JOB_MAX || shell_jobs[id - 1].id == 0) return 127;
+    job = &shell_jobs[id - 1];
+
+    shell_job_block(&old);
+
+    for(k = 0; k < job->length; ++k)
+    {
+        if(job->status[k] != SH_JOB_RUNNING) continue;
+
+        reaped = shell_waitpid(job->pids[k], &status);
+
+        job->status[k] = reaped == job->pids[k] ? shell_job_decode(status) : 127;
+        --job->running;
+    }
+
+    status = job->status[job->length - 1];
+    shell_job_release(job);
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return status;
+}
@@ -0,0 +1,54 @@
+#ifndef SHELL_JOB_HEADER_FILE
+#define SHELL_JOB_HEADER_FILE 1
+
+#include "shell.h"
+
+// Most pipelines that can run in the background at once
+#define SH_JOB_MAX (1 << 6)
+
+// Status of a stage that is still running
+#define SH_JOB_RUNNING -1
+
+// A pipeline that was started with '&', and is reaped by the SIGCHLD handler
+struct shell_job
+{
+    // 1 + the slot of the job in the table, or 0 if the slot is free
+    int id;
+
+    // The pid and exit status of every stage, status is SH_JOB_RUNNING until it is reaped
+    pid_t* pids;
+    int* status;
+    int length;
+
+    // Number of stages that haven't been reaped yet
+    int running;
+
+    // The commands of the pipeline, for jobs and the notice when it finishes
+    char* text;
+
+    // Order the jobs were started in, so that %% finds the newest one
+    unsigned long started;
+};
+
+// Add a pipeline whose stages have all been started to the job table, returns its id or -1
+int shell_job_add(const struct shell_pipeline*, const struct shell_process* stages);
+
+// Print and forget every job that finished since the last call
+void shell_job_notify();
+
+// Print every job, like bash's jobs builtin, and forget the ones that finished
+void shell_job_print(int out);
+
+// Find a job from %n, %%, %+ or the pid of one of its stages, returns its id or 0
+int shell_job_find(const char* spec);
+
+// Id of the most recently started job, or 0 if there are none
+int shell_job_last();
+
+// The commands of a job, or NULL if there is no such job
+const char* shell_job_command(int id);
+
+// Wait for every stage of a job, then forget it, returns the exit status of its last stage
+int shell_job_wait(int id);
+
+#endif
@@ -0,0 +1,313 @@
+#include "shell_lexer.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SH_LEXER_X86 1
+#endif
+
+// Bytes that end a run of ordinary characters outside of quotes
+#define SH_LEXER_DELIMITERS " ;\n|&'\"<>\\"
+
+// Most bytes that the scanners ever look for at once
+#define SH_LEXER_MAX_SET 16
+
+/**
+ * @brief find the first byte of a run that is in a set of bytes
+ *
+ * this is used at the end of a run that is too short for a vector,
+ * and on machines without SSE2.
+ *
+ * @param run the bytes to scan
+ * @param length the number of bytes in the run
+ * @param set the bytes to look for
+ * @param set_size the number of bytes in set
+ * @return the index of the first byte in the set, or length if there isn't one
+ */
+static size_t shell_lexer_scan_scalar(const char* run, size_t length, const char* set, size_t set_size)
+{
+    size_t i;
+
+    for(i = 0; i < length; ++i)
+        if(memchr(set, run[i], set_size)) break;
+
+    return i;
+}
+
+#ifdef __SSE2__
+/**
+ * @brief find the first byte of a run that is in a set of bytes, 16 bytes at a time
+ *
+ * every block is compared against every byte of the set,
+ * and the first match is found from the movemask of all of the comparisons.
+ *
+ * @param run the bytes to scan
+ * @param length the number of bytes in the run
+ * @param set the bytes to look for
+ * @param set_size the number of bytes in set
+ * @return the index of the first byte in the set, or length if there isn't one
+ */
+static size_t shell_lexer_scan_sse2(const char* run, size_t length, const char* set, size_t set_size)
+{
+    __m128i needles[SH_LEXER_MAX_SET], block, hits;
+    size_t i, k;
+    int mask;
+
+    for(k = 0; k < set_size; ++k) needles[k] = _mm_set1_epi8(set[k]);
+
+    for(i = 0; i + sizeof(__m128i) <= length; i += sizeof(__m128i))
+    {
+        block = _mm_loadu_si128((const __m128i*)(run + i));
+
+        hits = _mm_cmpeq_epi8(block, needles[0]);
+        for(k = 1; k < set_size; ++k) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[k]));
+
+        mask = _mm_movemask_epi8(hits);
+        if(mask) return i + __builtin_ctz(mask);
+    }
+
+    return i + shell_lexer_scan_scalar(run + i, length - i, set, set_size);
+}
+#endif
+
+#ifdef SH_LEXER_X86
+/**
+ * @brief find the first byte of a run that is in a set of bytes, 32 bytes at a time
+ *
+ * this is the same as shell_lexer_scan_sse2(...), but it is only
+ * called once the cpu has been checked for AVX2.
+ *
+ * @param run the bytes to scan
+ * @param length the number of bytes in the run
+ * @param set the bytes to look for
+ * @param set_size the number of bytes in set
+ * @return the index of the first byte in the set, or length if there isn't one
+ */
+__attribute__((target("avx2")))
+static size_t shell_lexer_scan_avx2(const char* run, size_t length, const char* set, size_t set_size)
+{
+    __m256i needles[SH_LEXER_MAX_SET], block, hits;
+    size_t i, k;
+    unsigned int mask;
+
+    for(k = 0; k < set_size; ++k) needles[k] = _mm256_set1_epi8(set[k]);
+
+    for(i = 0; i + sizeof(__m256i) <= length; i += sizeof(__m256i))
+    {
+        block = _mm256_loadu_si256((const __m256i*)(run + i));
+
+        hits = _mm256_cmpeq_epi8(block, needles[0]);
+        for(k = 1; k < set_size; ++k) hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[k]));
+
+        mask = _mm256_movemask_epi8(hits);
+        if(mask) return i + __builtin_ctz(mask);
+    }
+
+    return i + shell_lexer_scan_scalar(run + i, length - i, set, set_size);
+}
+#endif
+
+/**
+ * @brief find the first byte of a run that is in a set of bytes
+ *
+ * the widest scanner the cpu supports is picked the first time this is called.
+ *
+ * @param run the bytes to scan
+ * @param length the number of bytes in the run
+ * @param set the bytes to look for, null terminated
+ * @return the index of the first byte in the set, or length if there isn't one
+ */
+static size_t shell_lexer_scan(const char* run, size_t length, const char* set)
+{
+    static size_t (*scan)(const char*, size_t, const char*, size_t) = NULL;
+
+    if(scan == NULL)
+    {
+        scan = shell_lexer_scan_scalar;
+#ifdef __SSE2__
+        scan = shell_lexer_scan_sse2;
+#endif
+#ifdef SH_LEXER_X86
+        if(__builtin_cpu_supports("avx2")) scan = shell_lexer_scan_avx2;
+#endif
+    }
+
+    return scan(run, length, set, strlen(set));
+}
+
+/**
+ * @param c the character after a backslash
+ * @return the character that the escape stands for
+ */
+static char shell_lexer_escape(char c)
+{
+    switch(c)
+    {
+        // Escape codes built into the commands
+        case 'a': return '\a';
+        case 'b': return '\b';
+        case 'f': return '\f';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case 'v': return '\v';
+        default: return c;
+    }
+}
+
+/**
+ * @brief start lexing a line
+ *
+ * every word of the line is followed by at least one delimiter or the end of the line,
+ * and escapes only ever make a word shorter, so length + 1 bytes is enough room
+ * for the text of every word and its null terminator.
+ *
+ * @param lexer the lexer to initialize
+ * @param arena the arena to allocate the text of the words in
+ * @param line the line to lex
+ * @param length the number of characters in the line
+ */
+void shell_lexer_init(struct shell_lexer* lexer, struct shell_arena* arena, const char* line, size_t length)
+{
+    lexer->line = line;
+    lexer->position = 0;
+    lexer->length = length;
+    lexer->quote = '\0';
+    lexer->out = shell_arena_alloc(arena, length + 1);
+}
+
+/**
+ * @brief finish the word that starts at word, and store it in the token
+ *
+ * @return 1 if there was a word, 0 if it was empty
+ */
+static int shell_lexer_word(struct shell_lexer* lexer, char* word, struct shell_token* token)
+{
+    if(lexer->out == word) return 0;
+
+    *lexer->out++ = '\0';
+
+    token->type = SH_TOKEN_WORD;
+    token->text = word;
+    token->length = lexer->out - word - 1;
+    return 1;
+}
+
+/**
+ * @brief read the next token from the line
+ *
+ * the lexer jumps from delimiter to delimiter with shell_lexer_scan(...),
+ * copying the ordinary bytes in between with a single memcpy, so every byte
+ * of the line is only looked at once. it looks for a couple of things, these things are:
+ *
+ *  1) ' & " - to ignore special characters between quotes
+ *  2) ' ' - to separate arguments
+ *  3) '\n' & ';' - to separate commands, and '&' to separate them and run the one before in the background
+ *  4) '|' - to pipe commands
+ *  5) '&&' & '||' - to separate commands, where the next one depends on the exit status of the one before
+ *  6) '>', '>>', '<' - allow redirection without spaces surrounding the redirects
+ *  7) '\' - allow escape characters
+ *
+ * '>&', '<&' and '&>' are read as a single token that the parser rejects,
+ * so that a redirect like 2>&1 never turns into a background job.
+ *
+ * when a delimiter that is its own token ends a word, the word is returned first
+ * and the delimiter is read again by the next call.
+ *
+ * @param lexer the lexer to read from
+ * @param token where the token is stored
+ * @return 0 once the end of the line has been reached, 1 otherwise
+ */
+int shell_lexer_next(struct shell_lexer* lexer, struct shell_token* token)
+{
+    const char* line = lexer->line;
+    char quotes[3] = { '\0', '\\', '\0' };
+    char* word = lexer->out;
+    size_t run;
+    char c, next;
+
+    while(1)
+    {
+        // Copy everything up to the next byte that means something
+        quotes[0] = lexer->quote;
+        run = shell_lexer_scan(line + lexer->position, lexer->length - lexer->position, lexer->quote ? quotes : SH_LEXER_DELIMITERS);
+
+        memcpy(lexer->out, line + lexer->position, run);
+        lexer->out += run;
+        lexer->position += run;
+
+        // The end of the line ends the last word, even inside of a quote
+        if(lexer->position == lexer->length)
+        {
+            if(shell_lexer_word(lexer, word, token)) return 1;
+
+            token->type = SH_TOKEN_END;
+            return 0;
+        }
+
+        c = line[lexer->position++];
+
+        // A backslash at the very end of the line has nothing to escape
+        if(c == '\\')
+        {
+            if(lexer->position < lexer->length) *lexer->out++ = shell_lexer_escape(line[lexer->position++]);
+            continue;
+        }
+
+        // Inside of quotes, the only other thing that matters is the end of the quote
+        if(lexer->quote)
+        {
+            lexer->quote = '\0';
+            if(shell_lexer_word(lexer, word, token)) return 1;
+            continue;
+        }
+
+        switch(c)
+        {
+            // If there is a space, just end the word
+            case ' ':
+                if(shell_lexer_word(lexer, word, token)) return 1;
+                break;
+
+            // Enter special interpretation mode with quotes
+            case '\'': case '\"':
+                lexer->quote = c;
+                if(shell_lexer_word(lexer, word, token)) return 1;
+                break;
+
+            // Everything else is its own token
+            default:
+                if(shell_lexer_word(lexer, word, token))
+                {
+                    --lexer->position;
+                    return 1;
+                }
+
+                next = lexer->position < lexer->length ? line[lexer->position] : '\0';
+
+                if(c == ';' || c == '\n') token->type = SH_TOKEN_SEPARATOR;
+                else if(c == '&' && next == '&') token->type = SH_TOKEN_AND;
+                else if(c == '|' && next == '|') token->type = SH_TOKEN_OR;
+                else if(c == '>' && next == '>') token->type = SH_TOKEN_REDIRECT_APPEND;
+                else if((c == '>' || c == '<') && next == '&') token->type = SH_TOKEN_UNSUPPORTED;
+                else if(c == '&' && next == '>') token->type = SH_TOKEN_UNSUPPORTED;
+                else if(c == '&') token->type = SH_TOKEN_BACKGROUND;
+                else if(c == '|') token->type = SH_TOKEN_PIPE;
+                else if(c == '<') token->type = SH_TOKEN_REDIRECT_IN;
+                else token->type = SH_TOKEN_REDIRECT_OUT;
+
+                // Operators that are two bytes long take the second one too
+                if(token->type == SH_TOKEN_AND || token->type == SH_TOKEN_OR || token->type == SH_TOKEN_REDIRECT_APPEND || token->type == SH_TOKEN_UNSUPPORTED)
+                    ++lexer->position;
+
+                if(token->type == SH_TOKEN_UNSUPPORTED)
+                {
+                    token->text = c == '&' ? "&>" : c == '>' ? ">&" : "<&";
+                    token->length = 2;
+                }
+
+                return 1;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef SHELL_LEXER_HEADER_FILE
+#define SHELL_LEXER_HEADER_FILE 1
+
+#include <stddef.h>
+
+#include "shell_arena.h"
+
+// Types of tokens the lexer emits
+#define SH_TOKEN_END 0
+#define SH_TOKEN_WORD 1
+#define SH_TOKEN_SEPARATOR 2
+#define SH_TOKEN_PIPE 3
+#define SH_TOKEN_REDIRECT_IN 4
+#define SH_TOKEN_REDIRECT_OUT 5
+#define SH_TOKEN_REDIRECT_APPEND 6
+#define SH_TOKEN_BACKGROUND 7
+#define SH_TOKEN_AND 8
+#define SH_TOKEN_OR 9
+
+// '>&', '<&' and '&>', which would move one file descriptor onto another.
+// the text of the token is the operator, so the parser can say which one it was
+#define SH_TOKEN_UNSUPPORTED 10
+
+struct shell_token
+{
+    int type;
+
+    // Only set for words, the text is null terminated and lives in the arena
+    int length;
+    char* text;
+};
+
+// Splits a line into tokens in a single pass.
+// Escapes are resolved while the words are copied out,
+// so the line itself is never modified.
+struct shell_lexer
+{
+    const char* line;
+    size_t position;
+    size_t length;
+
+    // The quote that is currently open, or '\0'
+    char quote;
+
+    // Where the text of the next word is written
+    char* out;
+};
+
+// Start lexing a line, the text of every word is allocated in the arena
+void shell_lexer_init(struct shell_lexer*, struct shell_arena*, const char* line, size_t length);
+
+// Read the next token, returns 0 once SH_TOKEN_END has been reached
+int shell_lexer_next(struct shell_lexer*, struct shell_token*);
+
+#endif
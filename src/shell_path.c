@@ -0,0 +1,185 @@
+#include "shell_path.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "constants.h"
+#include "shell_hash.h"
+
+// Commands that have been looked up, found with linear probing
+static struct shell_path_entry path_cache[SH_PATH_CACHE_SIZE];
+static int path_cache_count = 0;
+
+// Value of $PATH when the cache was filled
+static char* path_cache_env = NULL;
+
+/**
+ * @brief copy a string, exiting if there is no memory left
+ *
+ * @param str the string to copy
+ * @return the copy
+ */
+static char* shell_path_strdup(const char* str)
+{
+    char* copy = strdup(str);
+
+    if(copy == NULL)
+    {
+        fprintf(stderr, SH_PROGRAM_NAME ": fatal error: unable to allocate memory. exiting...\n");
+        exit(-1);
+    }
+
+    return copy;
+}
+
+/**
+ * @param path the path to check
+ * @return SH_TRUE if path is a regular file that can be executed
+ */
+static int shell_path_executable(const char* path)
+{
+    struct stat info;
+
+    return stat(path, &info) == 0 && S_ISREG(info.st_mode) && access(path, X_OK) == 0;
+}
+
+/**
+ * @brief search every directory of $PATH for a command, the same way execvp does
+ *
+ * an empty directory in $PATH means the current directory.
+ *
+ * @param name the name of the command
+ * @param env the value of $PATH
+ * @return the path of the command, which has to be freed, or NULL if it wasn't found
+ */
+static char* shell_path_search(const char* name, const char* env)
+{
+    const char *dir, *end;
+    char* path;
+    size_t dir_size, name_size = strlen(name);
+
+    for(dir = env;; dir = end + 1)
+    {
+        end = strchr(dir, ':');
+        if(end == NULL) end = dir + strlen(dir);
+
+        dir_size = end - dir;
+
+        path = malloc(dir_size + name_size + 3);
+        if(path == NULL) return NULL;
+
+        if(dir_size == 0) sprintf(path, "./%s", name);
+        else sprintf(path, "%.*s/%s", (int)dir_size, dir, name);
+
+        if(shell_path_executable(path)) return path;
+        free(path);
+
+        if(*end == '\0') return NULL;
+    }
+}
+
+/**
+ * @brief forget every command in the cache
+ */
+void shell_path_clear()
+{
+    int i;
+
+    for(i = 0; i < SH_PATH_CACHE_SIZE; ++i)
+    {
+        free(path_cache[i].name);
+        free(path_cache[i].path);
+
+        path_cache[i].name = NULL;
+        path_cache[i].path = NULL;
+        path_cache[i].hits = 0;
+    }
+
+    path_cache_count = 0;
+
+    free(path_cache_env);
+    path_cache_env = NULL;
+}
+
+/**
+ * @brief find the path to execute a command at
+ *
+ * names with a '/' in them are already paths, and are returned as they are.
+ * everything else is looked up in the cache first, and $PATH is only searched if:
+ *
+ *  1) the command isn't in the cache
+ *  2) $PATH changed since the cache was filled, which clears the whole cache
+ *  3) the cached path doesn't exist anymore, or wasn't found last time
+ *
+ * the cache is cleared when it gets 3/4 full, so probing always stays short.
+ *
+ * @param name the name of the command
+ * @return the path of the command, or NULL if it can't be found
+ */
+const char* shell_path_lookup(const char* name)
+{
+    struct shell_path_entry* entry;
+    const char* env = getenv("PATH");
+    unsigned long slot;
+
+    if(strchr(name, '/')) return name;
+
+    // Same default as execvp
+    if(env == NULL) env = "/bin:/usr/bin";
+
+    if(path_cache_env == NULL || strcmp(path_cache_env, env) != 0 || path_cache_count >= SH_PATH_CACHE_SIZE / 4 * 3)
+    {
+        shell_path_clear();
+        path_cache_env = shell_path_strdup(env);
+    }
+
+    for(slot = shell_hash_string(name);; ++slot)
+    {
+        entry = &path_cache[slot & (SH_PATH_CACHE_SIZE - 1)];
+
+        if(entry->name == NULL)
+        {
+            entry->name = shell_path_strdup(name);
+            ++path_cache_count;
+            break;
+        }
+
+        if(strcmp(entry->name, name) == 0) break;
+    }
+
+    if(entry->path && shell_path_executable(entry->path))
+    {
+        ++entry->hits;
+        return entry->path;
+    }
+
+    free(entry->path);
+    entry->path = shell_path_search(name, env);
+    entry->hits = entry->path != NULL;
+
+    return entry->path;
+}
+
+/**
+ * @brief print every command in the cache
+ *
+ * @param file the file to print to
+ */
+void shell_path_print(FILE* file)
+{
+    int i;
+
+    if(path_cache_count == 0)
+    {
+        fprintf(file, "hash: hash table empty\n");
+        return;
+    }
+
+    fprintf(file, "hits\tcommand\n");
+    for(i = 0; i < SH_PATH_CACHE_SIZE; ++i)
+    {
+        if(path_cache[i].path) fprintf(file, "%4u\t%s\n", path_cache[i].hits, path_cache[i].path);
+    }
+}
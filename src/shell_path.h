@@ -0,0 +1,30 @@
+#ifndef SHELL_PATH_HEADER_FILE
+#define SHELL_PATH_HEADER_FILE 1
+
+#include <stdio.h>
+
+// Number of commands the cache can hold, this must be a power of 2
+#define SH_PATH_CACHE_SIZE (1 << 8)
+
+// A command that was found in $PATH
+struct shell_path_entry
+{
+    char* name;
+
+    // NULL if the command wasn't found the last time it was looked up
+    char* path;
+
+    unsigned int hits;
+};
+
+// Find the path to execute a command at, or NULL if it isn't in $PATH.
+// the path stays valid until the next call.
+const char* shell_path_lookup(const char* name);
+
+// Forget every command in the cache
+void shell_path_clear();
+
+// Print every command in the cache, like bash's hash builtin
+void shell_path_print(FILE*);
+
+#endif